@@ -3,11 +3,14 @@
 
 #include <cstddef>
 #include <ctime>
+#include <functional>
 #include <memory>
 #include <string>
 #include <sys/types.h>
 #include <vector>
 
+#include "backend/byteranges.h"
+
 namespace cache_fs {
 
 struct FileInfo {
@@ -22,15 +25,50 @@ public:
     virtual ~Backend() = default;
     virtual int init(const std::string& base_url, const std::string& bearer_token = "") = 0;
     virtual ssize_t download(const std::string& path, char* buffer, std::size_t size, off_t offset) = 0;
+    // Starts the same read and returns at once; done gets what download
+    // would have returned, possibly on another thread. buffer must stay
+    // valid until then.
+    virtual void download_async(const std::string& path, char* buffer, std::size_t size, off_t offset,
+                                std::function<void(ssize_t)> done) {
+        done(download(path, buffer, size, offset));
+    }
+    // Reads every span of path, in one request where the origin allows it.
+    // done gets what each span's download would have returned, in order.
+    // The default issues a download_async per span.
+    virtual void download_ranges_async(const std::string& path, std::vector<ByteSpan> spans,
+                                       std::function<void(std::vector<ssize_t>)> done);
     virtual ssize_t upload(const std::string& path, const char* buffer, std::size_t size, off_t offset) = 0;
     virtual int remove(const std::string& path) = 0;
+    // Expected seconds to fetch len bytes of path again, from observed
+    // latency and throughput of earlier fetches.
+    virtual double refetch_cost(const std::string& path, std::size_t len) const = 0;
 };
 
 std::shared_ptr<Backend> create_backend(const std::string& url);
 
 ssize_t backend_read_range(const std::string& path, char* buf, std::size_t len, off_t off);
+// Calls done with the result of the read once it completes, -ENODEV at
+// once without a backend. Any number may be in flight; they share one
+// event loop rather than a thread each.
+void    backend_read_range_async(const std::string& path, char* buf, std::size_t len, off_t off,
+                                 std::function<void(ssize_t)> done);
+// The same for several spans of one file; -ENODEV for each without a
+// backend.
+void    backend_read_ranges_async(const std::string& path, std::vector<ByteSpan> spans,
+                                  std::function<void(std::vector<ssize_t>)> done);
 ssize_t backend_put_range (const std::string& path, const char* buf, std::size_t len, off_t off);
 int     backend_delete    (const std::string& path);
+double  backend_refetch_cost(const std::string& path, std::size_t len);
+// Most requests in flight to any one origin at a time, over every backend
+// in the process (CurlPool::kDefaultPerOrigin unless set). Requests beyond
+// it queue until one finishes. Returns -EINVAL for 0.
+int     backend_set_origin_concurrency(std::size_t limit);
+// Block fetches still running past the given percentile of the origin's
+// recent latency are sent a second time and the first answer wins; at most
+// max_fraction of them are (95 and TransferEngine::kDefaultHedgeBudget
+// unless set). A percentile of 0 turns hedging off. Returns -EINVAL for a
+// percentile outside [0, 100) or a fraction outside [0, 1].
+int     backend_set_hedging(double percentile, double max_fraction);
 
 }
 
@@ -0,0 +1,226 @@
+#include "backend/byteranges.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+namespace cache_fs {
+
+namespace {
+
+// Part headers are short; anything longer is not a multipart body.
+constexpr std::size_t kMaxLine = 4096;
+
+bool starts_with_nocase(const std::string& s, const char* prefix) {
+    std::size_t n = std::strlen(prefix);
+    if (s.size() < n) return false;
+    for (std::size_t i = 0; i < n; ++i) {
+        if (std::tolower(static_cast<unsigned char>(s[i])) != std::tolower(static_cast<unsigned char>(prefix[i])))
+            return false;
+    }
+    return true;
+}
+
+std::string trim(const std::string& s) {
+    std::size_t b = s.find_first_not_of(" \t");
+    if (b == std::string::npos) return "";
+    std::size_t e = s.find_last_not_of(" \t\r\n");
+    return s.substr(b, e - b + 1);
+}
+
+// boundary parameter of a multipart Content-Type, unquoted
+std::string boundary_of(const std::string& content_type) {
+    std::size_t pos = 0;
+    while ((pos = content_type.find(';', pos)) != std::string::npos) {
+        std::string param = trim(content_type.substr(pos + 1));
+        pos += 1;
+        if (!starts_with_nocase(param, "boundary=")) continue;
+        std::string value = param.substr(9);
+        value = value.substr(0, value.find(';'));
+        value = trim(value);
+        if (value.size() >= 2 && value.front() == '"' && value.back() == '"') value = value.substr(1, value.size() - 2);
+        return value;
+    }
+    return "";
+}
+
+}
+
+ByteRangeSink::ByteRangeSink(std::vector<ByteSpan> spans) : spans_(std::move(spans)), got_(spans_.size(), 0) {}
+
+std::string ByteRangeSink::rangeHeader(const std::vector<ByteSpan>& spans) {
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> ranges;   // [first, end)
+    for (const ByteSpan& s : spans) {
+        if (s.len) ranges.emplace_back(s.off, s.off + s.len);
+    }
+    std::sort(ranges.begin(), ranges.end());
+    std::string header;
+    for (std::size_t i = 0; i < ranges.size();) {
+        std::uint64_t first = ranges[i].first, end = ranges[i].second;
+        for (++i; i < ranges.size() && ranges[i].first <= end; ++i) end = std::max(end, ranges[i].second);
+        if (!header.empty()) header += ',';
+        header += std::to_string(first) + "-" + std::to_string(end - 1);
+    }
+    return header;
+}
+
+bool ByteRangeSink::parseContentRange(const std::string& value, std::uint64_t& first, std::uint64_t& last) {
+    std::string v = trim(value);
+    if (!starts_with_nocase(v, "bytes ")) return false;
+    const char* p = v.c_str() + 6;
+    char* end;
+    errno = 0;
+    unsigned long long a = std::strtoull(p, &end, 10);
+    if (end == p || *end != '-') return false;
+    p = end + 1;
+    unsigned long long b = std::strtoull(p, &end, 10);
+    if (end == p || *end != '/' || errno || b < a) return false;
+    first = a;
+    last  = b;
+    return true;
+}
+
+bool ByteRangeSink::begin(long status, const std::string& content_type, const std::string& content_range) {
+    line_.clear();
+    part_range_ = false;
+    if (status == 200) {
+        // the whole resource, ranges ignored
+        state_ = State::Single;
+        at_    = 0;
+        left_  = std::numeric_limits<std::uint64_t>::max();
+        return true;
+    }
+    if (status != 206) {
+        // an error body; nothing of it belongs in the buffers
+        state_ = State::Done;
+        return true;
+    }
+    if (starts_with_nocase(trim(content_type), "multipart/byteranges")) {
+        std::string boundary = boundary_of(content_type);
+        if (boundary.empty()) {
+            state_ = State::Failed;
+            return false;
+        }
+        delimiter_ = "--" + boundary;
+        state_     = State::Delimiter;
+        return true;
+    }
+    std::uint64_t first, last;
+    if (parseContentRange(content_range, first, last)) {
+        at_   = first;
+        left_ = last - first + 1;
+    } else {
+        // a 206 without Content-Range can only be the one range asked for
+        at_ = std::numeric_limits<std::uint64_t>::max();
+        for (const ByteSpan& s : spans_) {
+            if (s.len) at_ = std::min<std::uint64_t>(at_, s.off);
+        }
+        left_ = std::numeric_limits<std::uint64_t>::max();
+    }
+    state_ = State::Single;
+    return true;
+}
+
+void ByteRangeSink::scatter(std::uint64_t at, const char* data, std::size_t n) {
+    for (std::size_t i = 0; i < spans_.size(); ++i) {
+        const ByteSpan& s = spans_[i];
+        std::uint64_t lo = std::max<std::uint64_t>(at, s.off);
+        std::uint64_t hi = std::min<std::uint64_t>(at + n, s.off + s.len);
+        if (lo >= hi) continue;
+        std::memcpy(s.buf + (lo - s.off), data + (lo - at), hi - lo);
+        got_[i] = std::max<std::size_t>(got_[i], hi - s.off);
+    }
+}
+
+// One complete line outside a part body, without its line ending.
+bool ByteRangeSink::line(const std::string& text) {
+    if (state_ == State::Delimiter) {
+        // anything before the first delimiter or between a body and the
+        // next one is padding
+        if (text.compare(0, delimiter_.size(), delimiter_) != 0) return true;
+        std::string rest = trim(text.substr(delimiter_.size()));
+        if (rest == "--") {
+            state_ = State::Done;
+        } else if (rest.empty()) {
+            state_      = State::PartHeaders;
+            part_range_ = false;
+        }
+        return true;
+    }
+    // State::PartHeaders
+    if (text.empty()) {
+        if (!part_range_) return false;
+        state_ = State::PartBody;
+        return true;
+    }
+    if (starts_with_nocase(text, "content-range:")) {
+        std::uint64_t first, last;
+        if (!parseContentRange(text.substr(14), first, last)) return false;
+        at_         = first;
+        left_       = last - first + 1;
+        part_range_ = true;
+    }
+    return true;
+}
+
+bool ByteRangeSink::feed(const char* data, std::size_t n) {
+    while (n) {
+        switch (state_) {
+        case State::Done:
+            return true;
+        case State::Failed:
+            return false;
+        case State::Single:
+        case State::PartBody: {
+            std::size_t take = static_cast<std::size_t>(std::min<std::uint64_t>(n, left_));
+            scatter(at_, data, take);
+            at_   += take;
+            left_ -= take;
+            data  += take;
+            n     -= take;
+            if (left_ == 0) state_ = state_ == State::PartBody ? State::Delimiter : State::Done;
+            break;
+        }
+        case State::Delimiter:
+        case State::PartHeaders: {
+            const char* nl = static_cast<const char*>(std::memchr(data, '\n', n));
+            std::size_t take = nl ? static_cast<std::size_t>(nl - data) + 1 : n;
+            line_.append(data, nl ? take - 1 : take);
+            data += take;
+            n    -= take;
+            if (line_.size() > kMaxLine) {
+                state_ = State::Failed;
+                return false;
+            }
+            if (!nl) break;
+            if (!line_.empty() && line_.back() == '\r') line_.pop_back();
+            bool ok = line(line_);
+            line_.clear();
+            if (!ok) {
+                state_ = State::Failed;
+                return false;
+            }
+            break;
+        }
+        }
+    }
+    return state_ != State::Failed;
+}
+
+bool ByteRangeSink::satisfied() const {
+    for (std::size_t i = 0; i < spans_.size(); ++i) {
+        if (got_[i] < spans_[i].len) return false;
+    }
+    return true;
+}
+
+std::size_t ByteRangeSink::total() const {
+    std::size_t sum = 0;
+    for (std::size_t g : got_) sum += g;
+    return sum;
+}
+
+}
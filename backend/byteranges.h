@@ -0,0 +1,69 @@
+#ifndef CACHE_FS_BYTERANGES_H
+#define CACHE_FS_BYTERANGES_H
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace cache_fs {
+
+// len bytes of a resource at off, read into buf.
+struct ByteSpan {
+    char*       buf = nullptr;
+    std::size_t len = 0;
+    off_t       off = 0;
+};
+
+// Scatters the body of a ranged GET into the buffers of the spans that asked
+// for it, as it arrives. The body is either one part at a known offset (a 206
+// with Content-Range, or a 200 carrying the whole resource from 0) or a
+// multipart/byteranges body whose parts each carry their own Content-Range.
+// Bytes no span asked for are dropped, so an origin that merges ranges or
+// ignores them altogether still fills the right buffers.
+class ByteRangeSink {
+public:
+    explicit ByteRangeSink(std::vector<ByteSpan> spans = {});
+
+    // Value for a Range header asking for every span, adjacent and
+    // overlapping ones merged ("0-99,200-299"); empty if no span has bytes.
+    static std::string rangeHeader(const std::vector<ByteSpan>& spans);
+    // Start and end (inclusive) of a "bytes a-b/total" Content-Range.
+    static bool parseContentRange(const std::string& value, std::uint64_t& first, std::uint64_t& last);
+
+    // Called once the final response's headers are in; false if a body of
+    // that shape cannot be read.
+    bool begin(long status, const std::string& content_type, const std::string& content_range);
+    // False once the body turns out to be malformed.
+    bool feed(const char* data, std::size_t n);
+    // Every span has all its bytes, so the rest of a whole-resource body
+    // is not needed.
+    bool satisfied() const;
+
+    const std::vector<ByteSpan>& spans() const { return spans_; }
+    // Bytes written into each span, from its start.
+    const std::vector<std::size_t>& got() const { return got_; }
+    std::size_t total() const;
+
+private:
+    enum class State { Single, Delimiter, PartHeaders, PartBody, Done, Failed };
+
+    void scatter(std::uint64_t at, const char* data, std::size_t n);
+    bool line(const std::string& text);
+
+    std::vector<ByteSpan>    spans_;
+    std::vector<std::size_t> got_;
+
+    State         state_ = State::Failed;
+    std::string   delimiter_;            // "--" + boundary
+    std::string   line_;
+    std::uint64_t at_   = 0;             // resource offset of the next body byte
+    std::uint64_t left_ = 0;             // bytes left in the current part
+    bool          part_range_ = false;
+};
+
+}
+
+#endif
@@ -0,0 +1,126 @@
+#include "backend/curl_pool.h"
+
+#include <algorithm>
+
+namespace cache_fs {
+
+CurlPool::Handle& CurlPool::Handle::operator=(Handle&& other) noexcept {
+    if (this != &other) {
+        release();
+        pool_   = other.pool_;
+        origin_ = other.origin_;
+        curl_   = other.curl_;
+        other.curl_ = nullptr;
+    }
+    return *this;
+}
+
+void CurlPool::Handle::release() {
+    if (!curl_) return;
+    pool_->giveBack(*origin_, curl_);
+    curl_ = nullptr;
+}
+
+CurlPool::CurlPool(std::size_t max_per_origin) : max_per_origin_(std::max<std::size_t>(max_per_origin, 1)) {
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    share_ = curl_share_init();
+    if (!share_) return;
+    curl_share_setopt(share_, CURLSHOPT_LOCKFUNC, lockShare);
+    curl_share_setopt(share_, CURLSHOPT_UNLOCKFUNC, unlockShare);
+    curl_share_setopt(share_, CURLSHOPT_USERDATA, this);
+    curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+}
+
+// Handles still lent out at this point are leaked rather than freed under
+// their borrower.
+CurlPool::~CurlPool() {
+    std::lock_guard<std::mutex> g(mu_);
+    for (auto& [name, origin] : origins_) {
+        for (CURL* curl : origin->idle) curl_easy_cleanup(curl);
+        origin->idle.clear();
+    }
+    if (share_) curl_share_cleanup(share_);
+}
+
+void CurlPool::lockShare(CURL*, curl_lock_data data, curl_lock_access, void* pool) {
+    static_cast<CurlPool*>(pool)->share_mu_[data].lock();
+}
+
+void CurlPool::unlockShare(CURL*, curl_lock_data data, void* pool) {
+    static_cast<CurlPool*>(pool)->share_mu_[data].unlock();
+}
+
+// Options every request relies on; everything else is set per request.
+void CurlPool::applyDefaults(CURL* curl) {
+    if (share_) curl_easy_setopt(curl, CURLOPT_SHARE, share_);
+    // many threads use handles at once, so no SIGALRM-based DNS timeouts
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(curl, CURLOPT_TCP_NODELAY, 1L);
+}
+
+CurlPool::Handle CurlPool::acquire(const std::string& url) {
+    std::unique_lock<std::mutex> lk(mu_);
+    auto& slot = origins_[originOf(url)];
+    if (!slot) slot = std::make_unique<Origin>();
+    Origin& origin = *slot;
+    origin.cv.wait(lk, [&] { return origin.lent < max_per_origin_; });
+
+    CURL* curl = nullptr;
+    if (!origin.idle.empty()) {
+        curl = origin.idle.back();
+        origin.idle.pop_back();
+    } else {
+        curl = curl_easy_init();
+        if (!curl) return Handle();
+        ++created_;
+        applyDefaults(curl);
+    }
+    ++origin.lent;
+    return Handle(this, &origin, curl);
+}
+
+void CurlPool::giveBack(Origin& origin, CURL* curl) {
+    // resetting keeps the connection, only the options are cleared
+    curl_easy_reset(curl);
+    applyDefaults(curl);
+    {
+        std::lock_guard<std::mutex> g(mu_);
+        origin.idle.push_back(curl);
+        --origin.lent;
+    }
+    origin.cv.notify_one();
+}
+
+void CurlPool::setMaxPerOrigin(std::size_t n) {
+    std::lock_guard<std::mutex> g(mu_);
+    max_per_origin_ = std::max<std::size_t>(n, 1);
+    // waiters re-check against the new limit
+    for (auto& [name, origin] : origins_) origin->cv.notify_all();
+}
+
+std::size_t CurlPool::maxPerOrigin() const {
+    std::lock_guard<std::mutex> g(mu_);
+    return max_per_origin_;
+}
+
+std::size_t CurlPool::created() const {
+    std::lock_guard<std::mutex> g(mu_);
+    return created_;
+}
+
+std::string CurlPool::originOf(const std::string& url) {
+    std::size_t scheme = url.find("://");
+    if (scheme == std::string::npos) return url;
+    std::size_t end = url.find_first_of("/?#", scheme + 3);
+    return end == std::string::npos ? url : url.substr(0, end);
+}
+
+CurlPool& shared_curl_pool() {
+    static CurlPool pool;
+    return pool;
+}
+
+}
@@ -0,0 +1,97 @@
+#ifndef CACHE_FS_CURL_POOL_H
+#define CACHE_FS_CURL_POOL_H
+
+#include <curl/curl.h>
+
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace cache_fs {
+
+// Reusable curl easy handles, kept per origin (scheme://host:port). A handle
+// goes back to the pool after each request with its connection still open,
+// so the next request to that origin skips the TCP (and TLS) handshake. All
+// handles share one DNS cache, connection cache and TLS session cache.
+//
+// At most max_per_origin handles of one origin are lent out at a time;
+// acquire() waits for one to come back beyond that, which also bounds the
+// connections the pool opens to that origin.
+class CurlPool {
+    struct Origin;
+
+public:
+    static constexpr std::size_t kDefaultPerOrigin = 8;
+
+    // A lent handle, returned to the pool when destroyed. Options set on it
+    // are reset on return.
+    class Handle {
+    public:
+        Handle() = default;
+        Handle(Handle&& other) noexcept { *this = std::move(other); }
+        Handle& operator=(Handle&& other) noexcept;
+        ~Handle() { release(); }
+
+        CURL* get() const { return curl_; }
+        explicit operator bool() const { return curl_ != nullptr; }
+
+    private:
+        friend class CurlPool;
+        Handle(CurlPool* pool, Origin* origin, CURL* curl) : pool_(pool), origin_(origin), curl_(curl) {}
+        void release();
+
+        CurlPool* pool_   = nullptr;
+        Origin*   origin_ = nullptr;
+        CURL*     curl_   = nullptr;
+    };
+
+    explicit CurlPool(std::size_t max_per_origin = kDefaultPerOrigin);
+    ~CurlPool();
+
+    // Handle for a request to url, empty if curl cannot create one.
+    Handle acquire(const std::string& url);
+    void setMaxPerOrigin(std::size_t n);
+    std::size_t maxPerOrigin() const;
+    // Easy handles created so far, over all origins.
+    std::size_t created() const;
+
+    // "scheme://host:port" part of url, as far as it can be told without
+    // a full parse; the whole url if it has no scheme.
+    static std::string originOf(const std::string& url);
+
+private:
+    struct Origin {
+        std::vector<CURL*>      idle;
+        std::size_t             lent = 0;
+        std::condition_variable cv;
+    };
+
+    void giveBack(Origin& origin, CURL* curl);
+    void applyDefaults(CURL* curl);
+    static void lockShare(CURL*, curl_lock_data data, curl_lock_access, void* pool);
+    static void unlockShare(CURL*, curl_lock_data data, void* pool);
+
+    CURLSH* share_ = nullptr;
+    std::mutex share_mu_[CURL_LOCK_DATA_LAST];
+
+    mutable std::mutex mu_;
+    // origins are never erased, so Handle can keep a plain pointer
+    std::unordered_map<std::string, std::unique_ptr<Origin>> origins_;
+    std::size_t max_per_origin_;
+    std::size_t created_ = 0;
+
+    CurlPool(const CurlPool&) = delete;
+    CurlPool& operator=(const CurlPool&) = delete;
+};
+
+// The pool every HttpBackend in the process draws from, so origin limits
+// hold across backends talking to the same server.
+CurlPool& shared_curl_pool();
+
+}
+
+#endif
@@ -1,34 +1,24 @@
 #include "backend/backend.h"
+#include "backend/curl_pool.h"
+#include "backend/latency_histogram.h"
+#include "backend/transfer_engine.h"
 
 #define ENABLE_PUT
 
 #include <curl/curl.h>
 #include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
 #include <cstring>
 #include <mutex>
 #include <memory>
+#include <unordered_map>
 
 namespace cache_fs {
 
 namespace {
 
-struct SliceWriter {
-    char*  dst;
-    size_t cap;
-    size_t pos;
-};
-
-size_t write_slice_cb(void* ptr, size_t sz, size_t nm, void* ud) {
-    auto* sw   = static_cast<SliceWriter*>(ud);
-    size_t n   = sz * nm;
-    size_t cpy = std::min(n, sw->cap - sw->pos);
-    if (cpy) {
-        memcpy(sw->dst + sw->pos, ptr, cpy);
-        sw->pos += cpy;
-    }
-    return n;
-}
-
 #ifdef ENABLE_PUT
 struct UploadBuf {
     const char* data;
@@ -50,6 +40,85 @@ size_t read_upload_cb(char* ptr, size_t sz, size_t nm, void* ud) {
 
 static bool ok_2xx(long code) { return code / 100 == 2; }
 
+// Latency percentile past which a block fetch is hedged; 0 turns hedging off.
+std::atomic<double> g_hedge_percentile{95.0};
+
+// Per-span results of reads that complete separately; done runs once the
+// last one is in.
+class SpanResults {
+public:
+    SpanResults(std::size_t n, std::function<void(std::vector<ssize_t>)> done)
+        : got_(n, -1), left_(n), done_(std::move(done)) {}
+
+    void set(std::size_t i, ssize_t n) {
+        {
+            std::lock_guard<std::mutex> g(mu_);
+            got_[i] = n;
+            if (--left_ != 0) return;
+        }
+        done_(std::move(got_));
+    }
+
+private:
+    std::mutex mu_;
+    std::vector<ssize_t> got_;
+    std::size_t left_;
+    std::function<void(std::vector<ssize_t>)> done_;
+};
+
+// Exponentially weighted time-to-first-byte and transfer rate.
+struct FetchEwma {
+    static constexpr double kAlpha = 0.2;
+
+    double latency = 0.0;
+    double rate    = 0.0;
+    bool   seen    = false;
+
+    void add(double ttfb, double total, std::size_t bytes) {
+        double xfer = total - ttfb;
+        double r    = (xfer > 0 && bytes > 0) ? bytes / xfer : 0.0;
+        if (!seen) {
+            latency = ttfb;
+            rate    = r;
+            seen    = true;
+            return;
+        }
+        latency += kAlpha * (ttfb - latency);
+        if (r > 0) rate = rate > 0 ? rate + kAlpha * (r - rate) : r;
+    }
+
+    double cost(std::size_t bytes) const {
+        return latency + (rate > 0 ? bytes / rate : 0.0);
+    }
+};
+
+// Per-file fetch statistics with the origin-wide figure as fallback for files
+// not fetched yet. The per-file table is reset when it grows too large.
+class FetchStats {
+public:
+    static constexpr std::size_t kMaxFiles     = 65536;
+    static constexpr double      kDefaultCost  = 0.05;
+
+    void record(const std::string& path, std::size_t bytes, double ttfb, double total) {
+        std::lock_guard<std::mutex> lk(mu_);
+        origin_.add(ttfb, total, bytes);
+        if (files_.size() >= kMaxFiles && !files_.count(path)) files_.clear();
+        files_[path].add(ttfb, total, bytes);
+    }
+
+    double cost(const std::string& path, std::size_t bytes) const {
+        std::lock_guard<std::mutex> lk(mu_);
+        auto it = files_.find(path);
+        if (it != files_.end()) return it->second.cost(bytes);
+        return origin_.seen ? origin_.cost(bytes) : kDefaultCost;
+    }
+
+private:
+    mutable std::mutex mu_;
+    FetchEwma origin_;
+    std::unordered_map<std::string, FetchEwma> files_;
+};
+
 }
 
 class HttpBackend : public Backend {
@@ -61,40 +130,49 @@ public:
         return 0;
     }
 
+    // Waits on the engine rather than running the transfer on this thread.
     ssize_t download(const std::string& path, char* buffer, std::size_t size, off_t offset) override {
-        CURL* curl = curl_easy_init();
-        if (!curl) return -1;
+        std::mutex mu;
+        std::condition_variable cv;
+        bool finished = false;
+        ssize_t got = -1;
+        download_async(path, buffer, size, offset, [&](ssize_t n) {
+            std::lock_guard<std::mutex> g(mu);
+            got = n;
+            finished = true;
+            // notified under the lock, so the waiter cannot return and
+            // destroy cv first
+            cv.notify_one();
+        });
+        std::unique_lock<std::mutex> lk(mu);
+        cv.wait(lk, [&] { return finished; });
+        return got;
+    }
 
-        std::string url = base_url_ + path;
-        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-        curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+    void download_async(const std::string& path, char* buffer, std::size_t size, off_t offset,
+                        std::function<void(ssize_t)> done) override {
+        fetch(path, {ByteSpan{buffer, size, offset}}, [done = std::move(done)](const TransferEngine::Result& res) {
+            done(res.bytes < 0 ? -1 : res.bytes);
+        });
+    }
 
-        if (size != 0) {
-            std::string range = std::to_string(offset) + "-" + std::to_string(offset + size - 1);
-            curl_easy_setopt(curl, CURLOPT_RANGE, range.c_str());
+    // Spans go out kMaxRangesPerRequest at a time, so no Range header
+    // grows past what origins accept.
+    void download_ranges_async(const std::string& path, std::vector<ByteSpan> spans,
+                               std::function<void(std::vector<ssize_t>)> done) override {
+        if (spans.empty()) {
+            done({});
+            return;
         }
-
-        struct curl_slist* hdrs = nullptr;
-        if (!bearer_token_.empty()) {
-            hdrs = curl_slist_append(hdrs, ("Authorization: Bearer " + bearer_token_).c_str());
+        auto results = std::make_shared<SpanResults>(spans.size(), std::move(done));
+        for (std::size_t first = 0; first < spans.size(); first += kMaxRangesPerRequest) {
+            std::size_t last = std::min(spans.size(), first + kMaxRangesPerRequest);
+            std::vector<ByteSpan> batch(spans.begin() + first, spans.begin() + last);
+            fetch(path, std::move(batch), [results, first, last](const TransferEngine::Result& res) {
+                for (std::size_t i = first; i < last; ++i)
+                    results->set(i, res.bytes < 0 ? -1 : static_cast<ssize_t>(res.got[i - first]));
+            });
         }
-        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, hdrs);
-
-        SliceWriter sw{buffer, size, 0};
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_slice_cb);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &sw);
-
-        CURLcode cres = curl_easy_perform(curl);
-        long http_code = 0;
-        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-
-        curl_slist_free_all(hdrs);
-        curl_easy_cleanup(curl);
-
-        if (cres != CURLE_OK || !ok_2xx(http_code))
-            return -1;
-
-        return static_cast<ssize_t>(sw.pos);
     }
 
     ssize_t upload(const std::string& path, const char* buffer, std::size_t size, off_t offset) override {
@@ -102,10 +180,11 @@ public:
         (void)path; (void)buffer; (void)size; (void)offset;
         return -ENOSYS;
 #else
-        CURL* curl = curl_easy_init();
-        if (!curl) return -1;
-
         std::string url = base_url_ + path;
+        CurlPool::Handle handle = pool_.acquire(url);
+        if (!handle) return -1;
+        CURL* curl = handle.get();
+
         curl_easy_setopt(curl, CURLOPT_URL,    url.c_str());
         curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L);
         curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
@@ -128,7 +207,6 @@ public:
         curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
 
         curl_slist_free_all(hdrs);
-        curl_easy_cleanup(curl);
 
         return (cres == CURLE_OK && ok_2xx(http_code)) ? static_cast<ssize_t>(size) : -1;
 #endif
@@ -139,10 +217,11 @@ public:
         (void)path;
         return -ENOSYS;
 #else
-        CURL* curl = curl_easy_init();
-        if (!curl) return -1;
-
         std::string url = base_url_ + path;
+        CurlPool::Handle handle = pool_.acquire(url);
+        if (!handle) return -1;
+        CURL* curl = handle.get();
+
         curl_easy_setopt(curl, CURLOPT_URL,           url.c_str());
         curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "DELETE");
         curl_easy_setopt(curl, CURLOPT_FAILONERROR,   1L);
@@ -158,44 +237,139 @@ public:
         curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
 
         if (hdrs) curl_slist_free_all(hdrs);
-        curl_easy_cleanup(curl);
 
         return (cres == CURLE_OK && ok_2xx(http_code)) ? 0 : -1;
 #endif
     }
 
+    double refetch_cost(const std::string& path, std::size_t len) const override {
+        return stats_->cost(path, len);
+    }
+
 private:
+    static constexpr std::size_t kMaxRangesPerRequest = 16;
+    // Fetches up to this size are block misses and prefetch windows, whose
+    // latency is mostly the origin's and worth hedging; bulk chunks are
+    // larger and bound by bandwidth, which a duplicate would only split.
+    static constexpr std::size_t kHedgeMaxBytes = 256 * 1024;
+    // samples before the percentile is trusted
+    static constexpr double      kHedgeMinSamples = 20;
+    static constexpr double      kHedgeMinSeconds = 0.001;
+
+    // One GET of path for spans on the engine; done sees the raw result
+    // after the statistics have taken it in.
+    void fetch(const std::string& path, std::vector<ByteSpan> spans, TransferEngine::Completion done) {
+        TransferEngine::Request req;
+        req.url = base_url_ + path;
+        if (!bearer_token_.empty()) req.headers.push_back("Authorization: Bearer " + bearer_token_);
+        std::size_t bytes = 0;
+        for (const ByteSpan& s : spans) bytes += s.len;
+        bool hedgeable = bytes > 0 && bytes <= kHedgeMaxBytes;
+        double percentile = g_hedge_percentile.load(std::memory_order_relaxed);
+        if (hedgeable && percentile > 0 && latency_->count() >= kHedgeMinSamples)
+            req.hedge_after = std::max(latency_->percentile(percentile / 100), kHedgeMinSeconds);
+        req.spans = std::move(spans);
+        // holds the statistics, not the backend, which may be gone by then
+        req.done = [stats = stats_, latency = latency_, hedgeable, path, done = std::move(done)](const TransferEngine::Result& res) {
+            if (res.bytes >= 0) {
+                stats->record(path, res.bytes, res.ttfb, res.total);
+                if (hedgeable) latency->record(res.latency);
+            }
+            done(res);
+        };
+        engine_.submit(std::move(req));
+    }
+
     std::string base_url_;
     std::string bearer_token_;
+    std::shared_ptr<FetchStats> stats_ = std::make_shared<FetchStats>();
+    // of this origin's hedgeable fetches, hedged ones included
+    std::shared_ptr<LatencyHistogram> latency_ = std::make_shared<LatencyHistogram>();
+    // uploads and deletes borrow a handle per request; reads go through
+    // the engine
+    CurlPool&       pool_   = shared_curl_pool();
+    TransferEngine& engine_ = shared_transfer_engine();
 };
 
 
-static std::mutex g_mtx;
+// Transfers run without any lock: HttpBackend keeps no per-request state,
+// its statistics have their own lock, and the engine and the pool bound how
+// many requests each origin sees at once. Only swapping the backend itself is atomic.
 static std::shared_ptr<Backend> g_backend;
 
 std::shared_ptr<Backend> create_backend(const std::string& url) {
     auto b = std::make_shared<HttpBackend>();
     if (b->init(url) != 0) return nullptr;
-    std::lock_guard<std::mutex> lk(g_mtx);
-    g_backend = b;
+    std::atomic_store(&g_backend, std::shared_ptr<Backend>(b));
     return b;
 }
 
+int backend_set_origin_concurrency(std::size_t limit) {
+    if (limit == 0) return -EINVAL;
+    shared_curl_pool().setMaxPerOrigin(limit);
+    shared_transfer_engine().setMaxPerOrigin(limit);
+    return 0;
+}
+
+int backend_set_hedging(double percentile, double max_fraction) {
+    if (!(percentile >= 0 && percentile < 100) || !(max_fraction >= 0 && max_fraction <= 1)) return -EINVAL;
+    g_hedge_percentile.store(percentile, std::memory_order_relaxed);
+    shared_transfer_engine().setHedgeBudget(max_fraction);
+    return 0;
+}
+
 ssize_t backend_read_range(const std::string& path, char* buf, std::size_t len, off_t off) {
-    std::lock_guard<std::mutex> lk(g_mtx);
-    if (!g_backend) return -ENODEV;
-    return g_backend->download(path, buf, len, off);
+    auto b = std::atomic_load(&g_backend);
+    if (!b) return -ENODEV;
+    return b->download(path, buf, len, off);
+}
+
+void backend_read_range_async(const std::string& path, char* buf, std::size_t len, off_t off,
+                              std::function<void(ssize_t)> done) {
+    auto b = std::atomic_load(&g_backend);
+    if (!b) {
+        done(-ENODEV);
+        return;
+    }
+    b->download_async(path, buf, len, off, std::move(done));
+}
+
+void Backend::download_ranges_async(const std::string& path, std::vector<ByteSpan> spans,
+                                    std::function<void(std::vector<ssize_t>)> done) {
+    if (spans.empty()) {
+        done({});
+        return;
+    }
+    auto results = std::make_shared<SpanResults>(spans.size(), std::move(done));
+    for (std::size_t i = 0; i < spans.size(); ++i) {
+        download_async(path, spans[i].buf, spans[i].len, spans[i].off, [results, i](ssize_t n) { results->set(i, n); });
+    }
+}
+
+void backend_read_ranges_async(const std::string& path, std::vector<ByteSpan> spans,
+                               std::function<void(std::vector<ssize_t>)> done) {
+    auto b = std::atomic_load(&g_backend);
+    if (!b) {
+        done(std::vector<ssize_t>(spans.size(), -ENODEV));
+        return;
+    }
+    b->download_ranges_async(path, std::move(spans), std::move(done));
 }
 
 ssize_t backend_put_range(const std::string& path, const char* buf, std::size_t len, off_t off) {
-    std::lock_guard<std::mutex> lk(g_mtx);
-    if (!g_backend) return -ENODEV;
-    return g_backend->upload(path, buf, len, off);
+    auto b = std::atomic_load(&g_backend);
+    if (!b) return -ENODEV;
+    return b->upload(path, buf, len, off);
 }
 
 int backend_delete(const std::string& path) {
-    std::lock_guard<std::mutex> lk(g_mtx);
-    if (!g_backend) return -ENODEV;
-    return g_backend->remove(path);
+    auto b = std::atomic_load(&g_backend);
+    if (!b) return -ENODEV;
+    return b->remove(path);
+}
+
+double backend_refetch_cost(const std::string& path, std::size_t len) {
+    auto b = std::atomic_load(&g_backend);
+    return b ? b->refetch_cost(path, len) : FetchStats::kDefaultCost;
 }
 }
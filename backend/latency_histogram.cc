@@ -0,0 +1,46 @@
+#include "backend/latency_histogram.h"
+
+#include <cmath>
+
+namespace cache_fs {
+
+std::size_t LatencyHistogram::bucketOf(double seconds) {
+    if (!(seconds > kMinSeconds)) return 0;
+    double b = std::ceil(std::log(seconds / kMinSeconds) / std::log(kGrowth));
+    return b >= kBuckets - 1 ? kBuckets - 1 : static_cast<std::size_t>(b);
+}
+
+double LatencyHistogram::upperEdge(std::size_t bucket) {
+    return kMinSeconds * std::pow(kGrowth, static_cast<double>(bucket));
+}
+
+void LatencyHistogram::record(double seconds) {
+    std::lock_guard<std::mutex> g(mu_);
+    counts_[bucketOf(seconds)] += 1;
+    total_ += 1;
+    if (++since_halving_ < kHalfLife) return;
+    since_halving_ = 0;
+    total_ = 0;
+    for (double& c : counts_) {
+        c /= 2;
+        total_ += c;
+    }
+}
+
+double LatencyHistogram::percentile(double p) const {
+    std::lock_guard<std::mutex> g(mu_);
+    if (total_ <= 0) return 0;
+    double want = p * total_, seen = 0;
+    for (std::size_t b = 0; b < kBuckets; ++b) {
+        seen += counts_[b];
+        if (seen >= want && counts_[b] > 0) return upperEdge(b);
+    }
+    return upperEdge(kBuckets - 1);
+}
+
+double LatencyHistogram::count() const {
+    std::lock_guard<std::mutex> g(mu_);
+    return total_;
+}
+
+}
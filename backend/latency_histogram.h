@@ -0,0 +1,40 @@
+#ifndef CACHE_FS_LATENCY_HISTOGRAM_H
+#define CACHE_FS_LATENCY_HISTOGRAM_H
+
+#include <array>
+#include <cstddef>
+#include <mutex>
+
+namespace cache_fs {
+
+// Request latencies in log-spaced buckets, 10% apart from 100 us to about
+// 100 s, so any percentile is known to within a bucket. Counts are halved
+// every kHalfLife samples, so the histogram follows an origin whose latency
+// drifts. Thread-safe.
+class LatencyHistogram {
+public:
+    static constexpr double      kMinSeconds = 1e-4;
+    static constexpr double      kGrowth     = 1.1;
+    static constexpr std::size_t kBuckets    = 146;
+    static constexpr std::size_t kHalfLife   = 1024;
+
+    void record(double seconds);
+    // Upper edge of the bucket holding the p-quantile (0 < p < 1); 0 with
+    // no samples.
+    double percentile(double p) const;
+    // Samples currently weighing in, after decay.
+    double count() const;
+
+private:
+    static std::size_t bucketOf(double seconds);
+    static double upperEdge(std::size_t bucket);
+
+    mutable std::mutex mu_;
+    std::array<double, kBuckets> counts_{};
+    double      total_ = 0;
+    std::size_t since_halving_ = 0;
+};
+
+}
+
+#endif
@@ -9,22 +9,35 @@ import time
 import argparse
 import mimetypes
 import shutil
-from http.server import HTTPServer, BaseHTTPRequestHandler
+import threading
+import uuid
+from http.server import ThreadingHTTPServer, BaseHTTPRequestHandler
 from urllib.parse import urlparse, parse_qs
 
 class CacheAPIHandler(BaseHTTPRequestHandler):
+    # keep-alive, so clients that pool connections reuse them; every
+    # response therefore carries a Content-Length
+    protocol_version = 'HTTP/1.1'
+    # headers and body are separate writes; with Nagle on, the body of a
+    # small response waits for the client's delayed ACK
+    disable_nagle_algorithm = True
 
     def _send_json_response(self, code, data):
+        body = json.dumps(data).encode('utf-8')
         self.send_response(code)
         self.send_header('Content-Type', 'application/json')
+        self.send_header('Content-Length', str(len(body)))
         self.end_headers()
-        self.wfile.write(json.dumps(data).encode('utf-8'))
+        self.wfile.write(body)
 
     def _send_error_response(self, code, message):
+        self._send_json_response(code, {'error': message})
+
+    def _send_empty_response(self, code):
         self.send_response(code)
-        self.send_header('Content-Type', 'application/json')
+        if code != 204:
+            self.send_header('Content-Length', '0')
         self.end_headers()
-        self.wfile.write(json.dumps({'error': message}).encode('utf-8'))
 
     def _get_file_info(self, path):
         full_path = os.path.join(self.server.root_dir, path.lstrip('/'))
@@ -122,6 +135,15 @@ class CacheAPIHandler(BaseHTTPRequestHandler):
 
     def _handle_data_request(self, path):
         full_path = os.path.join(self.server.root_dir, path.lstrip('/'))
+        delay = self.server.delay
+        if self.server.slow_every:
+            # every Nth data request is a straggler, as from a busy origin
+            with self.server.slow_lock:
+                self.server.slow_count += 1
+                if self.server.slow_count % self.server.slow_every == 0:
+                    delay += self.server.slow_delay
+        if delay:
+            time.sleep(delay)
         
         if not os.path.isfile(full_path):
             self._send_error_response(404, f"File not found: {path}")
@@ -129,37 +151,20 @@ class CacheAPIHandler(BaseHTTPRequestHandler):
             
         try:
             range_header = self.headers.get('Range')
-            
-            if range_header:
-                range_match = range_header.strip().lower()
-                if range_match.startswith('bytes='):
-                    ranges = range_match[6:].split('-')
-                    start = int(ranges[0]) if ranges[0] else 0
-                    end = int(ranges[1]) if len(ranges) > 1 and ranges[1] else None
-                    
-                    file_size = os.path.getsize(full_path)
-                    
-                    if end is None:
-                        end = file_size - 1
-                    
-                    end = min(end, file_size - 1)
+            file_size = os.path.getsize(full_path)
+            ranges = self._parse_ranges(range_header, file_size) if range_header else None
 
-                    content_length = end - start + 1
-                    
-                    self.send_response(206)
-                    self.send_header('Content-Range', f'bytes {start}-{end}/{file_size}')
-                    self.send_header('Content-Length', str(content_length))
-                    
-                    content_type, _ = mimetypes.guess_type(full_path)
-                    if content_type:
-                        self.send_header('Content-Type', content_type)
+            if ranges is not None:
+                if not ranges:
+                    self.send_response(416)
+                    self.send_header('Content-Range', f'bytes */{file_size}')
+                    self.send_header('Content-Length', '0')
                     self.end_headers()
-                    
-                    with open(full_path, 'rb') as f:
-                        f.seek(start)
-                        self.wfile.write(f.read(content_length))
-                    
-                    return
+                elif len(ranges) == 1:
+                    self._send_single_range(full_path, ranges[0], file_size)
+                else:
+                    self._send_multiple_ranges(full_path, ranges, file_size)
+                return
             
             with open(full_path, 'rb') as f:
                 file_data = f.read()
@@ -175,6 +180,74 @@ class CacheAPIHandler(BaseHTTPRequestHandler):
         except Exception as e:
             self._send_error_response(500, str(e))
 
+    def _parse_ranges(self, header, file_size):
+        """(start, end) pairs of a bytes Range header, end inclusive, with
+        the unsatisfiable ones dropped; None if the header is not one we
+        understand, in which case the whole file is sent"""
+        header = header.strip().lower()
+        if not header.startswith('bytes='):
+            return None
+        ranges = []
+        for spec in header[6:].split(','):
+            first, sep, last = spec.strip().partition('-')
+            if not sep:
+                return None
+            try:
+                if first:
+                    start = int(first)
+                    end = int(last) if last else file_size - 1
+                else:
+                    # suffix range: the last N bytes
+                    start = max(file_size - int(last), 0)
+                    end = file_size - 1
+            except ValueError:
+                return None
+            if end < start:
+                return None
+            if start < file_size:
+                ranges.append((start, min(end, file_size - 1)))
+        return ranges
+
+    def _send_single_range(self, full_path, byte_range, file_size):
+        start, end = byte_range
+        content_length = end - start + 1
+        
+        self.send_response(206)
+        self.send_header('Content-Range', f'bytes {start}-{end}/{file_size}')
+        self.send_header('Content-Length', str(content_length))
+        
+        content_type, _ = mimetypes.guess_type(full_path)
+        if content_type:
+            self.send_header('Content-Type', content_type)
+        self.end_headers()
+        
+        with open(full_path, 'rb') as f:
+            f.seek(start)
+            self.wfile.write(f.read(content_length))
+
+    def _send_multiple_ranges(self, full_path, ranges, file_size):
+        """multipart/byteranges response, one part per range in the order
+        asked for"""
+        boundary = uuid.uuid4().hex
+        content_type, _ = mimetypes.guess_type(full_path)
+        body = bytearray()
+        with open(full_path, 'rb') as f:
+            for start, end in ranges:
+                body += f'--{boundary}\r\n'.encode('ascii')
+                if content_type:
+                    body += f'Content-Type: {content_type}\r\n'.encode('ascii')
+                body += f'Content-Range: bytes {start}-{end}/{file_size}\r\n\r\n'.encode('ascii')
+                f.seek(start)
+                body += f.read(end - start + 1)
+                body += b'\r\n'
+        body += f'--{boundary}--\r\n'.encode('ascii')
+        
+        self.send_response(206)
+        self.send_header('Content-Type', f'multipart/byteranges; boundary={boundary}')
+        self.send_header('Content-Length', str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
     def _handle_data_upload(self, path, method):
         full_path = os.path.join(self.server.root_dir, path.lstrip('/'))
         directory = os.path.dirname(full_path)
@@ -196,14 +269,12 @@ class CacheAPIHandler(BaseHTTPRequestHandler):
                     f.seek(start)
                     f.write(data)
                     
-                self.send_response(204)
-                self.end_headers()
+                self._send_empty_response(204)
             else:
                 with open(full_path, 'wb') as f:
                     f.write(data)
                     
-                self.send_response(201 if method == 'PUT' else 200)
-                self.end_headers()
+                self._send_empty_response(201 if method == 'PUT' else 200)
                 
         except Exception as e:
             self._send_error_response(500, str(e))
@@ -227,8 +298,7 @@ class CacheAPIHandler(BaseHTTPRequestHandler):
                     with open(full_path, 'wb') as f:
                         pass
             
-            self.send_response(201)
-            self.end_headers()
+            self._send_empty_response(201)
         except Exception as e:
             self._send_error_response(500, str(e))
 
@@ -252,8 +322,7 @@ class CacheAPIHandler(BaseHTTPRequestHandler):
                 self._send_error_response(400, "Invalid request: path type mismatch")
                 return
                 
-            self.send_response(204)
-            self.end_headers()
+            self._send_empty_response(204)
         except Exception as e:
             self._send_error_response(500, str(e))
 
@@ -283,8 +352,7 @@ class CacheAPIHandler(BaseHTTPRequestHandler):
                 
             os.rename(old_full_path, new_full_path)
             
-            self.send_response(204)
-            self.end_headers()
+            self._send_empty_response(204)
             
         except json.JSONDecodeError:
             self._send_error_response(400, "Invalid JSON body")
@@ -297,10 +365,20 @@ class CacheAPIHandler(BaseHTTPRequestHandler):
                           self.log_date_time_string(),
                           format % args))
 
-class CacheServer(HTTPServer):
-    def __init__(self, server_address, handler_class, root_dir):
+class CacheServer(ThreadingHTTPServer):
+    # one thread per connection, so concurrent clients are served at once
+    # a burst of connects beyond the default backlog of 5 would be dropped
+    # and retried by the client a second later
+    request_queue_size = 128
+
+    def __init__(self, server_address, handler_class, root_dir, delay_ms=0, slow_every=0, slow_ms=0):
         super().__init__(server_address, handler_class)
         self.root_dir = os.path.abspath(root_dir)
+        self.delay = delay_ms / 1000.0
+        self.slow_every = slow_every
+        self.slow_delay = slow_ms / 1000.0
+        self.slow_count = 0
+        self.slow_lock = threading.Lock()
 
 def create_test_files(directory, sizes_kb=None):
     if sizes_kb is None:
@@ -329,6 +407,9 @@ def main():
     parser.add_argument('--port', type=int, default=8080, help='Server port')
     parser.add_argument('--directory', type=str, default='./test_data', help='Directory to serve')
     parser.add_argument('--create-test-files', action='store_true', help='Create test files in the directory')
+    parser.add_argument('--delay-ms', type=float, default=0, help='Latency added to every data request')
+    parser.add_argument('--slow-every', type=int, default=0, help='Make every Nth data request slow')
+    parser.add_argument('--slow-ms', type=float, default=0, help='Latency added to the slow data requests')
     args = parser.parse_args()
     
     os.makedirs(args.directory, exist_ok=True)
@@ -336,7 +417,11 @@ def main():
     if args.create_test_files:
         create_test_files(args.directory)
     
-    server = CacheServer(('', args.port), CacheAPIHandler, args.directory)
+    # handler threads hand the GIL over every 0.5 ms instead of 5 ms, or
+    # concurrent requests queue behind each other
+    sys.setswitchinterval(0.0005)
+    server = CacheServer(('', args.port), CacheAPIHandler, args.directory, args.delay_ms,
+                         args.slow_every, args.slow_ms)
     server_address = f"http://localhost:{args.port}"
     
     print(f"Starting server at {server_address}")
@@ -0,0 +1,324 @@
+#include "backend/transfer_engine.h"
+#include "backend/curl_pool.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <strings.h>
+
+namespace cache_fs {
+
+TransferEngine::TransferEngine(std::size_t max_per_origin) : max_per_origin_(std::max<std::size_t>(max_per_origin, 1)) {
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    multi_ = curl_multi_init();
+    if (multi_) thread_ = std::thread(&TransferEngine::loop, this);
+}
+
+TransferEngine::~TransferEngine() {
+    {
+        std::lock_guard<std::mutex> g(mu_);
+        stop_ = true;
+    }
+    if (multi_) curl_multi_wakeup(multi_);
+    if (thread_.joinable()) thread_.join();
+    for (CURL* curl : idle_) curl_easy_cleanup(curl);
+    if (multi_) curl_multi_cleanup(multi_);
+}
+
+size_t TransferEngine::writeCb(void* ptr, size_t sz, size_t nm, void* ud) {
+    auto* a  = static_cast<Attempt*>(ud);
+    size_t n = sz * nm;
+    if (!a->begun) {
+        a->begun = true;
+        long http_code = 0;
+        curl_easy_getinfo(a->curl, CURLINFO_RESPONSE_CODE, &http_code);
+        if (!a->sink.begin(http_code, a->content_type, a->content_range)) return 0;
+        a->truncate = http_code == 200 && a->ranged;
+    }
+    if (!a->sink.feed(static_cast<const char*>(ptr), n)) return 0;
+    // an origin that ignored the ranges sends the whole resource; stop at
+    // the last byte wanted, giving up the connection
+    if (a->truncate && a->sink.satisfied()) return 0;
+    return n;
+}
+
+size_t TransferEngine::headerCb(char* ptr, size_t sz, size_t nm, void* ud) {
+    auto* a  = static_cast<Attempt*>(ud);
+    size_t n = sz * nm;
+    std::string line(ptr, n);
+    auto value = [&](std::size_t skip) {
+        std::size_t b = line.find_first_not_of(" \t", skip);
+        std::size_t e = line.find_last_not_of(" \t\r\n");
+        return b == std::string::npos || e < b ? std::string() : line.substr(b, e - b + 1);
+    };
+    auto is = [&](const char* name) { return line.size() >= std::strlen(name) && strncasecmp(line.c_str(), name, std::strlen(name)) == 0; };
+    if (is("HTTP/")) {
+        // a new response, after a redirect or a 100 Continue
+        a->content_type.clear();
+        a->content_range.clear();
+    } else if (is("Content-Type:")) {
+        a->content_type = value(13);
+    } else if (is("Content-Range:")) {
+        a->content_range = value(14);
+    }
+    return n;
+}
+
+std::uint64_t TransferEngine::submit(Request req) {
+    std::uint64_t ticket = 0;
+    {
+        std::lock_guard<std::mutex> g(mu_);
+        if (multi_ && !stop_) {
+            ticket = next_ticket_++;
+            submitted_.emplace_back(ticket, std::move(req));
+            in_flight_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    if (ticket == 0) {
+        // no loop to run it
+        req.done(Result::failed(-EIO));
+        return 0;
+    }
+    curl_multi_wakeup(multi_);
+    return ticket;
+}
+
+void TransferEngine::cancel(std::uint64_t ticket) {
+    {
+        std::lock_guard<std::mutex> g(mu_);
+        if (!multi_ || stop_) return;
+        cancelled_.push_back(ticket);
+    }
+    curl_multi_wakeup(multi_);
+}
+
+void TransferEngine::setMaxPerOrigin(std::size_t n) {
+    {
+        std::lock_guard<std::mutex> g(mu_);
+        max_per_origin_ = std::max<std::size_t>(n, 1);
+        limit_changed_  = true;
+    }
+    if (multi_) curl_multi_wakeup(multi_);
+}
+
+void TransferEngine::setHedgeBudget(double fraction) {
+    hedge_budget_.store(std::clamp(fraction, 0.0, 1.0), std::memory_order_relaxed);
+}
+
+TransferEngine::HedgeStats TransferEngine::hedgeStats() const {
+    HedgeStats s;
+    s.eligible = eligible_.load(std::memory_order_relaxed);
+    s.hedged   = hedged_.load(std::memory_order_relaxed);
+    s.won      = won_.load(std::memory_order_relaxed);
+    return s;
+}
+
+void TransferEngine::start(std::uint64_t ticket, Request req) {
+    auto job = std::make_unique<Job>();
+    job->ticket  = ticket;
+    job->req     = std::move(req);
+    job->started = Clock::now();
+    Job& j = *job;
+    jobs_[ticket] = std::move(job);
+    if (!launch(j, false)) {
+        complete(ticket, Result::failed(-EIO));
+        return;
+    }
+    if (j.req.hedge_after > 0) {
+        eligible_.fetch_add(1, std::memory_order_relaxed);
+        if (++window_eligible_ >= kHedgeWindow) {
+            window_eligible_ /= 2;
+            window_hedged_   /= 2;
+        }
+        auto after = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(j.req.hedge_after));
+        hedge_due_.emplace(j.started + after, ticket);
+    }
+}
+
+bool TransferEngine::launch(Job& job, bool hedge) {
+    CURL* curl;
+    if (!idle_.empty()) {
+        curl = idle_.back();
+        idle_.pop_back();
+    } else if (!(curl = curl_easy_init())) {
+        return false;
+    }
+
+    auto a = std::make_unique<Attempt>();
+    a->job   = &job;
+    a->curl  = curl;
+    a->hedge = hedge;
+    std::vector<ByteSpan> spans = job.req.spans;
+    if (hedge) {
+        std::size_t want = 0;
+        for (const ByteSpan& s : spans) want += s.len;
+        a->scratch.reset(new char[want]);
+        char* at = a->scratch.get();
+        for (ByteSpan& s : spans) {
+            s.buf = at;
+            at += s.len;
+        }
+    }
+    a->sink = ByteRangeSink(std::move(spans));
+    const std::string range = ByteRangeSink::rangeHeader(job.req.spans);
+    a->ranged = !range.empty();
+    for (const std::string& h : job.req.headers) a->headers = curl_slist_append(a->headers, h.c_str());
+
+    curl_easy_setopt(curl, CURLOPT_URL, job.req.url.c_str());
+    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(curl, CURLOPT_TCP_NODELAY, 1L);
+    if (!range.empty()) curl_easy_setopt(curl, CURLOPT_RANGE, range.c_str());
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, a->headers);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeCb);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, a.get());
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, headerCb);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, a.get());
+
+    if (curl_multi_add_handle(multi_, curl) != CURLM_OK) {
+        curl_easy_reset(curl);
+        idle_.push_back(curl);
+        return false;
+    }
+    job.attempts.push_back(curl);
+    active_[curl] = std::move(a);
+    return true;
+}
+
+void TransferEngine::drop(CURL* curl) {
+    auto it = active_.find(curl);
+    if (it == active_.end()) return;
+    std::vector<CURL*>& attempts = it->second->job->attempts;
+    attempts.erase(std::remove(attempts.begin(), attempts.end(), curl), attempts.end());
+    active_.erase(it);
+    curl_multi_remove_handle(multi_, curl);
+    // resetting keeps the connection in the multi handle's cache
+    curl_easy_reset(curl);
+    idle_.push_back(curl);
+}
+
+void TransferEngine::complete(std::uint64_t ticket, Result res) {
+    auto it = jobs_.find(ticket);
+    if (it == jobs_.end()) return;
+    std::unique_ptr<Job> job = std::move(it->second);
+    jobs_.erase(it);
+    while (!job->attempts.empty()) drop(job->attempts.back());
+    res.latency = std::chrono::duration<double>(Clock::now() - job->started).count();
+    in_flight_.fetch_sub(1, std::memory_order_relaxed);
+    job->req.done(res);
+}
+
+void TransferEngine::attemptDone(CURL* curl, CURLcode code) {
+    auto it = active_.find(curl);
+    if (it == active_.end()) return;
+    Attempt& a = *it->second;
+    Job& job   = *a.job;
+
+    long http_code = 0;
+    Result res;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+    curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME, &res.ttfb);
+    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME, &res.total);
+    // a write error is ours when we cut a whole-resource body short
+    bool cut = code == CURLE_WRITE_ERROR && a.truncate && a.sink.satisfied();
+    bool ok  = (code == CURLE_OK || cut) && http_code / 100 == 2;
+    if (ok) {
+        res.bytes = static_cast<ssize_t>(a.sink.total());
+        res.got   = a.sink.got();
+    } else if (http_code == 416) {
+        // every range starts past the end of the resource
+        res.got.assign(job.req.spans.size(), 0);
+    } else if (job.attempts.size() > 1) {
+        // the other attempt may still get through
+        drop(curl);
+        return;
+    } else {
+        res.bytes = -EIO;
+    }
+
+    if (a.hedge) {
+        // the first attempt stops writing into the caller's buffers once
+        // dropped, so the hedge's bytes can go in after it
+        for (CURL* other : std::vector<CURL*>(job.attempts))
+            if (other != curl) drop(other);
+        const std::vector<ByteSpan>& scratch = a.sink.spans();
+        for (std::size_t i = 0; i < res.got.size() && i < job.req.spans.size(); ++i)
+            if (res.got[i] > 0) std::memcpy(job.req.spans[i].buf, scratch[i].buf, res.got[i]);
+        won_.fetch_add(1, std::memory_order_relaxed);
+    }
+    complete(job.ticket, std::move(res));
+}
+
+void TransferEngine::hedgeDue(Clock::time_point now) {
+    while (!hedge_due_.empty() && hedge_due_.top().first <= now) {
+        std::uint64_t ticket = hedge_due_.top().second;
+        hedge_due_.pop();
+        auto it = jobs_.find(ticket);
+        if (it == jobs_.end() || it->second->hedged || it->second->attempts.empty()) continue;
+        Job& job = *it->second;
+        // a request still waiting for a connection is slow on our side,
+        // not the origin's; a second one would only queue behind it
+        curl_off_t sent = 0;
+        curl_easy_getinfo(job.attempts.front(), CURLINFO_PRETRANSFER_TIME_T, &sent);
+        if (sent == 0) {
+            auto after = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(job.req.hedge_after));
+            hedge_due_.emplace(now + after, ticket);
+            continue;
+        }
+        if (window_hedged_ + 1 > hedge_budget_.load(std::memory_order_relaxed) * window_eligible_) continue;
+        job.hedged = true;
+        if (!launch(job, true)) continue;
+        window_hedged_ += 1;
+        hedged_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+long TransferEngine::pollTimeout(Clock::time_point now) const {
+    if (hedge_due_.empty()) return 1000;
+    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(hedge_due_.top().first - now).count() + 1;
+    return std::clamp<long>(static_cast<long>(wait), 1, 1000);
+}
+
+void TransferEngine::loop() {
+    std::vector<std::pair<std::uint64_t, Request>> submitted;
+    std::vector<std::uint64_t> cancelled;
+    for (;;) {
+        bool stop;
+        {
+            std::lock_guard<std::mutex> g(mu_);
+            stop = stop_;
+            submitted.swap(submitted_);
+            cancelled.swap(cancelled_);
+            if (limit_changed_) {
+                curl_multi_setopt(multi_, CURLMOPT_MAX_HOST_CONNECTIONS, static_cast<long>(max_per_origin_));
+                limit_changed_ = false;
+            }
+        }
+        for (auto& [ticket, req] : submitted) start(ticket, std::move(req));
+        submitted.clear();
+        if (stop) break;
+        for (std::uint64_t ticket : cancelled) complete(ticket, Result::failed(-ECANCELED));
+        cancelled.clear();
+
+        int running = 0;
+        curl_multi_perform(multi_, &running);
+        int queued = 0;
+        while (CURLMsg* msg = curl_multi_info_read(multi_, &queued)) {
+            if (msg->msg == CURLMSG_DONE) attemptDone(msg->easy_handle, msg->data.result);
+        }
+        Clock::time_point now = Clock::now();
+        hedgeDue(now);
+        curl_multi_poll(multi_, nullptr, 0, static_cast<int>(pollTimeout(now)), nullptr);
+    }
+
+    // submissions that raced with stop were started above and end here too
+    while (!jobs_.empty()) complete(jobs_.begin()->first, Result::failed(-ECANCELED));
+}
+
+TransferEngine& shared_transfer_engine() {
+    static TransferEngine engine(CurlPool::kDefaultPerOrigin);
+    return engine;
+}
+
+}
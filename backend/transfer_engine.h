@@ -0,0 +1,191 @@
+#ifndef CACHE_FS_TRANSFER_ENGINE_H
+#define CACHE_FS_TRANSFER_ENGINE_H
+
+#include <curl/curl.h>
+#include <sys/types.h>
+
+#include "backend/byteranges.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace cache_fs {
+
+// Runs ranged GETs on a single thread with curl_multi. submit() hands a
+// request to the engine and returns at once; the engine drives every
+// transfer in flight from one event loop and calls the request's completion
+// when it ends. Waiting callers cost no thread of their own, so deep
+// prefetch and wide parallel misses only cost memory for their buffers.
+//
+// At most max_per_origin connections are open to one origin; transfers
+// beyond that queue inside curl until a connection is free. Connections
+// stay open between transfers and are reused.
+//
+// A request may be hedged: if it is still running hedge_after seconds after
+// it went out, the same GET is sent again, whichever answer finishes first
+// is used and the other is cancelled. Hedges are capped at a fraction of the
+// recent requests that allowed one.
+class TransferEngine {
+public:
+    static constexpr double kDefaultHedgeBudget = 0.05;
+
+    struct Result {
+        // bytes written over all spans, or a negative errno: -EIO when the
+        // transfer failed, -ECANCELED when it was cancelled
+        ssize_t bytes = 0;
+        // bytes written into each span, in request order; short past the
+        // end of the resource
+        std::vector<std::size_t> got;
+        // of the attempt whose answer was used
+        double  ttfb  = 0;
+        double  total = 0;
+        // from submission to completion, across every attempt
+        double  latency = 0;
+
+        static Result failed(ssize_t err) {
+            Result r;
+            r.bytes = err;
+            return r;
+        }
+    };
+    using Completion = std::function<void(const Result&)>;
+
+    struct Request {
+        std::string url;
+        std::vector<std::string> headers;
+        // Each span's bytes are written to its buf, which must stay valid
+        // until done has run. All spans go out as one request, as a
+        // multi-range GET when they are not contiguous; spans without bytes
+        // fetch the whole resource and keep nothing.
+        std::vector<ByteSpan> spans;
+        // seconds to wait for an answer before sending a second request;
+        // 0 never does
+        double      hedge_after = 0;
+        // runs on the engine thread, so it must not block; hand real work
+        // to another thread
+        Completion  done;
+    };
+
+    struct HedgeStats {
+        std::uint64_t eligible = 0;   // requests with a hedge_after
+        std::uint64_t hedged   = 0;   // second requests sent
+        std::uint64_t won      = 0;   // ...that finished first
+    };
+
+    explicit TransferEngine(std::size_t max_per_origin);
+    // Cancels whatever is still in flight; each completion runs once.
+    ~TransferEngine();
+
+    // Ticket naming the transfer for cancel().
+    std::uint64_t submit(Request req);
+    // Ends the transfer with -ECANCELED unless it has completed already.
+    void cancel(std::uint64_t ticket);
+    void setMaxPerOrigin(std::size_t n);
+    // Largest share of hedge-eligible requests that may be sent twice,
+    // clamped to [0, 1]; kDefaultHedgeBudget until set.
+    void setHedgeBudget(double fraction);
+    // Transfers submitted and not completed yet.
+    std::size_t inFlight() const { return in_flight_.load(std::memory_order_relaxed); }
+    HedgeStats hedgeStats() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // eligible requests the hedge budget is held over
+    static constexpr double kHedgeWindow = 1024;
+
+    // One submitted request and the attempts running for it.
+    struct Job {
+        std::uint64_t      ticket = 0;
+        Request            req;
+        std::vector<CURL*> attempts;
+        Clock::time_point  started;
+        bool               hedged = false;
+    };
+
+    // One GET on one easy handle.
+    struct Attempt {
+        Job*          job  = nullptr;
+        CURL*         curl = nullptr;
+        bool          hedge = false;
+        ByteRangeSink sink;
+        // a hedge writes here, not into the caller's buffers, which the
+        // first attempt may still be filling
+        std::unique_ptr<char[]> scratch;
+        // of the final response, for the sink
+        std::string   content_type;
+        std::string   content_range;
+        bool          begun = false;
+        bool          ranged = false;     // a Range header went out
+        bool          truncate = false;   // ...and the origin ignored it
+        curl_slist*   headers = nullptr;
+
+        ~Attempt() { curl_slist_free_all(headers); }
+    };
+
+    static size_t writeCb(void* ptr, size_t sz, size_t nm, void* ud);
+    static size_t headerCb(char* ptr, size_t sz, size_t nm, void* ud);
+
+    void loop();
+    // Loop thread only.
+    void start(std::uint64_t ticket, Request req);
+    bool launch(Job& job, bool hedge);
+    void attemptDone(CURL* curl, CURLcode code);
+    void hedgeDue(Clock::time_point now);
+    long pollTimeout(Clock::time_point now) const;
+    // Detaches an attempt from the multi handle and its job.
+    void drop(CURL* curl);
+    // Drops whatever attempts are left and completes the job.
+    void complete(std::uint64_t ticket, Result res);
+
+    CURLM* multi_ = nullptr;
+
+    std::mutex mu_;
+    std::vector<std::pair<std::uint64_t, Request>> submitted_;
+    std::vector<std::uint64_t> cancelled_;
+    std::size_t max_per_origin_;
+    bool limit_changed_ = true;
+    bool stop_ = false;
+    std::uint64_t next_ticket_ = 1;
+    std::atomic<std::size_t> in_flight_{0};
+    std::atomic<double> hedge_budget_{kDefaultHedgeBudget};
+
+    // owned by the loop thread
+    std::unordered_map<std::uint64_t, std::unique_ptr<Job>> jobs_;
+    std::unordered_map<CURL*, std::unique_ptr<Attempt>> active_;
+    // finished handles, reset and kept so their setup is not repeated
+    std::vector<CURL*> idle_;
+    // when each hedgeable job is due its second attempt, earliest first;
+    // entries for jobs that completed meanwhile are skipped
+    using Deadline = std::pair<Clock::time_point, std::uint64_t>;
+    std::priority_queue<Deadline, std::vector<Deadline>, std::greater<Deadline>> hedge_due_;
+    // the budget is held over recent requests: both counts halve together
+    double window_eligible_ = 0;
+    double window_hedged_   = 0;
+
+    std::atomic<std::uint64_t> eligible_{0};
+    std::atomic<std::uint64_t> hedged_{0};
+    std::atomic<std::uint64_t> won_{0};
+
+    std::thread thread_;
+
+    TransferEngine(const TransferEngine&) = delete;
+    TransferEngine& operator=(const TransferEngine&) = delete;
+};
+
+// The engine every HttpBackend in the process submits to.
+TransferEngine& shared_transfer_engine();
+
+}
+
+#endif
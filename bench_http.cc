@@ -0,0 +1,207 @@
+#include <curl/curl.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "backend/backend.h"
+
+// Measures how many small blocks a second HttpBackend fetches from
+// backend/local_server.py: against the same requests made the way the
+// backend used to, a fresh easy handle and so a fresh connection each time;
+// from one thread and from several at once; submitted asynchronously from
+// one thread, with up to threads connections to the origin; and from one
+// thread as multi-range GETs of 16 scattered blocks each.
+// Usage:
+//   ./bench_http [blocks] [block_kb] [threads] [delay_ms]
+// delay_ms is latency the server adds to every request, standing in for a
+// remote origin.
+static constexpr const char* kDataDir = "bench_http_data";
+static constexpr const char* kPort    = "8091";
+
+static size_t discard_cb(void*, size_t sz, size_t nm, void*) { return sz * nm; }
+
+// One ranged GET on a handle of its own, cleaned up afterwards.
+static bool fetch_fresh(const std::string& url, std::size_t off, std::size_t len) {
+    CURL* curl = curl_easy_init();
+    if (!curl) return false;
+    std::string range = std::to_string(off) + "-" + std::to_string(off + len - 1);
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(curl, CURLOPT_RANGE, range.c_str());
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, discard_cb);
+    bool ok = curl_easy_perform(curl) == CURLE_OK;
+    curl_easy_cleanup(curl);
+    return ok;
+}
+
+static bool port_free(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return false;
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port   = htons(port);
+    bool ok = bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+    close(fd);
+    return ok;
+}
+
+template <class Fn>
+static double blocks_per_sec(std::size_t n, Fn&& fn) {
+    auto t0 = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < n; ++i) fn(i);
+    std::chrono::duration<double> dt = std::chrono::steady_clock::now() - t0;
+    return n / dt.count();
+}
+
+int main(int argc, char** argv) {
+    std::size_t n     = argc > 1 ? std::stoul(argv[1]) : 2000;
+    std::size_t block = (argc > 2 ? std::stoul(argv[2]) : 64) * 1024;
+    std::size_t threads = argc > 3 ? std::stoul(argv[3]) : 8;
+    std::string delay_ms = argc > 4 ? argv[4] : "0";
+    const std::size_t file_blocks = 64;
+
+    // whatever already listens on the port would answer instead of our
+    // server and skew the numbers
+    if (!port_free(std::atoi(kPort))) {
+        std::cerr << "port " << kPort << " is in use\n";
+        return 1;
+    }
+
+    std::filesystem::create_directories(kDataDir);
+    {
+        std::ofstream out(std::string(kDataDir) + "/blob", std::ios::binary);
+        std::vector<char> chunk(block, 'x');
+        for (std::size_t i = 0; i < file_blocks; ++i) out.write(chunk.data(), chunk.size());
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        // the server logs every request
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        execlp("python3", "python3", "backend/local_server.py", "--port", kPort, "--directory", kDataDir,
+               "--delay-ms", delay_ms.c_str(), nullptr);
+        _exit(1);
+    }
+    if (pid < 0) {
+        perror("fork");
+        return 1;
+    }
+    auto stop_server = [&] {
+        if (kill(pid, SIGTERM) == 0) waitpid(pid, nullptr, 0);
+        std::filesystem::remove_all(kDataDir);
+    };
+
+    const std::string base = std::string("http://127.0.0.1:") + kPort + "/api/data";
+    const std::string url  = base + "/blob";
+    bool up = false;
+    for (int i = 0; i < 50 && !up; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        if (waitpid(pid, nullptr, WNOHANG) == pid) break;
+        up = fetch_fresh(url, 0, 1);
+    }
+    auto backend = cache_fs::create_backend(base);
+    if (!up || !backend) {
+        std::cerr << "server did not start\n";
+        stop_server();
+        return 1;
+    }
+
+    bool ok = true;
+    std::vector<char> buf(block);
+    auto offset = [&](std::size_t i) { return (i % file_blocks) * block; };
+    std::printf("%zu blocks of %zu KiB, %s ms origin delay\n", n, block / 1024, delay_ms.c_str());
+    auto report = [](const char* how, double rate) { std::printf("%-18s %10.0f blocks/s\n", how, rate); };
+    report("fresh handle", blocks_per_sec(n, [&](std::size_t i) { ok &= fetch_fresh(url, offset(i), block); }));
+    report("backend, 1 thr", blocks_per_sec(n, [&](std::size_t i) {
+        ok &= backend->download("/blob", buf.data(), block, offset(i)) == static_cast<ssize_t>(block);
+    }));
+
+    cache_fs::backend_set_origin_concurrency(threads);
+    std::atomic<bool> threads_ok{true};
+    std::string label = "backend, " + std::to_string(threads) + " thr";
+    report(label.c_str(), n * blocks_per_sec(1, [&](std::size_t) {
+        std::vector<std::thread> workers;
+        for (std::size_t t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t] {
+                std::vector<char> tbuf(block);
+                for (std::size_t i = t; i < n; i += threads) {
+                    if (backend->download("/blob", tbuf.data(), block, offset(i)) != static_cast<ssize_t>(block))
+                        threads_ok = false;
+                }
+            });
+        }
+        for (auto& w : workers) w.join();
+    }));
+    ok &= threads_ok;
+
+    // every block in flight at once from this thread; the engine queues
+    // them behind the origin's connection limit
+    std::vector<char> all(n * block);
+    std::atomic<std::size_t> async_ok{0};
+    report("async, 1 thr", n * blocks_per_sec(1, [&](std::size_t) {
+        std::mutex mu;
+        std::condition_variable cv;
+        std::size_t left = n;
+        for (std::size_t i = 0; i < n; ++i) {
+            backend->download_async("/blob", all.data() + i * block, block, offset(i), [&](ssize_t got) {
+                if (got == static_cast<ssize_t>(block)) ++async_ok;
+                std::lock_guard<std::mutex> g(mu);
+                if (--left == 0) cv.notify_one();
+            });
+        }
+        std::unique_lock<std::mutex> lk(mu);
+        cv.wait(lk, [&] { return left == 0; });
+    }));
+    ok &= async_ok == n;
+
+    // every other block, so no two spans of a request merge into one range
+    const std::size_t per_request = 16;
+    std::size_t ranged_ok = 0;
+    report("multi-range, 1 thr", n * blocks_per_sec(1, [&](std::size_t) {
+        for (std::size_t i = 0; i < n; i += per_request) {
+            std::vector<cache_fs::ByteSpan> spans;
+            for (std::size_t j = i; j < std::min(n, i + per_request); ++j)
+                spans.push_back({all.data() + j * block, block, static_cast<off_t>(((2 * j) % file_blocks) * block)});
+            std::mutex mu;
+            std::condition_variable cv;
+            bool finished = false;
+            backend->download_ranges_async("/blob", std::move(spans), [&](std::vector<ssize_t> got) {
+                std::lock_guard<std::mutex> g(mu);
+                for (ssize_t r : got) ranged_ok += r == static_cast<ssize_t>(block);
+                finished = true;
+                cv.notify_one();
+            });
+            std::unique_lock<std::mutex> lk(mu);
+            cv.wait(lk, [&] { return finished; });
+        }
+    }));
+    ok &= ranged_ok == n;
+
+    stop_server();
+    if (!ok) {
+        std::cerr << "bench_http FAILED\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,128 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cache/policy/metadata/metadata_store.h"
+
+// Measures MetadataStore throughput per operation. Usage:
+//   ./bench_metadata [ops] [off|normal|full|index] [shards]
+// off/normal/full run the SQLite backend at that synchronous level, spread
+// over shards database files (default 1); index runs the mmapped hash table.
+static constexpr const char* kDbPrefix = "bench_meta.";
+
+// Removes the database or index and everything kept next to it (WAL,
+// string heaps).
+static void remove_db() {
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(".", ec)) {
+        if (entry.path().filename().string().rfind(kDbPrefix, 0) == 0) std::filesystem::remove(entry.path(), ec);
+    }
+}
+
+// Mutations are group-committed, so their timing includes the final flush.
+template <class Fn>
+static double ops_per_sec(MetadataStore& store, std::size_t n, Fn&& fn) {
+    auto t0 = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < n; ++i) fn(i);
+    store.flush();
+    std::chrono::duration<double> dt = std::chrono::steady_clock::now() - t0;
+    return n / dt.count();
+}
+
+int main(int argc, char** argv) {
+    std::size_t n = argc > 1 ? std::stoul(argv[1]) : 2000;
+    std::string level = argc > 2 ? argv[2] : "normal";
+    std::size_t shards = argc > 3 ? std::stoul(argv[3]) : 1;
+    MetadataStore::SyncLevel sync = MetadataStore::SyncLevel::Normal;
+    MetadataStore::Backend backend = MetadataStore::Backend::Sqlite;
+    if (level == "off")   sync = MetadataStore::SyncLevel::Off;
+    if (level == "full")  sync = MetadataStore::SyncLevel::Full;
+    if (level == "index") backend = MetadataStore::Backend::Index;
+    const std::string db_path = std::string(kDbPrefix) + (backend == MetadataStore::Backend::Index ? "idx" : "db");
+    remove_db();
+
+    auto open = [&] {
+        auto store = std::make_unique<MetadataStore>(db_path, "bench_cache", sync, backend, shards);
+        if (!store->init()) store.reset();
+        return store;
+    };
+    auto store = open();
+    if (backend == MetadataStore::Backend::Index)
+        std::printf("%zu ops, index\n", n);
+    else
+        std::printf("%zu ops, synchronous=%s, %zu shard(s)\n", n, level.c_str(), shards);
+    if (!store) {
+        std::cerr << "init failed\n";
+        return 1;
+    }
+
+    // short enough to stay in the small-string buffer at 10M entries
+    std::vector<std::string> paths;
+    paths.reserve(n);
+    for (std::size_t i = 0; i < n; ++i) paths.push_back("/b/f" + std::to_string(i));
+
+    bool ok = true;
+    auto report = [](const char* op, double rate) { std::printf("%-18s %12.0f ops/s\n", op, rate); };
+    report("put", ops_per_sec(*store, n, [&](std::size_t i) {
+        CacheMetadata m;
+        m.path = paths[i];
+        m.local_path = "bench_cache" + paths[i];
+        m.size = i;
+        m.timestamp = m.last_accessed = static_cast<std::time_t>(i);
+        ok &= store->put(m);
+    }));
+
+    // reopen so the first lookups are answered by the backend itself,
+    // not by rows remembered from the puts
+    store.reset();
+    store = open();
+    if (!store) {
+        std::cerr << "reopen failed\n";
+        return 1;
+    }
+    report("get (cold)", ops_per_sec(*store, n, [&](std::size_t i) { ok &= store->get(paths[i]).has_value(); }));
+    report("get (warm)", ops_per_sec(*store, n, [&](std::size_t i) { ok &= store->get(paths[i]).has_value(); }));
+    report("updateAccessTime", ops_per_sec(*store, n, [&](std::size_t i) {
+        ok &= store->updateAccessTime(paths[i], static_cast<std::time_t>(i + 1));
+    }));
+    report("markDirty", ops_per_sec(*store, n, [&](std::size_t i) { ok &= store->markDirty(paths[i], true); }));
+    report("remove", ops_per_sec(*store, n, [&](std::size_t i) { ok &= store->remove(paths[i]); }));
+
+    // the same puts again from several threads, which only scales when the
+    // rows are spread over more than one shard
+    const std::size_t threads = std::max(2u, std::thread::hardware_concurrency());
+    std::atomic<bool> threads_ok{true};
+    report("put (threads)", n * ops_per_sec(*store, 1, [&](std::size_t) {
+        std::vector<std::thread> workers;
+        for (std::size_t t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t] {
+                for (std::size_t i = t; i < n; i += threads) {
+                    CacheMetadata m;
+                    m.path = paths[i];
+                    m.local_path = "bench_cache" + paths[i];
+                    m.size = i;
+                    if (!store->put(m)) threads_ok = false;
+                }
+            });
+        }
+        for (auto& w : workers) w.join();
+    }));
+    ok &= threads_ok;
+
+    store.reset();
+    remove_db();
+    std::filesystem::remove_all("bench_cache");
+    if (!ok) {
+        std::cerr << "bench_metadata FAILED\n";
+        return 1;
+    }
+    return 0;
+}
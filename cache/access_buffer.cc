@@ -0,0 +1,24 @@
+#include "access_buffer.h"
+
+std::size_t AccessBuffer::stripe_index() {
+    static std::atomic<std::size_t> next{0};
+    thread_local std::size_t idx = next.fetch_add(1, std::memory_order_relaxed) % kStripes;
+    return idx;
+}
+
+std::size_t AccessBuffer::record(std::size_t key, std::uint16_t part, double hotness, double cost) {
+    Stripe& s = stripes_[stripe_index()];
+    std::uint64_t tail = s.tail.load(std::memory_order_relaxed);
+    for (;;) {
+        std::uint64_t head = s.head.load(std::memory_order_acquire);
+        if (tail - head >= kSlots) return 0;
+        if (!s.tail.compare_exchange_weak(tail, tail + 1, std::memory_order_relaxed)) continue;
+
+        Slot& slot = s.slots[tail & (kSlots - 1)];
+        slot.part.store(part, std::memory_order_relaxed);
+        slot.hotness.store(hotness, std::memory_order_relaxed);
+        slot.cost.store(cost, std::memory_order_relaxed);
+        slot.key.store(key + 1, std::memory_order_release);
+        return tail + 1 - head;
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef CACHE_ACCESS_BUFFER_H
+#define CACHE_ACCESS_BUFFER_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Lossy, striped ring buffers for cache hits. Each thread records into its
+// own stripe with one CAS and no locks; whoever holds the policy lock drains
+// all stripes and replays the accesses into the policy in one batch. When a
+// stripe is full the access is dropped, which only costs recency accuracy.
+class AccessBuffer {
+public:
+    struct Access {
+        std::size_t   key;
+        std::uint16_t part;
+        double        hotness;
+        double        cost;
+    };
+
+    static constexpr std::size_t kStripes = 16;
+    static constexpr std::size_t kSlots   = 256;
+    static constexpr std::size_t kDrainThreshold = kSlots / 2;
+
+    // Returns the number of accesses pending in the caller's stripe including
+    // this one, or 0 if the stripe was full and the access was dropped.
+    std::size_t record(std::size_t key, std::uint16_t part, double hotness, double cost);
+
+    // Replays every published access into fn. Only one thread may drain at a
+    // time, i.e. the caller holds the policy lock.
+    template <class Fn>
+    std::size_t drain(Fn&& fn);
+
+private:
+    struct Slot {
+        std::atomic<std::size_t>   key{0};     // key + 1, 0 while unpublished
+        std::atomic<std::uint16_t> part{0};
+        std::atomic<double>        hotness{0};
+        std::atomic<double>        cost{0};
+    };
+
+    struct alignas(64) Stripe {
+        std::atomic<std::uint64_t> head{0};
+        std::atomic<std::uint64_t> tail{0};
+        std::array<Slot, kSlots>   slots;
+    };
+
+    static std::size_t stripe_index();
+
+    std::array<Stripe, kStripes> stripes_;
+};
+
+#include "access_buffer.inl"
+
+#endif
@@ -0,0 +1,25 @@
+#pragma once
+#include <utility>
+
+template <class Fn>
+std::size_t AccessBuffer::drain(Fn&& fn) {
+    std::size_t n = 0;
+    for (Stripe& s : stripes_) {
+        std::uint64_t head = s.head.load(std::memory_order_relaxed);
+        std::uint64_t tail = s.tail.load(std::memory_order_acquire);
+        for (; head != tail; ++head) {
+            Slot& slot = s.slots[head & (kSlots - 1)];
+            std::size_t key = slot.key.load(std::memory_order_acquire);
+            // claimed but not yet published; pick it up next time
+            if (key == 0) break;
+            fn(Access{key - 1,
+                      slot.part.load(std::memory_order_relaxed),
+                      slot.hotness.load(std::memory_order_relaxed),
+                      slot.cost.load(std::memory_order_relaxed)});
+            slot.key.store(0, std::memory_order_relaxed);
+            ++n;
+        }
+        s.head.store(head, std::memory_order_release);
+    }
+    return n;
+}
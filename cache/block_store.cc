@@ -8,6 +8,8 @@
 #include <cerrno>
 #include <cstring>
 #include <filesystem>
+#include <fstream>
+#include <functional>
 #include <iostream>
 
 namespace fs = std::filesystem;
@@ -24,10 +26,60 @@ bool BlockStore::init() {
         return false;
         }
     }
+    if (!load_usage()) used_.store(scan_usage(), std::memory_order_relaxed);
     return true;
 }
 
-static void ensure_shard_dirs(const std::string& root, const std::string& hash_hex) {
+// The counter is persisted only on clean shutdown and the file is consumed on
+// load, so a crash forces a single rescan instead of trusting a stale value.
+bool BlockStore::load_usage() {
+    std::string path = usage_path(root_);
+    std::ifstream in(path);
+    std::uint64_t bytes = 0;
+    bool ok = static_cast<bool>(in >> bytes);
+    in.close();
+    ::unlink(path.c_str());
+    if (ok) used_.store(bytes, std::memory_order_relaxed);
+    return ok;
+}
+
+std::uint64_t BlockStore::scan_usage() const {
+    std::uint64_t bytes = 0;
+    std::error_code ec;
+    for (auto it = fs::recursive_directory_iterator(root_, ec); !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+        if (it->path().extension() != ".blk") continue;
+        struct stat st;
+        if (::stat(it->path().c_str(), &st) == 0) bytes += static_cast<std::uint64_t>(st.st_blocks) * 512;
+    }
+    return bytes;
+}
+
+void BlockStore::cleanup() {
+    std::ofstream out(usage_path(root_), std::ios::trunc);
+    out << used_.load(std::memory_order_relaxed) << '\n';
+}
+
+std::mutex& BlockStore::file_lock(const std::string& path) {
+    return file_mu_[std::hash<std::string>{}(path) % file_mu_.size()];
+}
+
+void BlockStore::account(std::int64_t delta) {
+    if (delta >= 0) {
+        used_.fetch_add(static_cast<std::uint64_t>(delta), std::memory_order_relaxed);
+        return;
+    }
+    std::uint64_t dec = static_cast<std::uint64_t>(-delta);
+    std::uint64_t cur = used_.load(std::memory_order_relaxed);
+    while (!used_.compare_exchange_weak(cur, cur > dec ? cur - dec : 0, std::memory_order_relaxed)) {}
+}
+
+static std::int64_t allocated_bytes(int fd) {
+    struct stat st;
+    return (::fstat(fd, &st) == 0) ? static_cast<std::int64_t>(st.st_blocks) * 512 : 0;
+}
+
+static void ensure_shard_dirs(const std::string& root, std::uint64_t object) {
+    std::string hash_hex = object_hex(object);
     std::string lvl1 = root + "/" + hash_hex.substr(0, 2);
     std::string lvl2 = lvl1 + "/" + hash_hex.substr(2, 2);
 
@@ -41,11 +93,11 @@ static int open_file(const std::string& path, int flags, mode_t mode = 0644) {
 }
 
 
-ssize_t BlockStore::read(const std::string& hash_hex, char* buf, std::size_t len, off_t off) {
+ssize_t BlockStore::read(std::uint64_t object, char* buf, std::size_t len, off_t off) {
     std::size_t part_idx = off / kMaxPartSize;
     off_t part_off = off % kMaxPartSize;
 
-    std::string path = data_part_path(root_, hash_hex, part_idx);
+    std::string path = data_part_path(root_, object, part_idx);
 
     int fd = open_file(path, O_RDONLY);
     if (fd < 0) return fd;
@@ -56,32 +108,42 @@ ssize_t BlockStore::read(const std::string& hash_hex, char* buf, std::size_t len
     return n;
 }
 
-ssize_t BlockStore::write(const std::string& hash_hex, const char* buf, std::size_t len, off_t off, bool) {
-    ensure_shard_dirs(root_, hash_hex);
+ssize_t BlockStore::write(std::uint64_t object, const char* buf, std::size_t len, off_t off, bool, std::int64_t* grown) {
+    ensure_shard_dirs(root_, object);
 
     std::size_t part_idx = off / kMaxPartSize;
     off_t       part_off = off % kMaxPartSize;
 
-    std::string path = data_part_path(root_, hash_hex, part_idx);
+    std::string path = data_part_path(root_, object, part_idx);
 
     int fd = open_file(path, O_RDWR | O_CREAT, 0644);
     if (fd < 0) return fd;
 
+    std::lock_guard<std::mutex> g(file_lock(path));
+    std::int64_t before = allocated_bytes(fd);
     ssize_t n = ::pwrite(fd, buf, len, part_off);
     if (n < 0) n = -errno;
+    std::int64_t delta = allocated_bytes(fd) - before;
+    account(delta);
+    if (grown) *grown = delta;
     ::close(fd);
     return n;
 }
 
-bool BlockStore::delete_object(const std::string& hash_hex) {
+bool BlockStore::delete_object(std::uint64_t object) {
     bool ok = true;
-    std::string dir = root_ + "/" + shard_dir(hash_hex);
+    std::string dir = root_ + "/" + shard_dir(object);
+    std::string hash_hex = object_hex(object);
 
     if (!fs::exists(dir)) return true;
     for (auto const& entry : fs::directory_iterator(dir)) {
         if (entry.path().filename().string().rfind(hash_hex, 0) == 0) {
+            std::lock_guard<std::mutex> g(file_lock(entry.path().string()));
+            struct stat st;
+            std::int64_t bytes = (::stat(entry.path().c_str(), &st) == 0) ? static_cast<std::int64_t>(st.st_blocks) * 512 : 0;
             std::error_code ec;
             fs::remove(entry, ec);
+            if (!ec && entry.path().extension() == ".blk") account(-bytes);
             if (ec) {
                 std::cerr << "[block_store] failed to remove " << entry.path() << ": " << ec.message() << '\n';
                 ok = false;
@@ -1,8 +1,11 @@
 #ifndef CACHE_BLOCK_STORE_H
 #define CACHE_BLOCK_STORE_H
 
+#include <array>
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <mutex>
 #include <string>
 #include <sys/types.h>
 
@@ -13,17 +16,30 @@ BlockStore(const std::string& cache_root, std::size_t block_size);
 
 bool init();
 
-ssize_t read(const std::string& hash_hex, char* buf, std::size_t len,  off_t off);
+// Objects are named by their 64-bit id; see fs_layout.h for the file names.
+ssize_t read(std::uint64_t object, char* buf, std::size_t len,  off_t off);
 
-ssize_t write(const std::string& hash_hex, const char* buf, std::size_t len, off_t off, bool mark_dirty);
+// grown, when given, receives the change in allocated bytes caused by the write.
+ssize_t write(std::uint64_t object, const char* buf, std::size_t len, off_t off, bool mark_dirty, std::int64_t* grown = nullptr);
 
-bool delete_object(const std::string& hash_hex);
+bool delete_object(std::uint64_t object);
+
+// Bytes allocated on disk by block files, maintained on every write and
+// delete rather than by walking the cache directory.
+std::uint64_t used_bytes() const { return used_.load(std::memory_order_relaxed); }
 
 void cleanup();
 
 private:
 std::string root_; 
 std::size_t block_size_;
+std::atomic<std::uint64_t> used_{0};
+std::array<std::mutex, 64> file_mu_;
+
+std::mutex& file_lock(const std::string& path);
+void account(std::int64_t delta);
+bool load_usage();
+std::uint64_t scan_usage() const;
 
 BlockStore(const BlockStore&)            = delete;
 BlockStore& operator=(const BlockStore&) = delete;
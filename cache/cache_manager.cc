@@ -1,19 +1,38 @@
+#include "cache_manager.h"
 #include "block_store.h"
 #include "metadata_store.h"
+#include "eviction_policy.h"
 #include "lru_policy.h"
+#include "clock_policy.h"
+#include "gdsf_policy.h"
+#include "time_policy.h"
+#include "stacked_policy.h"
 #include "thread_pool.h"
+#include "access_buffer.h"
+#include "path_table.h"
+#include "stream_tuner.h"
 #include "backend/backend.h"
 #include "fs_layout.h"
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <functional>
 #include <chrono>
+#include <condition_variable>
 #include <cstring>
+#include <ctime>
+#include <deque>
 #include <filesystem>
-#include <iomanip>
+#include <memory>
 #include <mutex>
-#include <sstream>
+#include <shared_mutex>
 #include <string>
+#include <thread>
+#include <tuple>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 #include <sys/types.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -27,63 +46,358 @@ namespace fs = std::filesystem;
 #endif
 static constexpr std::size_t kBlockSize = 64 * 1024;
 static constexpr std::size_t kCacheBlocksCapacity = 200'000;
+// policies_ is reserved for this many up front, so the lock-free hit path can
+// index it while add_partition appends
+static constexpr std::size_t kMaxPartitions = 1024;
 
-static std::string hash_hex(const std::string& s) {
-    std::size_t h = std::hash<std::string>{}(s);
-    std::ostringstream oss;
-    oss << std::hex << std::setw(16) << std::setfill('0') << h;
-    return oss.str();
+// Background eviction starts above the high watermark and stops at the low
+// one. Only a write that would push usage past the capacity evicts inline.
+static constexpr std::uint64_t kDefaultCapacityBytes = 1ULL << 30;
+static constexpr double        kHighWatermark = 0.90;
+static constexpr double        kLowWatermark  = 0.80;
+static constexpr std::size_t   kEvictBatch    = 32;
+static constexpr auto          kEvictorPeriod   = std::chrono::seconds(1);
+static constexpr auto          kEvictorThrottle = std::chrono::milliseconds(2);
+
+// A file of at least kBulkMinBytes read sequentially for kBulkAfterBlocks
+// blocks, with nothing stored past the prefetch window, is fetched ahead of
+// the reader in kBulkChunkBytes ranges over up to kBulkMaxStreams parallel
+// streams, staying at most kBulkWindowBytes ahead.
+static constexpr std::uint64_t kBulkMinBytes    = 16ULL << 20;
+static constexpr std::size_t   kBulkAfterBlocks = 8;
+static constexpr std::size_t   kBulkChunkBytes  = 1 << 20;
+static constexpr std::uint64_t kBulkWindowBytes = 64ULL << 20;
+static constexpr std::size_t   kBulkMaxStreams  = 8;
+// A read waits this long for a block someone is already fetching before
+// fetching it itself.
+static constexpr auto          kInflightWait    = std::chrono::seconds(5);
+
+// Names the object's block and bitmap files; see fs_layout.h.
+static std::uint64_t object_id(const std::string& path) {
+    return std::hash<std::string>{}(path);
 }
 
+// The path itself lives only in the PathTable; an entry is found by the id
+// the table gave its path.
 struct CacheEntry {
-    std::string path;
-    std::string hash_hex;
-    std::size_t last_block = std::numeric_limits<std::size_t>::max();
+    std::uint64_t object = 0;
+    std::uint32_t id = 0;
+    std::uint16_t part = 0;
+    std::uint64_t bytes = 0;
+    std::atomic<double> cost{0};            // expected seconds to refetch one block
+    std::atomic<std::size_t> last_block{std::numeric_limits<std::size_t>::max()};
+    std::atomic<std::uint32_t> seq_run{0};  // blocks read in order up to last_block
+    // bumped by every drop, so a block write that started before one can
+    // tell; read without mu_ under the entry's io lock
+    std::atomic<std::uint32_t> epoch{0};
     bool evicted    = false;
+    // blocks [admitted_first, admitted_end) may have keys in the policy;
+    // guarded by policy_mu_, so a drop can take them all out
+    std::uint32_t admitted_first = 0;
+    std::uint32_t admitted_end   = 0;
+};
+
+// A capacity partition for paths under one prefix. Each partition has its
+// own policy instance; partitions may grow past their quota while the cache
+// has room, and those borrowing the most are evicted from first.
+struct Partition {
+    std::string   prefix;
+    std::uint64_t quota = 0;
+    std::uint64_t used  = 0;
 };
 
-class CacheManager {
+// Policy keys carry the entry id in the high half and the block index in the
+// low half, so a victim maps back to its entry without chasing pointers.
+static inline std::size_t block_key(std::uint32_t id, std::size_t blk) {
+    return (static_cast<std::size_t>(id) << 32) | (blk & 0xffffffffu);
+}
+
+// Reads started together on the backend's event loop; wait() returns once
+// every one has completed, so their round trips overlap.
+class FetchBatch {
 public:
-    explicit CacheManager(const std::string& root) : store_(root, kBlockSize), meta_("cache_meta.db", root), lru_(kCacheBlocksCapacity), prefetch_pool_(4), root_(root) {
+    // Fetches spans of path, in one request where the origin allows it;
+    // *got receives the result for each.
+    void start(const std::string& path, std::vector<cache_fs::ByteSpan> spans, std::vector<ssize_t>* got) {
+        {
+            std::lock_guard<std::mutex> g(mu_);
+            ++pending_;
+        }
+        cache_fs::backend_read_ranges_async(path, std::move(spans), [this, got](std::vector<ssize_t> n) {
+            std::lock_guard<std::mutex> g(mu_);
+            *got = std::move(n);
+            --pending_;
+            // notified under the lock, so wait() cannot return and destroy
+            // the batch before this is done with it
+            cv_.notify_one();
+        });
+    }
+    void wait() {
+        std::unique_lock<std::mutex> lk(mu_);
+        cv_.wait(lk, [&] { return pending_ == 0; });
+    }
+
+private:
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::size_t pending_ = 0;
+};
+
+static const char* metadata_db_path(MetadataStore::Backend backend) {
+    return backend == MetadataStore::Backend::Index ? "cache_meta.idx" : "cache_meta.db";
+}
+
+class CacheManagerBase {
+public:
+    CacheManagerBase(const std::string& root, MetadataStore::Backend meta_backend, std::size_t meta_shards)
+    : store_(root, kBlockSize),
+      meta_(metadata_db_path(meta_backend), root, MetadataStore::SyncLevel::Normal, meta_backend, meta_shards, &paths_),
+      root_(root) {
+        parts_.push_back(Partition{});
         store_.init();
         meta_.init();
     }
+    virtual ~CacheManagerBase() { store_.cleanup(); }
 
-    ssize_t read(const std::string& path, char* buf, std::size_t len, off_t off);
+    virtual ssize_t read(const std::string& path, char* buf, std::size_t len, off_t off) = 0;
 
-    ssize_t write(const std::string& path, const char* buf, std::size_t len, off_t off);
+    virtual ssize_t write(const std::string& path, const char* buf, std::size_t len, off_t off) = 0;
+    virtual void   evict_until_gb(double free_gb) = 0;
+    virtual int    add_partition(const std::string& prefix, std::uint64_t quota) = 0;
     void   flush_all();
-    void   evict_until_gb(double free_gb);
+    void   set_capacity(std::uint64_t bytes) { capacity_.store(bytes, std::memory_order_relaxed); kick_evictor(); }
+    std::uint64_t used_bytes() const { return store_.used_bytes(); }
+    void   set_attr_ttl(int seconds) { attr_ttl_.store(seconds, std::memory_order_relaxed); }
+    void   kick_evictor();
+    // Attributes come from the metadata table; they are stale once older
+    // than the attribute TTL and must be revalidated against the origin.
+    int    get_attr(const std::string& path, cache_attr* out);
+    void   put_attr(const std::string& path, const cache_attr& attr);
+    // The origin copy was changed behind the cache: drops the cached blocks
+    // and expires the attributes.
+    void   invalidate(const std::string& path);
     bool has_valid_entry(const std::string& path) {
         std::lock_guard<std::mutex> g(mu_);
-        auto it = entries_.find(path);
-        return it != entries_.end() && !it->second.evicted;
+        CacheEntry* ce = find_entry(path);
+        return ce && !ce->evicted;
     }
-    CacheEntry* get_entry(const std::string& path) {
-        std::lock_guard<std::mutex> g(mu_);
-        auto it = entries_.find(path);
-        return (it != entries_.end() && !it->second.evicted) ? &it->second : nullptr;
+    // The metadata row of a cached path. Without one the size comes from
+    // the local copy the cache reads through to.
+    std::optional<CacheMetadata> get_entry(const std::string& path) {
+        if (!has_valid_entry(path)) return std::nullopt;
+        if (auto row = meta_.get(path)) return row;
+        CacheMetadata row;
+        row.path       = path;
+        row.local_path = fs_layout::data_part_path(root_, object_id(path), 0);
+        std::error_code ec;
+        auto size = fs::file_size(fs::path(root_) / fs::path(path[0] == '/' ? path.substr(1) : path), ec);
+        if (!ec) row.size = size;
+        return row;
     }
 
-private:
+protected:
+    // Foreground operations hold one of these so the evictor can back off.
+    struct IoScope {
+        explicit IoScope(std::atomic<int>& n) : n_(n) { n_.fetch_add(1, std::memory_order_relaxed); }
+        ~IoScope() { n_.fetch_sub(1, std::memory_order_relaxed); }
+        std::atomic<int>& n_;
+    };
+
+    // Caller holds mu_. entry() creates the entry on first use.
     CacheEntry& entry(const std::string& path);
-    void schedule_prefetch(CacheEntry ce, std::size_t first_blk);
+    CacheEntry* find_entry(const std::string& path);
+    CacheEntry* entry_by_key(std::size_t key);
+
+    std::uint16_t partition_for(const std::string& path) const;
+    std::uint64_t quota_of(std::size_t part) const;
+    std::size_t   pick_partition(const std::vector<bool>& drained) const;
+    void          charge(CacheEntry& ce, std::int64_t grown);
+
+    // Stores a fetched block of ce without holding mu_. drop_entry takes the
+    // entry's io lock exclusively, so the write can neither land in a file
+    // being unlinked nor re-create one for an entry dropped since epoch was
+    // read under mu_. False if the block was not kept.
+    bool store_fetched(CacheEntry& ce, std::uint32_t epoch, const char* buf, std::size_t len, off_t off, std::size_t blk);
+    std::shared_mutex& io_lock(const CacheEntry& ce) { return io_mu_[ce.id % io_mu_.size()]; }
+
+    // Evicts until usage is at most target_bytes or max_victims objects are
+    // gone. Caller holds mu_. Returns false once the policy has no victims.
+    virtual bool evict_locked(std::uint64_t target_bytes, std::size_t max_victims) = 0;
+    // Drops the entries of blocks a policy displaced on touch, and those it
+    // reports as expired.
+    virtual void drop_due() = 0;
+    // Replays hits buffered since the last drain into the policy.
+    virtual void drain_accesses() = 0;
+    // Removes the keys of every block of ce admitted since its last drop.
+    // Takes policy_mu_.
+    virtual void forget_blocks(CacheEntry& ce) = 0;
+    void drop_entry(CacheEntry& ce);
+    void make_room(std::size_t incoming);
+    void note_usage();
+
+    void start_evictor();
+    void stop_evictor();
+    void evictor_loop();
+
+    std::uint64_t high_bytes() const { return static_cast<std::uint64_t>(capacity_.load(std::memory_order_relaxed) * kHighWatermark); }
+    std::uint64_t low_bytes()  const { return static_cast<std::uint64_t>(capacity_.load(std::memory_order_relaxed) * kLowWatermark); }
 
     std::mutex mu_;
     BlockStore store_;
+    // shared with meta_, so it is declared first
+    PathTable paths_;
     MetadataStore meta_;
-    LruPolicy lru_;
-    ThreadPool prefetch_pool_;
-    std::unordered_map<std::string, CacheEntry> entries_;
+    // indexed by path id; a deque so entries never move
+    std::deque<CacheEntry> entries_;
+    // striped by entry id; shared by block writes running without mu_,
+    // exclusive in drop_entry
+    std::array<std::shared_mutex, 64> io_mu_;
+    // parts_[0] is the catch-all partition; it gets whatever capacity the
+    // prefixed partitions do not reserve.
+    std::vector<Partition> parts_;
     std::string root_;
+
+    std::atomic<std::uint64_t> capacity_{kDefaultCapacityBytes};
+    std::atomic<int> attr_ttl_{60};
+    std::atomic<int> io_inflight_{0};
+    std::thread evictor_;
+    std::mutex evict_mu_;
+    std::condition_variable evict_cv_;
+    bool evict_stop_ = false;
+    bool evict_kick_ = false;
 };
 
-ssize_t CacheManager::read(const std::string& path, char* buf, std::size_t len, off_t off) {
-    std::lock_guard<std::mutex> g(mu_);
-    CacheEntry& ce = entry(path);
-    if (ce.evicted) return -ENOENT;
+template <class Policy>
+class CacheManager final : public CacheManagerBase {
+    static_assert(eviction::is_policy<Policy>::value, "Policy does not model the eviction policy interface");
+
+public:
+    template <class... Args>
+    CacheManager(const std::string& root, MetadataStore::Backend meta_backend, std::size_t meta_shards, Args&&... policy_args)
+    : CacheManagerBase(root, meta_backend, meta_shards), prefetch_pool_(4) {
+        make_policy_ = [args = std::make_tuple(policy_args...)] {
+            return std::apply([](const auto&... a) { return std::make_unique<Policy>(a...); }, args);
+        };
+        policies_.reserve(kMaxPartitions);
+        policies_.push_back(make_policy_());
+        start_evictor();
+    }
+    ~CacheManager() override {
+        // prefetch completions call back into this object
+        std::unique_lock<std::mutex> lk(prefetch_mu_);
+        prefetch_stop_ = true;
+        prefetch_cv_.wait(lk, [&] { return prefetching_.empty() && bulk_.empty(); });
+        lk.unlock();
+        stop_evictor();
+    }
+
+    ssize_t read(const std::string& path, char* buf, std::size_t len, off_t off) override;
+
+    ssize_t write(const std::string& path, const char* buf, std::size_t len, off_t off) override;
+    void   evict_until_gb(double free_gb) override;
+    int    add_partition(const std::string& prefix, std::uint64_t quota) override;
+
+private:
+    bool evict_locked(std::uint64_t target_bytes, std::size_t max_victims) override;
+    void drop_due() override;
+    void drain_accesses() override;
+    void forget_blocks(CacheEntry& ce) override;
+    void schedule_prefetch(const std::string& path, const CacheEntry& ce, std::size_t first_blk);
+    void store_prefetched(std::uint32_t id, std::size_t blk, const char* buf, ssize_t got);
+    void wait_inflight(const CacheEntry& ce, std::size_t first_blk, std::size_t last_blk);
+
+    // A large file read sequentially, fetched ahead of the reader as
+    // several concurrent range streams. Guarded by prefetch_mu_.
+    struct BulkFetch {
+        std::string   path;
+        std::uint64_t object = 0;
+        std::uint64_t size   = 0;
+        std::uint64_t next   = 0;   // offset of the next chunk to hand out
+        std::uint64_t end    = 0;   // fetch up to here; moves with the reader
+        std::size_t   active = 0;   // chunks in flight
+        StreamTuner   tuner{1, kBulkMaxStreams, 2};
+    };
+    // Starts or extends the bulk fetch of a file whose reader is at blk;
+    // false if the file does not qualify and gets the regular prefetch.
+    bool bulk_read(const std::string& path, CacheEntry& ce, std::size_t blk);
+    // Hands out chunks until every stream the tuner allows is busy. Caller
+    // holds prefetch_mu_.
+    void pump_bulk(std::uint32_t id, BulkFetch& b);
+    void bulk_chunk_done(std::uint32_t id, std::uint64_t off, const std::vector<std::size_t>& blks,
+                         const char* buf, const std::vector<ssize_t>& got, double seconds);
+
+    // Hits go straight to a policy with a lock-free hit(), or else through
+    // the lossy access buffer, and never wait for policy_mu_; newly stored
+    // blocks are admitted directly so none goes untracked. A block whose
+    // entry was dropped since epoch was read is not admitted.
+    void record_hit(const CacheEntry& ce, std::size_t blk, double hotness);
+    void admit(CacheEntry& ce, std::uint32_t epoch, std::size_t blk, double hotness);
+    void drain_locked();
+    // Caller holds policy_mu_. Queues a key touch() displaced for the
+    // evictor and wakes it.
+    void note_displaced(std::size_t key);
+
+    std::function<std::unique_ptr<Policy>()> make_policy_;
+    // Guards policies_ and every call into a policy but the lock-free hit().
+    // Taken after mu_ when both are needed, never before.
+    std::mutex policy_mu_;
+    std::vector<std::unique_ptr<Policy>> policies_;
+    // keys a policy displaced to admit another; their entries are dropped
+    // by the evictor, which can take mu_. Guarded by policy_mu_.
+    std::vector<std::size_t> displaced_;
+    AccessBuffer accesses_;
+    // Prefetch reads run on the backend's event loop; this pool only stores
+    // the blocks they bring back.
+    ThreadPool prefetch_pool_;
+    // policy keys of the blocks being prefetched, so overlapping windows
+    // do not fetch a block twice
+    std::mutex prefetch_mu_;
+    std::condition_variable prefetch_cv_;
+    std::unordered_set<std::size_t> prefetching_;
+    std::unordered_map<std::uint32_t, BulkFetch> bulk_;   // by entry id
+    bool prefetch_stop_ = false;
+};
+
+template <class Policy>
+ssize_t CacheManager<Policy>::read(const std::string& path, char* buf, std::size_t len, off_t off) {
+    IoScope io(io_inflight_);
+    CacheEntry* cep;
+    {
+        std::lock_guard<std::mutex> g(mu_);
+        cep = &entry(path);
+        // an evicted entry is just cold; its blocks are refetched below
+        cep->evicted = false;
+    }
+    CacheEntry& ce = *cep;
+
+    // Blocks of the range that are not stored are all requested up front,
+    // in one multi-range GET, so a read spanning several misses waits for
+    // one round trip, not one per block.
+    const std::size_t first_blk = off / kBlockSize;
+    const std::size_t last_blk  = len ? (off + len - 1) / kBlockSize : first_blk;
+    std::vector<std::unique_ptr<char[]>> fetched(last_blk - first_blk + 1);
+    std::vector<ssize_t> fetched_got(fetched.size(), -1);
+    if (len) wait_inflight(ce, first_blk, last_blk);
+    {
+        std::vector<cache_fs::ByteSpan> spans;
+        std::vector<std::size_t> span_blk;
+        for (std::size_t blk = first_blk; len && blk <= last_blk; ++blk) {
+            if (meta_.isBlockPresent(ce.object, blk * kBlockSize / fs_layout::kMaxPartSize, blk)) continue;
+            fetched[blk - first_blk].reset(new char[kBlockSize]);
+            spans.push_back({fetched[blk - first_blk].get(), kBlockSize, static_cast<off_t>(blk * kBlockSize)});
+            span_blk.push_back(blk);
+        }
+        if (!spans.empty()) {
+            std::vector<ssize_t> got;
+            FetchBatch batch;
+            batch.start(path, std::move(spans), &got);
+            batch.wait();
+            for (std::size_t i = 0; i < span_blk.size(); ++i) fetched_got[span_blk[i] - first_blk] = got[i];
+        }
+    }
 
     ssize_t done = 0;
+    std::optional<std::uint64_t> origin_eof;
     while (done < static_cast<ssize_t>(len)) {
         std::size_t blk = (off + done) / kBlockSize;
         off_t blk_off   = blk * kBlockSize;
@@ -91,9 +405,21 @@ ssize_t CacheManager::read(const std::string& path, char* buf, std::size_t len,
         std::size_t want= std::min<std::size_t>(kBlockSize - in, len - done);
 
         char block[kBlockSize];
-        bool cached = store_.read(ce.hash_hex, block,kBlockSize, blk_off) == static_cast<ssize_t>(kBlockSize);
+        std::size_t part_idx = blk_off / fs_layout::kMaxPartSize;
+        // the presence map tells a stored block, possibly a short final
+        // one, from a hole in the sparse part file
+        ssize_t avail = store_.read(ce.object, block, kBlockSize, blk_off);
+        bool cached = avail > 0 && meta_.isBlockPresent(ce.object, part_idx, blk);
         if (!cached) {
-            ssize_t got = cache_fs::backend_read_range(path, block, kBlockSize, blk_off);
+            ssize_t got;
+            if (const char* pre = fetched[blk - first_blk].get()) {
+                got = fetched_got[blk - first_blk];
+                if (got > 0) std::memcpy(block, pre, got);
+            } else {
+                // the presence bit was set but the stored block is gone
+                got = cache_fs::backend_read_range(path, block, kBlockSize, blk_off);
+            }
+            if (got > 0) ce.cost.store(cache_fs::backend_refetch_cost(path, kBlockSize), std::memory_order_relaxed);
             if (got <= 0) {
                 fs::path src = fs::path(root_) /
                             fs::path(path[0] == '/' ? path.substr(1) : path);
@@ -103,26 +429,61 @@ ssize_t CacheManager::read(const std::string& path, char* buf, std::size_t len,
                     ::close(fd);
                 }
             }
-            if (got <= 0) return (done ? done : -1);
-            store_.write(ce.hash_hex, block, got, blk_off, false);
+            if (got < 0) return (done ? done : -1);
+            // nothing at or past this block: the read ends short, or
+            // empty when it starts at the end of the file
+            if (got == 0) break;
+            bool keep;
+            std::uint32_t epoch;
+            {
+                std::lock_guard<std::mutex> g(mu_);
+                make_room(got);
+                // make_room may have picked this entry; the block is still
+                // returned, just not stored
+                keep  = !ce.evicted;
+                epoch = ce.epoch.load(std::memory_order_relaxed);
+            }
+            if (keep && store_fetched(ce, epoch, block, got, blk_off, blk)) admit(ce, epoch, blk, 1.0);
+            avail = got;
+            if (static_cast<std::size_t>(got) < kBlockSize) origin_eof = blk_off + got;
+        } else {
+            record_hit(ce, blk, 1.0);
         }
+        // a short block is the end of the file
+        if (static_cast<std::size_t>(avail) <= in) break;
+        want = std::min<std::size_t>(want, avail - in);
         std::memcpy(buf + done, block + in, want);
         done += want;
 
-        lru_.touch(reinterpret_cast<std::uintptr_t>(&ce)<<32 | blk, kBlockSize, 1.0);
-
-        bool seq = (ce.last_block != std::numeric_limits<std::size_t>::max()) && (blk == ce.last_block + 1);
-        ce.last_block = blk;
-        if (seq) schedule_prefetch(ce, blk + 1);
+        std::size_t prev = ce.last_block.exchange(blk, std::memory_order_relaxed);
+        bool seq = (prev != std::numeric_limits<std::size_t>::max()) && (blk == prev + 1);
+        if (seq) {
+            ce.seq_run.fetch_add(1, std::memory_order_relaxed);
+            if (!bulk_read(path, ce, blk)) schedule_prefetch(path, ce, blk + 1);
+        } else if (blk != prev) {
+            ce.seq_run.store(0, std::memory_order_relaxed);
+        }
+        if (static_cast<std::size_t>(avail) < kBlockSize) break;
+    }
+    meta_.updateAccessTime(path, std::time(nullptr));
+    if (origin_eof) {
+        auto row = meta_.get(path);
+        if (row && row->size != *origin_eof) {
+            row->size = *origin_eof;
+            meta_.put(*row);
+        }
     }
+    note_usage();
     return done;
 }
 
-ssize_t CacheManager::write(const std::string& path, const char* buf, std::size_t len, off_t off)
+template <class Policy>
+ssize_t CacheManager<Policy>::write(const std::string& path, const char* buf, std::size_t len, off_t off)
 {
+    IoScope io(io_inflight_);
     std::lock_guard<std::mutex> g(mu_);
     CacheEntry& ce = entry(path);
-    if (ce.evicted) return -ENOENT;
+    ce.evicted = false;
 
     int dst_fd = -1;
     auto ensure_dst = [&] {
@@ -141,13 +502,20 @@ std::size_t in   = (off + done) - boff;
 std::size_t chunk= std::min<std::size_t>(kBlockSize - in, len - done);
 
 char block[kBlockSize]{};
-store_.read(ce.hash_hex, block, kBlockSize, boff);
+store_.read(ce.object, block, kBlockSize, boff);
 std::memcpy(block + in, buf + done, chunk);
-store_.write(ce.hash_hex, block, kBlockSize, boff, true);
+make_room(kBlockSize);
+// make_room may have dropped this entry, with the blocks written so far;
+// unlike a fetched block this one is not ours to skip, so the entry comes
+// back with it
+ce.evicted = false;
+std::int64_t grown = 0;
+store_.write(ce.object, block, kBlockSize, boff, true, &grown);
+meta_.markPresentBlock(ce.object, boff / fs_layout::kMaxPartSize, blk);
+charge(ce, grown);
 
-meta_.markDirtyBlock(ce.hash_hex, boff / fs_layout::kMaxPartSize, blk);
-lru_.touch(reinterpret_cast<std::uintptr_t>(&ce)<<32 | blk,
-kBlockSize, 1.0);
+meta_.markDirtyBlock(ce.object, boff / fs_layout::kMaxPartSize, blk);
+admit(ce, ce.epoch.load(std::memory_order_relaxed), blk, 1.0);
 
 ensure_dst();
 ::pwrite(dst_fd, buf + done, chunk, off + done);
@@ -155,66 +523,593 @@ ensure_dst();
 done += chunk;
 }
 if (dst_fd != -1) ::close(dst_fd);
+// we are the writer, so the new size is known to be current; mtime stays
+// the origin's, since revalidation compares it with the origin's answer
+if (auto row = meta_.get(path)) {
+    row->size  = std::max<std::size_t>(row->size, off + len);
+    row->timestamp = row->last_accessed = std::time(nullptr);
+    row->dirty = true;
+    meta_.put(*row);
+}
+note_usage();
 return done;
 }
 
-void CacheManager::flush_all() {
+int CacheManagerBase::get_attr(const std::string& path, cache_attr* out) {
+    auto row = meta_.get(path);
+    if (!row) return -ENOENT;
+    out->size   = row->size;
+    out->mtime  = row->mtime;
+    out->is_dir = row->is_dir;
+    return std::time(nullptr) - row->timestamp < attr_ttl_.load(std::memory_order_relaxed) ? 0 : -ESTALE;
+}
+
+void CacheManagerBase::put_attr(const std::string& path, const cache_attr& attr) {
+    auto old = meta_.get(path);
+    // the origin copy changed under us, so the cached blocks are stale
+    if (old && !attr.is_dir && (old->size != attr.size || old->mtime != attr.mtime)) {
+        std::lock_guard<std::mutex> g(mu_);
+        CacheEntry* ce = find_entry(path);
+        if (ce && !ce->evicted) drop_entry(*ce);
+    }
+    CacheMetadata row = old.value_or(CacheMetadata{});
+    row.path       = path;
+    row.local_path = fs_layout::data_part_path(root_, object_id(path), 0);
+    row.size       = attr.size;
+    row.mtime      = attr.mtime;
+    row.is_dir     = attr.is_dir;
+    row.timestamp  = std::time(nullptr);
+    meta_.put(row);
+}
+
+void CacheManagerBase::invalidate(const std::string& path) {
+    {
+        std::lock_guard<std::mutex> g(mu_);
+        CacheEntry* ce = find_entry(path);
+        if (ce && !ce->evicted) drop_entry(*ce);
+    }
+    if (auto row = meta_.get(path)) {
+        row->timestamp = 0;
+        meta_.put(*row);
+    }
+}
+
+void CacheManagerBase::flush_all() {
+    meta_.checkpoint();
+}
+
+template <class Policy>
+void CacheManager<Policy>::evict_until_gb(double free_gb) {
     std::lock_guard<std::mutex> g(mu_);
-    for (auto& [_, ce] : entries_) meta_.flushBitmaps(ce.hash_hex);
+    const auto limit = static_cast<std::uint64_t>(free_gb * 1024.0 * 1024.0 * 1024.0);
+    while (evict_locked(limit, kEvictBatch)) {}
 }
 
-void CacheManager::evict_until_gb(double free_gb) {
-    auto used_gb = [&] {
-        std::uintmax_t bytes = 0;
-        for (auto& f : fs::recursive_directory_iterator(root_))
-            if (f.is_regular_file()) bytes += f.file_size();
-        return double(bytes)/(1024.0*1024.0*1024.0);
-    };
-    while (used_gb() > free_gb) {
-        std::uintptr_t key = lru_.evict();
-        if (key == std::numeric_limits<std::uintptr_t>::max()) break;
-        auto* ce = reinterpret_cast<CacheEntry*>(key >> 32);
+template <class Policy>
+int CacheManager<Policy>::add_partition(const std::string& prefix, std::uint64_t quota) {
+    if (prefix.empty()) return -EINVAL;
+    std::lock_guard<std::mutex> g(mu_);
+    if (parts_.size() >= kMaxPartitions) return -ENOSPC;
+    for (auto& p : parts_) {
+        if (p.prefix == prefix) {
+            p.quota = quota;
+            return 0;
+        }
+    }
+    parts_.push_back(Partition{prefix, quota, 0});
+    std::lock_guard<std::mutex> pg(policy_mu_);
+    policies_.push_back(make_policy_());
+    return 0;
+}
+
+template <class Policy>
+bool CacheManager<Policy>::evict_locked(std::uint64_t target_bytes, std::size_t max_victims) {
+    drain_accesses();
+    std::size_t victims = 0;
+    std::vector<bool> drained(parts_.size(), false);
+    while (store_.used_bytes() > target_bytes) {
+        if (victims == max_victims) return true;
+        std::size_t part = pick_partition(drained);
+        if (part == parts_.size()) return false;
+        std::size_t key;
+        {
+            // not held over the drop, which takes it to forget the
+            // victim's other blocks
+            std::lock_guard<std::mutex> pg(policy_mu_);
+            key = policies_[part]->evict();
+        }
+        if (key == eviction::kNoVictim) {
+            drained[part] = true;
+            continue;
+        }
+        CacheEntry* ce = entry_by_key(key);
         if (!ce || ce->evicted) continue;
-        store_.delete_object(ce->hash_hex);
-        meta_.flushBitmaps(ce->hash_hex);
-        ce->evicted = true;
-    }
-}
-
-CacheEntry& CacheManager::entry(const std::string& path) {
-    auto it = entries_.find(path);
-    if (it != entries_.end()) return it->second;
-    CacheEntry ce{path, hash_hex(path)};
-    return entries_.emplace(path, std::move(ce)).first->second;
-}
-
-void CacheManager::schedule_prefetch(CacheEntry ce, std::size_t first_blk) {
-    prefetch_pool_.enqueue([this, ce, first_blk]() {
-        for (std::size_t i = 0; i < PREFETCH_WINDOW; ++i) {
-            std::size_t blk = first_blk + i;
-            off_t off       = blk * kBlockSize;
-            char  buf[kBlockSize];
-            if (store_.read(ce.hash_hex, buf, kBlockSize, off) ==
-                static_cast<ssize_t>(kBlockSize))
-                continue;
-            ssize_t got = cache_fs::backend_read_range(
-                            ce.path, buf, kBlockSize, off);
-            if (got > 0) {
-                store_.write(ce.hash_hex, buf, got, off, false);
-                lru_.touch(reinterpret_cast<std::uintptr_t>(
-                            const_cast<CacheEntry*>(&ce))<<32 | blk,
-                        kBlockSize, 0.25);
+        drop_entry(*ce);
+        ++victims;
+    }
+    return false;
+}
+
+template <class Policy>
+void CacheManager<Policy>::drop_due() {
+    std::vector<std::size_t> due;
+    std::lock_guard<std::mutex> g(mu_);
+    {
+        std::lock_guard<std::mutex> pg(policy_mu_);
+        due.swap(displaced_);
+        if constexpr (eviction::has_expiry<Policy>::value) {
+            for (auto& policy : policies_) policy->expire(due);
+        }
+    }
+    for (std::size_t key : due) {
+        CacheEntry* ce = entry_by_key(key);
+        if (ce && !ce->evicted) drop_entry(*ce);
+    }
+}
+
+template <class Policy>
+void CacheManager<Policy>::drain_accesses() {
+    std::lock_guard<std::mutex> pg(policy_mu_);
+    drain_locked();
+}
+
+template <class Policy>
+void CacheManager<Policy>::drain_locked() {
+    accesses_.drain([this](const AccessBuffer::Access& a) {
+        note_displaced(eviction::touch(*policies_[a.part], a.key, kBlockSize, a.hotness, a.cost));
+    });
+}
+
+template <class Policy>
+void CacheManager<Policy>::note_displaced(std::size_t key) {
+    if (key == eviction::kNoVictim) return;
+    displaced_.push_back(key);
+    if (displaced_.size() == 1) kick_evictor();
+}
+
+template <class Policy>
+void CacheManager<Policy>::record_hit(const CacheEntry& ce, std::size_t blk, double hotness) {
+    if constexpr (eviction::has_lockfree_hit<Policy>::value) {
+        // ce.part was added before ce was handed out and policies_ never
+        // reallocates, so the slot can be read without policy_mu_
+        if (policies_[ce.part]->hit(block_key(ce.id, blk), hotness)) return;
+    }
+    std::size_t pending = accesses_.record(block_key(ce.id, blk), ce.part, hotness,
+                                           ce.cost.load(std::memory_order_relaxed));
+    // a dropped hit (0) means the stripe is full, so drain as well
+    if (pending != 0 && pending < AccessBuffer::kDrainThreshold) return;
+    // whoever gets the lock drains for everyone; the rest move on
+    std::unique_lock<std::mutex> pg(policy_mu_, std::try_to_lock);
+    if (pg.owns_lock()) drain_locked();
+}
+
+template <class Policy>
+void CacheManager<Policy>::admit(CacheEntry& ce, std::uint32_t epoch, std::size_t blk, double hotness) {
+    std::lock_guard<std::mutex> pg(policy_mu_);
+    drain_locked();
+    // drop_entry bumps the epoch before forget_blocks takes policy_mu_, so
+    // a key added here is either refused or removed by the drop
+    if (ce.epoch.load(std::memory_order_relaxed) != epoch) return;
+    note_displaced(eviction::touch(*policies_[ce.part], block_key(ce.id, blk), kBlockSize, hotness,
+                                   ce.cost.load(std::memory_order_relaxed)));
+    auto b = static_cast<std::uint32_t>(blk);
+    if (ce.admitted_first == ce.admitted_end) {
+        ce.admitted_first = b;
+        ce.admitted_end   = b + 1;
+    } else {
+        ce.admitted_first = std::min(ce.admitted_first, b);
+        ce.admitted_end   = std::max(ce.admitted_end, b + 1);
+    }
+}
+
+template <class Policy>
+void CacheManager<Policy>::forget_blocks(CacheEntry& ce) {
+    std::lock_guard<std::mutex> pg(policy_mu_);
+    // buffered hits on the entry would put its keys back
+    drain_locked();
+    for (std::uint32_t blk = ce.admitted_first; blk < ce.admitted_end; ++blk)
+        policies_[ce.part]->remove(block_key(ce.id, blk));
+    ce.admitted_first = ce.admitted_end = 0;
+}
+
+void CacheManagerBase::drop_entry(CacheEntry& ce) {
+    {
+        // waits out block writes of this entry already running without mu_
+        std::unique_lock<std::shared_mutex> io(io_lock(ce));
+        ce.epoch.fetch_add(1, std::memory_order_relaxed);
+        store_.delete_object(ce.object);
+        meta_.dropBitmaps(ce.object);
+        charge(ce, -static_cast<std::int64_t>(ce.bytes));
+        ce.evicted = true;
+    }
+    forget_blocks(ce);
+}
+
+std::uint16_t CacheManagerBase::partition_for(const std::string& path) const {
+    std::size_t best = 0, best_len = 0;
+    for (std::size_t i = 1; i < parts_.size(); ++i) {
+        const std::string& pre = parts_[i].prefix;
+        if (pre.size() > best_len && path.compare(0, pre.size(), pre) == 0) {
+            best = i;
+            best_len = pre.size();
+        }
+    }
+    return static_cast<std::uint16_t>(best);
+}
+
+std::uint64_t CacheManagerBase::quota_of(std::size_t part) const {
+    if (part != 0) return parts_[part].quota;
+    std::uint64_t cap = capacity_.load(std::memory_order_relaxed), reserved = 0;
+    for (std::size_t i = 1; i < parts_.size(); ++i) reserved += parts_[i].quota;
+    return cap > reserved ? cap - reserved : 0;
+}
+
+// The partition furthest above its quota gives up the next victim, so idle
+// capacity borrowed by one tenant is reclaimed before anyone's reserved share.
+std::size_t CacheManagerBase::pick_partition(const std::vector<bool>& drained) const {
+    std::size_t best = parts_.size();
+    double best_over = 0;
+    for (std::size_t i = 0; i < parts_.size(); ++i) {
+        if (drained[i] || parts_[i].used == 0) continue;
+        double over = double(parts_[i].used) - double(quota_of(i));
+        if (best == parts_.size() || over > best_over) {
+            best = i;
+            best_over = over;
+        }
+    }
+    return best;
+}
+
+void CacheManagerBase::charge(CacheEntry& ce, std::int64_t grown) {
+    auto apply = [grown](std::uint64_t& v) {
+        v = (grown < 0 && std::uint64_t(-grown) > v) ? 0 : v + grown;
+    };
+    apply(ce.bytes);
+    apply(parts_[ce.part].used);
+}
+
+bool CacheManagerBase::store_fetched(CacheEntry& ce, std::uint32_t epoch, const char* buf, std::size_t len, off_t off,
+                                     std::size_t blk) {
+    std::int64_t grown = 0;
+    ssize_t n;
+    {
+        std::shared_lock<std::shared_mutex> io(io_lock(ce));
+        if (ce.epoch.load(std::memory_order_relaxed) != epoch) return false;
+        n = store_.write(ce.object, buf, len, off, false, &grown);
+    }
+    std::lock_guard<std::mutex> g(mu_);
+    // dropped after the write: delete_object already took the block's
+    // bytes off the store, and ce.bytes never had them
+    if (ce.epoch.load(std::memory_order_relaxed) != epoch) return false;
+    charge(ce, grown);
+    if (n <= 0) return false;
+    meta_.markPresentBlock(ce.object, off / fs_layout::kMaxPartSize, blk);
+    return true;
+}
+
+// Emergency path: only runs when the incoming block would not fit under the
+// capacity, i.e. when the background evictor has fallen behind.
+void CacheManagerBase::make_room(std::size_t incoming) {
+    std::uint64_t cap = capacity_.load(std::memory_order_relaxed);
+    if (store_.used_bytes() + incoming <= cap) return;
+    std::uint64_t target = cap > incoming ? cap - incoming : 0;
+    while (evict_locked(target, kEvictBatch)) {}
+}
+
+void CacheManagerBase::note_usage() {
+    if (store_.used_bytes() > high_bytes()) kick_evictor();
+}
+
+void CacheManagerBase::kick_evictor() {
+    {
+        std::lock_guard<std::mutex> lk(evict_mu_);
+        evict_kick_ = true;
+    }
+    evict_cv_.notify_one();
+}
+
+void CacheManagerBase::start_evictor() {
+    evictor_ = std::thread(&CacheManagerBase::evictor_loop, this);
+}
+
+void CacheManagerBase::stop_evictor() {
+    {
+        std::lock_guard<std::mutex> lk(evict_mu_);
+        evict_stop_ = true;
+    }
+    evict_cv_.notify_one();
+    if (evictor_.joinable()) evictor_.join();
+}
+
+void CacheManagerBase::evictor_loop() {
+    std::unique_lock<std::mutex> lk(evict_mu_);
+    while (!evict_stop_) {
+        evict_cv_.wait_for(lk, kEvictorPeriod, [&] { return evict_stop_ || evict_kick_; });
+        evict_kick_ = false;
+        if (evict_stop_) break;
+        lk.unlock();
+        drain_accesses();
+        drop_due();
+        if (store_.used_bytes() <= high_bytes()) {
+            lk.lock();
+            continue;
+        }
+
+        // Drain to the low watermark in small batches, dropping mu_ between
+        // them and backing off while foreground reads and writes are active.
+        bool more = true;
+        while (more && store_.used_bytes() > low_bytes()) {
+            {
+                std::lock_guard<std::mutex> g(mu_);
+                more = evict_locked(low_bytes(), kEvictBatch);
             }
+            if (io_inflight_.load(std::memory_order_relaxed) > 0)
+                std::this_thread::sleep_for(kEvictorThrottle);
+            else
+                std::this_thread::yield();
+
+            std::lock_guard<std::mutex> stop(evict_mu_);
+            if (evict_stop_) break;
+        }
+        lk.lock();
+    }
+}
+
+CacheEntry& CacheManagerBase::entry(const std::string& path) {
+    std::uint32_t id = paths_.intern(path);
+    // the metadata store interns into the same table, so the ids it took
+    // since the last entry get theirs too, keeping entries_ indexed by id
+    while (entries_.size() <= id) {
+        CacheEntry& stored = entries_.emplace_back();
+        std::string name(paths_.path(static_cast<std::uint32_t>(entries_.size() - 1)));
+        stored.object = object_id(name);
+        stored.id = static_cast<std::uint32_t>(entries_.size() - 1);
+        stored.part = partition_for(name);
+        stored.cost.store(cache_fs::backend_refetch_cost(name, kBlockSize), std::memory_order_relaxed);
+    }
+    return entries_[id];
+}
+
+CacheEntry* CacheManagerBase::find_entry(const std::string& path) {
+    std::uint32_t id = paths_.find(path);
+    return id < entries_.size() ? &entries_[id] : nullptr;
+}
+
+CacheEntry* CacheManagerBase::entry_by_key(std::size_t key) {
+    std::size_t id = key >> 32;
+    return id < entries_.size() ? &entries_[id] : nullptr;
+}
+
+template <class Policy>
+void CacheManager<Policy>::schedule_prefetch(const std::string& path, const CacheEntry& ce, std::size_t first_blk) {
+    // blocks past the known end of the file would only fail
+    auto row = meta_.get(path);
+    const std::uint64_t size = row && !row->is_dir ? row->size : 0;
+    // the window's missing blocks go out as one multi-range GET into
+    // consecutive slots of one buffer
+    std::shared_ptr<char[]> buf(new char[PREFETCH_WINDOW * kBlockSize]);
+    std::vector<cache_fs::ByteSpan> spans;
+    std::vector<std::size_t> blks;
+    for (std::size_t i = 0; i < PREFETCH_WINDOW; ++i) {
+        std::size_t blk = first_blk + i;
+        off_t off       = blk * kBlockSize;
+        if (size != 0 && static_cast<std::uint64_t>(off) >= size) break;
+        if (meta_.isBlockPresent(ce.object, off / fs_layout::kMaxPartSize, blk))
+            continue;
+        // prefetch is speculative and never forces eviction
+        if (store_.used_bytes() + (spans.size() + 1) * kBlockSize > capacity_.load(std::memory_order_relaxed)) break;
+        {
+            std::lock_guard<std::mutex> g(prefetch_mu_);
+            if (!prefetching_.insert(block_key(ce.id, blk)).second) continue;
         }
+        spans.push_back({buf.get() + spans.size() * kBlockSize, kBlockSize, off});
+        blks.push_back(blk);
+    }
+    if (spans.empty()) return;
+    cache_fs::backend_read_ranges_async(path, std::move(spans),
+        [this, id = ce.id, blks, buf](std::vector<ssize_t> got) {
+            // runs on the backend's event loop, which must not wait on disk
+            prefetch_pool_.enqueue([this, id, blks, buf, got] {
+                for (std::size_t i = 0; i < blks.size(); ++i)
+                    store_prefetched(id, blks[i], buf.get() + i * kBlockSize, got[i]);
+            });
+        });
+}
+
+template <class Policy>
+void CacheManager<Policy>::store_prefetched(std::uint32_t id, std::size_t blk, const char* buf, ssize_t got) {
+    off_t off = blk * kBlockSize;
+    if (got > 0 && store_.used_bytes() + got <= capacity_.load(std::memory_order_relaxed)) {
+        CacheEntry* pce;
+        bool keep;
+        std::uint32_t epoch;
+        {
+            std::lock_guard<std::mutex> g(mu_);
+            pce   = &entries_[id];
+            // an entry dropped while its blocks were in flight stays dropped
+            keep  = !pce->evicted;
+            epoch = pce->epoch.load(std::memory_order_relaxed);
+        }
+        if (keep && store_fetched(*pce, epoch, buf, got, off, blk)) {
+            note_usage();
+            admit(*pce, epoch, blk, 0.25);
+        }
+    }
+    std::lock_guard<std::mutex> g(prefetch_mu_);
+    prefetching_.erase(block_key(id, blk));
+    // readers may be waiting for this block, the destructor for them all
+    prefetch_cv_.notify_all();
+}
+
+template <class Policy>
+void CacheManager<Policy>::wait_inflight(const CacheEntry& ce, std::size_t first_blk, std::size_t last_blk) {
+    std::unique_lock<std::mutex> lk(prefetch_mu_);
+    prefetch_cv_.wait_for(lk, kInflightWait, [&] {
+        for (std::size_t blk = first_blk; blk <= last_blk && !prefetching_.empty(); ++blk) {
+            if (prefetching_.count(block_key(ce.id, blk))) return false;
+        }
+        return true;
     });
 }
 
-static std::unique_ptr<CacheManager> g_cache;
+template <class Policy>
+bool CacheManager<Policy>::bulk_read(const std::string& path, CacheEntry& ce, std::size_t blk) {
+    const std::uint64_t ahead = (blk + 1) * kBlockSize;
+    {
+        std::lock_guard<std::mutex> g(prefetch_mu_);
+        auto it = bulk_.find(ce.id);
+        if (it != bulk_.end()) {
+            BulkFetch& b = it->second;
+            b.end = std::max(b.end, std::min(b.size, ahead + kBulkWindowBytes));
+            pump_bulk(ce.id, b);
+            return true;
+        }
+    }
+    if (ce.seq_run.load(std::memory_order_relaxed) < kBulkAfterBlocks) return false;
+    auto row = meta_.get(path);
+    if (!row || row->is_dir || row->size < kBulkMinBytes || ahead >= row->size) return false;
+    // the regular window keeps a few blocks ahead stored; anything past it
+    // means the file is warm
+    const std::size_t probe = blk + PREFETCH_WINDOW + 1;
+    if (meta_.isBlockPresent(ce.object, probe * kBlockSize / fs_layout::kMaxPartSize, probe)) return false;
+
+    std::lock_guard<std::mutex> g(prefetch_mu_);
+    if (prefetch_stop_) return false;
+    auto [it, fresh] = bulk_.try_emplace(ce.id);
+    BulkFetch& b = it->second;
+    if (fresh) {
+        b.path   = path;
+        b.object = ce.object;
+        b.size   = row->size;
+        b.next   = ahead;
+    }
+    b.end = std::max(b.end, std::min(b.size, ahead + kBulkWindowBytes));
+    pump_bulk(ce.id, b);
+    if (b.active == 0) bulk_.erase(it);
+    return true;
+}
+
+template <class Policy>
+void CacheManager<Policy>::pump_bulk(std::uint32_t id, BulkFetch& b) {
+    while (!prefetch_stop_ && b.active < b.tuner.streams() && b.next < b.end) {
+        // speculative like the prefetch window, so it stops short of the
+        // point where the evictor would start
+        if (store_.used_bytes() + kBulkChunkBytes > high_bytes()) {
+            b.end = b.next;
+            break;
+        }
+        const std::uint64_t off = b.next;
+        const std::uint64_t len = std::min<std::uint64_t>(kBulkChunkBytes, b.end - off);
+        b.next += len;
+
+        // the chunk's missing blocks land in one buffer at their offset in
+        // the chunk; adjacent ones go out as a single range
+        std::shared_ptr<char[]> buf(new char[len]);
+        std::vector<cache_fs::ByteSpan> spans;
+        std::vector<std::size_t> blks;
+        for (std::size_t blk = off / kBlockSize; blk * kBlockSize < off + len; ++blk) {
+            const std::uint64_t boff = blk * kBlockSize;
+            if (meta_.isBlockPresent(b.object, boff / fs_layout::kMaxPartSize, blk)) continue;
+            if (!prefetching_.insert(block_key(id, blk)).second) continue;
+            spans.push_back({buf.get() + (boff - off), std::min<std::size_t>(kBlockSize, off + len - boff),
+                             static_cast<off_t>(boff)});
+            blks.push_back(blk);
+        }
+        if (spans.empty()) continue;
+        ++b.active;
+        auto t0 = std::chrono::steady_clock::now();
+        cache_fs::backend_read_ranges_async(b.path, std::move(spans),
+            [this, id, off, blks, buf, t0](std::vector<ssize_t> got) {
+                std::chrono::duration<double> dt = std::chrono::steady_clock::now() - t0;
+                // runs on the backend's event loop, which must not wait on disk
+                prefetch_pool_.enqueue([this, id, off, blks, buf, got, secs = dt.count()] {
+                    bulk_chunk_done(id, off, blks, buf.get(), got, secs);
+                });
+            });
+    }
+}
+
+template <class Policy>
+void CacheManager<Policy>::bulk_chunk_done(std::uint32_t id, std::uint64_t off,
+                                           const std::vector<std::size_t>& blks, const char* buf,
+                                           const std::vector<ssize_t>& got, double seconds) {
+    std::size_t bytes = 0;
+    bool failed = false;
+    for (std::size_t i = 0; i < blks.size(); ++i) {
+        store_prefetched(id, blks[i], buf + (blks[i] * kBlockSize - off), got[i]);
+        if (got[i] < 0) failed = true;
+        else bytes += got[i];
+    }
+    std::lock_guard<std::mutex> g(prefetch_mu_);
+    auto it = bulk_.find(id);
+    BulkFetch& b = it->second;
+    --b.active;
+    // on an error the reader fetches for itself
+    if (failed) b.end = b.next;
+    else b.tuner.record(bytes, seconds);
+    pump_bulk(id, b);
+    if (b.active == 0) {
+        bulk_.erase(it);
+        prefetch_cv_.notify_all();
+    }
+}
+
+static std::unique_ptr<CacheManagerBase> g_cache;
+static MetadataStore::Backend g_meta_backend = MetadataStore::Backend::Sqlite;
+static std::size_t g_meta_shards = 1;
+
+static std::unique_ptr<CacheManagerBase> make_cache_manager(const std::string& root, int timeout, const std::string& policy) {
+    using TtlLru   = StackedPolicy<TimePolicy, LruPolicy>;
+    using TtlClock = StackedPolicy<TimePolicy, ClockPolicy>;
+    using TtlGdsf  = StackedPolicy<TimePolicy, GdsfPolicy>;
+    const auto meta = g_meta_backend;
+    const auto shards = g_meta_shards;
+    if (policy.empty() || policy == "lru")
+        return std::make_unique<CacheManager<LruPolicy>>(root, meta, shards, kCacheBlocksCapacity);
+    if (policy == "clock")
+        return std::make_unique<CacheManager<ClockPolicy>>(root, meta, shards, kCacheBlocksCapacity);
+    if (policy == "gdsf")
+        return std::make_unique<CacheManager<GdsfPolicy>>(root, meta, shards, kCacheBlocksCapacity);
+    if (policy == "ttl+lru")
+        return std::make_unique<CacheManager<TtlLru>>(root, meta, shards, timeout, kCacheBlocksCapacity);
+    if (policy == "ttl+clock")
+        return std::make_unique<CacheManager<TtlClock>>(root, meta, shards, timeout, kCacheBlocksCapacity);
+    if (policy == "ttl+gdsf")
+        return std::make_unique<CacheManager<TtlGdsf>>(root, meta, shards, timeout, kCacheBlocksCapacity);
+    return nullptr;
+}
+
+int cache_set_metadata_backend(const char* backend) {
+    if (!backend) return -EINVAL;
+    if (std::strcmp(backend, "sqlite") == 0) {
+        g_meta_backend = MetadataStore::Backend::Sqlite;
+        return 0;
+    }
+    if (std::strcmp(backend, "index") == 0) {
+        g_meta_backend = MetadataStore::Backend::Index;
+        return 0;
+    }
+    return -EINVAL;
+}
+
+int cache_set_metadata_shards(size_t shards) {
+    if (shards == 0) return -EINVAL;
+    g_meta_shards = shards;
+    return 0;
+}
 
-int cache_init(const char* root, int) {
-    try { g_cache = std::make_unique<CacheManager>(root); return 0; }
+int cache_init_policy(const char* root, int timeout, const char* policy) {
+    try {
+        g_cache = make_cache_manager(root, timeout, policy ? policy : "");
+        if (!g_cache) return -EINVAL;
+        g_cache->set_attr_ttl(timeout);
+        return 0;
+    }
     catch (...) { return -1; }
 }
+int cache_init(const char* root, int timeout) {
+    return cache_init_policy(root, timeout, "lru");
+}
 int cache_store_file(const char* p, const char* d, size_t len, off_t off)
 {
     if (!g_cache) return -ENODEV;
@@ -235,18 +1130,69 @@ void cache_cleanup(void)
 {
     if (g_cache) {
         g_cache->flush_all();
-        g_cache.release();
+        g_cache.reset();
     }
 }
 bool  cache_has_valid_entry(const char* path)
 { 
     return g_cache && g_cache->has_valid_entry(path); 
 }
-void* cache_get_entry(const char* path)
-{ 
-    return g_cache ? static_cast<void*>(g_cache->get_entry(path)) : nullptr; 
+cache_entry* cache_get_entry(const char* path)
+{
+    if (!g_cache || !path) return nullptr;
+    auto row = g_cache->get_entry(path);
+    if (!row) return nullptr;
+    thread_local CacheMetadata held;
+    thread_local cache_entry entry;
+    held = std::move(*row);
+    entry.path          = held.path.data();
+    entry.local_path    = held.local_path.data();
+    entry.size          = held.size;
+    entry.timestamp     = held.timestamp;
+    entry.last_accessed = held.last_accessed;
+    entry.dirty         = held.dirty;
+    entry.next          = nullptr;
+    return &entry;
 }
 int   cache_apply_eviction(void) 
 { 
-    return cache_evict_gb(1.0); 
+    if (!g_cache) return -ENODEV;
+    g_cache->kick_evictor();
+    return 0;
+}
+int   cache_add_partition(const char* prefix, unsigned long long quota_bytes)
+{
+    if (!g_cache) return -ENODEV;
+    if (!prefix) return -EINVAL;
+    return g_cache->add_partition(prefix, quota_bytes);
+}
+int   cache_set_capacity(unsigned long long bytes)
+{
+    if (!g_cache) return -ENODEV;
+    g_cache->set_capacity(bytes);
+    return 0;
+}
+unsigned long long cache_used_bytes(void)
+{
+    return g_cache ? g_cache->used_bytes() : 0;
+}
+int   cache_get_attr(const char* path, cache_attr* attr)
+{
+    if (!g_cache) return -ENODEV;
+    if (!path || !attr) return -EINVAL;
+    return g_cache->get_attr(path, attr);
+}
+int   cache_invalidate(const char* path)
+{
+    if (!g_cache) return -ENODEV;
+    if (!path) return -EINVAL;
+    g_cache->invalidate(path);
+    return 0;
+}
+int   cache_put_attr(const char* path, const cache_attr* attr)
+{
+    if (!g_cache) return -ENODEV;
+    if (!path || !attr) return -EINVAL;
+    g_cache->put_attr(path, *attr);
+    return 0;
 }
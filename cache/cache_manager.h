@@ -18,10 +18,31 @@ typedef struct cache_entry {
     struct cache_entry* next;
 } cache_entry;
 
+typedef struct cache_attr {
+    size_t              size;
+    time_t              mtime;
+    bool                is_dir;
+} cache_attr;
+
 int cache_init(const char* backing_dir, int timeout);
 
+int cache_init_policy(const char* backing_dir, int timeout, const char* policy);
+
+// Picks where metadata rows are kept by the next cache_init: "sqlite"
+// (cache_meta.db, the default) or "index" (an mmapped hash table in
+// cache_meta.idx). Returns -EINVAL for any other name.
+int cache_set_metadata_backend(const char* backend);
+
+// Spreads the SQLite metadata rows of the next cache_init over this many
+// database files (cache_meta.db.0, .1, ...), each with its own writer.
+// Defaults to 1, a plain cache_meta.db. Returns -EINVAL for 0.
+int cache_set_metadata_shards(size_t shards);
+
 bool cache_has_valid_entry(const char* path);
 
+// Fills an entry for a cached path from its metadata row, or returns NULL
+// when the path is not cached. The entry belongs to the calling thread and
+// is overwritten by its next call.
 cache_entry* cache_get_entry(const char* path);
 
 int cache_store_file(const char* path, const char* data, size_t size, off_t offset);
@@ -30,6 +51,21 @@ ssize_t cache_read_file(const char* path, char* buffer, size_t size, off_t offse
 
 int cache_apply_eviction(void);
 
+int cache_set_capacity(unsigned long long bytes);
+
+// Bytes of block data the cache holds on disk, from its running counter.
+unsigned long long cache_used_bytes(void);
+
+int cache_add_partition(const char* prefix, unsigned long long quota_bytes);
+
+int cache_get_attr(const char* path, cache_attr* attr);
+
+int cache_put_attr(const char* path, const cache_attr* attr);
+
+// Drops the cached blocks of a path written behind the cache, straight to
+// the origin, and expires its attributes so the next getattr asks again.
+int cache_invalidate(const char* path);
+
 void cache_cleanup(void);
 
 #endif
\ No newline at end of file
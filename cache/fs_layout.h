@@ -1,6 +1,8 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
+#include <cstdio>
 #include <string>
 
 namespace fs_layout {
@@ -10,16 +12,36 @@ constexpr std::size_t kMaxPartSize = 2ULL * 1024 * 1024 * 1024;
 constexpr std::size_t kFilesPerDir = 256;
 
 
-inline std::string shard_dir(const std::string& hash_hex) {
-    return hash_hex.substr(0, 2) + "/" + hash_hex.substr(2, 2);
+// Objects are named on disk by their 64-bit id as 16 hex digits.
+inline std::string object_hex(std::uint64_t object) {
+    char buf[17];
+    std::snprintf(buf, sizeof(buf), "%016llx", static_cast<unsigned long long>(object));
+    return buf;
 }
 
-inline std::string data_part_path(const std::string& cache_root, const std::string& hash_hex, std::size_t part_idx) {
-    return cache_root + "/" + shard_dir(hash_hex) + "/" + hash_hex + "." + std::to_string(part_idx) + ".blk";
+inline std::string shard_dir(std::uint64_t object) {
+    std::string hex = object_hex(object);
+    return hex.substr(0, 2) + "/" + hex.substr(2, 2);
 }
 
-inline std::string bitmap_path(const std::string& cache_root, const std::string& hash_hex, std::size_t part_idx) {
-    return cache_root + "/" + shard_dir(hash_hex) + "/" + hash_hex + "." + std::to_string(part_idx) + ".dmap";
+inline std::string data_part_path(const std::string& cache_root, std::uint64_t object, std::size_t part_idx) {
+    return cache_root + "/" + shard_dir(object) + "/" + object_hex(object) + "." + std::to_string(part_idx) + ".blk";
+}
+
+inline std::string usage_path(const std::string& cache_root) {
+    return cache_root + "/.usage";
+}
+
+inline std::string journal_path(const std::string& cache_root) {
+    return cache_root + "/.journal";
+}
+
+inline std::string bitmap_path(const std::string& cache_root, std::uint64_t object, std::size_t part_idx) {
+    return cache_root + "/" + shard_dir(object) + "/" + object_hex(object) + "." + std::to_string(part_idx) + ".dmap";
+}
+
+inline std::string presence_path(const std::string& cache_root, std::uint64_t object, std::size_t part_idx) {
+    return cache_root + "/" + shard_dir(object) + "/" + object_hex(object) + "." + std::to_string(part_idx) + ".pmap";
 }
 
 }
@@ -0,0 +1,73 @@
+#include "path_table.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+
+std::uint32_t PathTable::hashOf(std::string_view path) {
+    std::size_t h = std::hash<std::string_view>{}(path);
+    return static_cast<std::uint32_t>(h ^ (h >> 32));
+}
+
+std::uint32_t& PathTable::probe(std::string_view path, std::uint32_t hash) const {
+    const std::size_t mask = slots_.size() - 1;
+    for (std::size_t i = hash & mask;; i = (i + 1) & mask) {
+        std::uint32_t& slot = slots_[i];
+        if (slot == 0) return slot;
+        if (hashes_[slot - 1] == hash && views_[slot - 1] == path) return slot;
+    }
+}
+
+// Paths longer than a chunk get a chunk of their own, which then counts as
+// full.
+const char* PathTable::copy(std::string_view path) {
+    if (chunk_used_ + path.size() > kChunkBytes) {
+        chunks_.emplace_back(new char[std::max(kChunkBytes, path.size())]);
+        chunk_used_ = 0;
+    }
+    char* dst = chunks_.back().get() + chunk_used_;
+    std::memcpy(dst, path.data(), path.size());
+    chunk_used_ += path.size();
+    return dst;
+}
+
+void PathTable::grow() {
+    slots_.assign(std::max(kMinSlots, slots_.size() * 2), 0);
+    const std::size_t mask = slots_.size() - 1;
+    for (std::uint32_t id = 0; id < views_.size(); ++id) {
+        std::size_t i = hashes_[id] & mask;
+        while (slots_[i] != 0) i = (i + 1) & mask;
+        slots_[i] = id + 1;
+    }
+}
+
+std::uint32_t PathTable::intern(std::string_view path) {
+    std::lock_guard<std::mutex> g(mu_);
+    if ((views_.size() + 1) * 2 > slots_.size()) grow();
+    const std::uint32_t hash = hashOf(path);
+    std::uint32_t& slot = probe(path, hash);
+    if (slot != 0) return slot - 1;
+
+    const std::uint32_t id = static_cast<std::uint32_t>(views_.size());
+    views_.emplace_back(copy(path), path.size());
+    hashes_.push_back(hash);
+    slot = id + 1;
+    return id;
+}
+
+std::uint32_t PathTable::find(std::string_view path) const {
+    std::lock_guard<std::mutex> g(mu_);
+    if (slots_.empty()) return kNone;
+    std::uint32_t slot = probe(path, hashOf(path));
+    return slot == 0 ? kNone : slot - 1;
+}
+
+std::string_view PathTable::path(std::uint32_t id) const {
+    std::lock_guard<std::mutex> g(mu_);
+    return id < views_.size() ? views_[id] : std::string_view{};
+}
+
+std::size_t PathTable::size() const {
+    std::lock_guard<std::mutex> g(mu_);
+    return views_.size();
+}
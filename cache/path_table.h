@@ -0,0 +1,49 @@
+#ifndef CACHE_PATH_TABLE_H
+#define CACHE_PATH_TABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+// Interns paths. Each distinct path is copied once into an arena of 1 MiB
+// chunks and named by a dense 32-bit id handed out in insertion order, so
+// the rest of the cache can key everything by id. Ids are never reused and
+// arena bytes never move, so a view returned by path() stays valid for the
+// life of the table. Besides the path bytes each entry costs a view, a
+// 32-bit hash and about two 32-bit slots of the open-addressing index.
+class PathTable {
+public:
+    static constexpr std::uint32_t kNone = std::numeric_limits<std::uint32_t>::max();
+
+    // Id of path, adding it if it is new.
+    std::uint32_t intern(std::string_view path);
+    // Id of path, or kNone if it was never interned.
+    std::uint32_t find(std::string_view path) const;
+    std::string_view path(std::uint32_t id) const;
+    std::size_t size() const;
+
+private:
+    static constexpr std::size_t kChunkBytes = 1 << 20;
+    static constexpr std::size_t kMinSlots   = 1024;
+
+    static std::uint32_t hashOf(std::string_view path);
+    // Caller holds mu_. Slot holding path's id, or the empty slot where it
+    // would go.
+    std::uint32_t& probe(std::string_view path, std::uint32_t hash) const;
+    const char* copy(std::string_view path);
+    void grow();
+
+    mutable std::mutex mu_;
+    std::vector<std::unique_ptr<char[]>> chunks_;
+    std::size_t chunk_used_ = kChunkBytes;
+    std::vector<std::string_view> views_;
+    std::vector<std::uint32_t>    hashes_;
+    // id + 1, 0 when empty; size is a power of two kept at most half full
+    mutable std::vector<std::uint32_t> slots_;
+};
+
+#endif
@@ -0,0 +1,119 @@
+#include "clock_policy.h"
+
+#include <limits>
+
+
+ClockPolicy::ClockPolicy(std::size_t capacity)
+: capacity_(capacity ? capacity : 1), slots_(capacity_), ref_(new std::atomic<std::uint8_t>[capacity_]) {
+    free_.reserve(capacity_);
+    for (std::size_t i = capacity_; i-- > 0;) {
+        ref_[i].store(0, std::memory_order_relaxed);
+        free_.push_back(i);
+    }
+    map_.reserve(capacity_);
+
+    // twice as many hints as slots keeps collisions, and the locked
+    // fallback they cost, rare
+    std::size_t hints = 2;
+    unsigned bits = 1;
+    while (hints < 2 * capacity_) {
+        hints <<= 1;
+        ++bits;
+    }
+    hint_shift_ = 64 - bits;
+    hint_.reset(new std::atomic<std::uint32_t>[hints]);
+    for (std::size_t i = 0; i < hints; ++i) hint_[i].store(kNoSlot, std::memory_order_relaxed);
+}
+
+
+std::size_t ClockPolicy::hint_index(std::size_t blockId) const {
+    return static_cast<std::size_t>((static_cast<std::uint64_t>(blockId) * 0x9E3779B97F4A7C15ULL) >> hint_shift_);
+}
+
+
+// Prefetch touches (hotness < 1) keep the block resident but do not count
+// as a use. Racing bumps may be lost, which is fine.
+void ClockPolicy::bump(std::size_t slot, double hotness) {
+    if (hotness < 1.0) return;
+    auto& r = ref_[slot];
+    std::uint8_t v = r.load(std::memory_order_relaxed);
+    if (v < kMaxRef) r.store(v + 1, std::memory_order_relaxed);
+}
+
+
+bool ClockPolicy::hit(std::size_t blockId, double hotness) {
+    std::uint32_t slot = hint_[hint_index(blockId)].load(std::memory_order_relaxed);
+    if (slot >= capacity_ || slots_[slot].id.load(std::memory_order_relaxed) != blockId) return false;
+    // the slot may be recycled right after the check; the bump then lands
+    // on its new block, which only costs accuracy
+    bump(slot, hotness);
+    return true;
+}
+
+
+std::size_t ClockPolicy::touch(std::size_t blockId, std::size_t bytes, double hotness) {
+    if (hit(blockId, hotness)) return kEmpty;
+
+    std::lock_guard<std::mutex> g(mu_);
+    auto it = map_.find(blockId);
+    if (it != map_.end()) {
+        // resident, but its hint was taken by another key
+        bump(it->second, hotness);
+        hint_[hint_index(blockId)].store(static_cast<std::uint32_t>(it->second), std::memory_order_relaxed);
+        return kEmpty;
+    }
+    std::size_t displaced = free_.empty() ? evict_locked() : kEmpty;
+
+    std::size_t slot = free_.back();
+    free_.pop_back();
+    slots_[slot].bytes = bytes;
+    ref_[slot].store(0, std::memory_order_relaxed);
+    slots_[slot].id.store(blockId, std::memory_order_relaxed);
+    hint_[hint_index(blockId)].store(static_cast<std::uint32_t>(slot), std::memory_order_relaxed);
+    map_.emplace(blockId, slot);
+    return displaced;
+}
+
+
+void ClockPolicy::remove(std::size_t blockId) {
+    std::lock_guard<std::mutex> g(mu_);
+    auto it = map_.find(blockId);
+    if (it == map_.end()) return;
+    slots_[it->second].id.store(kEmpty, std::memory_order_relaxed);
+    slots_[it->second].bytes = 0;
+    free_.push_back(it->second);
+    map_.erase(it);
+}
+
+
+std::size_t ClockPolicy::evict() {
+    std::lock_guard<std::mutex> g(mu_);
+    return evict_locked();
+}
+
+
+std::size_t ClockPolicy::evict_locked() {
+    if (map_.empty()) return std::numeric_limits<std::size_t>::max();
+
+    // Every pass decrements each resident counter, so a victim is found
+    // within (kMaxRef + 1) sweeps of the array.
+    for (std::size_t step = 0; step < (kMaxRef + 1) * capacity_ + 1; ++step) {
+        std::size_t slot = hand_;
+        hand_ = (hand_ + 1) % capacity_;
+        std::size_t victimId = slots_[slot].id.load(std::memory_order_relaxed);
+        if (victimId == kEmpty) continue;
+
+        auto& r = ref_[slot];
+        std::uint8_t v = r.load(std::memory_order_relaxed);
+        if (v > 0) {
+            r.store(v - 1, std::memory_order_relaxed);
+            continue;
+        }
+        slots_[slot].id.store(kEmpty, std::memory_order_relaxed);
+        slots_[slot].bytes = 0;
+        free_.push_back(slot);
+        map_.erase(victimId);
+        return victimId;
+    }
+    return std::numeric_limits<std::size_t>::max();
+}
@@ -0,0 +1,62 @@
+#ifndef CACHE_POLICY_CLOCK_POLICY_H
+#define CACHE_POLICY_CLOCK_POLICY_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// CLOCK with a small saturating reference counter per slot. Each resident
+// block's slot is also recorded in a direct-mapped hint array indexed by its
+// key, so hit() finds the slot with one load and bumps the counter with
+// relaxed atomics, taking no lock. The hand sweeps and decrements under the
+// lock when a victim is needed.
+class ClockPolicy {
+public:
+    explicit ClockPolicy(std::size_t capacity);
+
+    // Returns the block whose slot a new one took when all were in use.
+    std::size_t touch(std::size_t blockId, std::size_t bytes, double hotness);
+
+    // Lock-free hit on a resident block. False when the block's hint was
+    // taken by another key or the block is not resident; the caller then
+    // goes through touch().
+    bool hit(std::size_t blockId, double hotness);
+
+    void remove(std::size_t blockId);
+
+    std::size_t evict();
+
+private:
+    static constexpr std::size_t   kEmpty  = static_cast<std::size_t>(-1);
+    static constexpr std::uint32_t kNoSlot = static_cast<std::uint32_t>(-1);
+    static constexpr std::uint8_t  kMaxRef = 3;
+
+    struct Slot {
+        std::atomic<std::size_t> id{kEmpty};   // read by hit() without the lock
+        std::size_t bytes = 0;
+    };
+
+    std::size_t evict_locked();
+    std::size_t hint_index(std::size_t blockId) const;
+    void bump(std::size_t slot, double hotness);
+
+    std::size_t capacity_;
+    std::vector<Slot> slots_;
+    std::unique_ptr<std::atomic<std::uint8_t>[]> ref_;
+    // slot last given to a key hashing here; checked against slots_[].id
+    std::unique_ptr<std::atomic<std::uint32_t>[]> hint_;
+    unsigned hint_shift_ = 0;
+    std::vector<std::size_t> free_;
+    std::unordered_map<std::size_t, std::size_t> map_;
+    std::size_t hand_ = 0;
+    std::mutex mu_;
+
+    ClockPolicy(const ClockPolicy&)            = delete;
+    ClockPolicy& operator=(const ClockPolicy&) = delete;
+};
+
+#endif
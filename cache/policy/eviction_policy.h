@@ -0,0 +1,81 @@
+#ifndef CACHE_POLICY_EVICTION_POLICY_H
+#define CACHE_POLICY_EVICTION_POLICY_H
+
+#include <cstddef>
+#include <limits>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Every eviction policy provides
+//
+//     std::size_t touch(std::size_t blockId, std::size_t bytes, double hotness);
+//     void        remove(std::size_t blockId);
+//     std::size_t evict();      // kNoVictim when nothing is evictable
+//
+// A policy that tracks a bounded number of blocks makes room for a new one
+// by evicting inside touch(), and returns the displaced key so the caller
+// can drop its block; touch() returns kNoVictim otherwise.
+//
+// Cost-aware policies also accept the expected refetch time in seconds as a
+// fourth touch() argument; eviction::touch() passes it only to those.
+//
+// Policies with a notion of expiry (TTL) additionally provide
+//
+//     std::size_t expire(std::vector<std::size_t>& out);
+//
+// which the background evictor calls on every wake-up to drop due entries in
+// one batch, independent of capacity pressure.
+//
+// Policies that can record a hit on a resident block without a lock provide
+//
+//     bool hit(std::size_t blockId, double hotness);   // false: use touch()
+//
+// and CacheManager calls it directly from the read path, without the policy
+// lock or the access buffer.
+//
+// CacheManager is instantiated per policy, so these calls are resolved at
+// compile time and never go through a vtable on the hit path.
+namespace eviction {
+
+constexpr std::size_t kNoVictim = std::numeric_limits<std::size_t>::max();
+
+template <class P, class = void>
+struct is_policy : std::false_type {};
+
+template <class P>
+struct is_policy<P, std::void_t<
+    decltype(std::declval<P&>().touch(std::size_t{}, std::size_t{}, double{})),
+    decltype(std::declval<P&>().remove(std::size_t{})),
+    decltype(std::size_t{std::declval<P&>().evict()})>> : std::true_type {};
+
+template <class P, class = void>
+struct has_expiry : std::false_type {};
+
+template <class P>
+struct has_expiry<P, std::void_t<
+    decltype(std::declval<P&>().expire(std::declval<std::vector<std::size_t>&>()))>> : std::true_type {};
+
+template <class P, class = void>
+struct has_lockfree_hit : std::false_type {};
+
+template <class P>
+struct has_lockfree_hit<P, std::void_t<
+    decltype(bool{std::declval<P&>().hit(std::size_t{}, double{})})>> : std::true_type {};
+
+template <class P, class = void>
+struct accepts_cost : std::false_type {};
+
+template <class P>
+struct accepts_cost<P, std::void_t<
+    decltype(std::declval<P&>().touch(std::size_t{}, std::size_t{}, double{}, double{}))>> : std::true_type {};
+
+template <class P>
+inline std::size_t touch(P& policy, std::size_t blockId, std::size_t bytes, double hotness, double cost) {
+    if constexpr (accepts_cost<P>::value) return policy.touch(blockId, bytes, hotness, cost);
+    else                                  return policy.touch(blockId, bytes, hotness);
+}
+
+}
+
+#endif
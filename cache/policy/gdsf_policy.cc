@@ -0,0 +1,48 @@
+#include "gdsf_policy.h"
+
+#include <algorithm>
+#include <limits>
+
+
+GdsfPolicy::GdsfPolicy(std::size_t capacity)
+: capacity_(capacity) {}
+
+
+std::size_t GdsfPolicy::touch(std::size_t blockId, std::size_t bytes, double hotness, double cost) {
+    std::size_t displaced = std::numeric_limits<std::size_t>::max();
+    auto it = nodes_.find(blockId);
+    if (it == nodes_.end()) {
+        if (nodes_.size() >= capacity_) displaced = evict();
+        it = nodes_.emplace(blockId, Node{bytes, 0.0, cost, 0.0}).first;
+    } else {
+        queue_.erase({it->second.priority, blockId});
+    }
+
+    Node& n = it->second;
+    n.bytes = bytes;
+    n.freq += hotness;
+    if (cost > 0) n.cost = cost;
+    n.priority = inflation_ + n.freq * n.cost / double(std::max<std::size_t>(n.bytes, 1));
+    queue_.emplace(n.priority, blockId);
+    return displaced;
+}
+
+
+void GdsfPolicy::remove(std::size_t blockId) {
+    auto it = nodes_.find(blockId);
+    if (it == nodes_.end()) return;
+    queue_.erase({it->second.priority, blockId});
+    nodes_.erase(it);
+}
+
+
+std::size_t GdsfPolicy::evict() {
+    if (queue_.empty()) return std::numeric_limits<std::size_t>::max();
+
+    auto victim = queue_.begin();
+    inflation_ = victim->first;
+    std::size_t victimId = victim->second;
+    queue_.erase(victim);
+    nodes_.erase(victimId);
+    return victimId;
+}
@@ -0,0 +1,44 @@
+#ifndef CACHE_POLICY_GDSF_POLICY_H
+#define CACHE_POLICY_GDSF_POLICY_H
+
+#include <cstddef>
+#include <set>
+#include <unordered_map>
+#include <utility>
+
+// GreedyDual-Size-Frequency. Each block has priority
+//
+//     H = L + frequency * cost / bytes
+//
+// where cost is the expected time to fetch it again from the origin. The
+// block with the lowest H is evicted and L rises to its H, so blocks that
+// are cheap to refetch per byte go first and idle blocks age out.
+class GdsfPolicy {
+public:
+    explicit GdsfPolicy(std::size_t capacity);
+
+    // Returns the block evicted to stay within capacity, if any.
+    std::size_t touch(std::size_t blockId, std::size_t bytes, double hotness, double cost = 1.0);
+
+    void remove(std::size_t blockId);
+
+    std::size_t evict();
+
+private:
+    struct Node {
+        std::size_t bytes;
+        double      freq;
+        double      cost;
+        double      priority;
+    };
+
+    std::size_t capacity_;
+    double      inflation_ = 0.0;
+    std::unordered_map<std::size_t, Node> nodes_;
+    std::set<std::pair<double, std::size_t>> queue_;
+
+    GdsfPolicy(const GdsfPolicy&)            = delete;
+    GdsfPolicy& operator=(const GdsfPolicy&) = delete;
+};
+
+#endif
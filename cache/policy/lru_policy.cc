@@ -4,24 +4,25 @@
 #include <limits>
 
 
-LruPolicy::LruPolicy(std::size_t capacity)
-: capacity_(capacity) {}
+LruPolicy::LruPolicy(std::size_t capacity, double halfLifeSeconds)
+: capacity_(capacity), decay_(halfLifeSeconds > 0 ? std::log(2.0) / halfLifeSeconds : 0.0) {}
 
 
-void LruPolicy::touch(std::size_t blockId, std::size_t bytes, double hotness) {
+std::size_t LruPolicy::touch(std::size_t blockId, std::size_t bytes, double hotness) {
+auto now = Clock::now();
+double freq = hotness;
 auto it = map_.find(blockId);
 
 if (it != map_.end()) {
+    freq += decayed(*it->second, now);
     order_.erase(it->second);
     map_.erase(it);
 }
-if (order_.size() >= capacity_) {
-    std::size_t victim = evict();
-    (void)victim;
-}
+std::size_t displaced = order_.size() >= capacity_ ? evict() : std::numeric_limits<std::size_t>::max();
 
-order_.push_front({blockId, bytes, hotness});
+order_.push_front({blockId, bytes, freq, now});
 map_[blockId] = order_.begin();
+return displaced;
 }
 
 
@@ -37,11 +38,12 @@ if (it != map_.end()) {
 std::size_t LruPolicy::evict() {
 if (order_.empty()) return std::numeric_limits<std::size_t>::max();
 
+auto now         = Clock::now();
 auto victim_it   = order_.end();
 double worstScore = -DBL_MAX;
 
 for (auto it = order_.begin(); it != order_.end(); ++it) {
-    double s = score(*it);
+    double s = score(double(it->bytes), decayed(*it, now));
     if (s > worstScore) {
         worstScore = s;
         victim_it  = it;
@@ -1,15 +1,22 @@
 #ifndef CACHE_POLICY_LRU_POLICY_H
 #define CACHE_POLICY_LRU_POLICY_H
 
+#include <chrono>
+#include <cmath>
 #include <cstddef>
 #include <list>
 #include <unordered_map>
 
 class LruPolicy {
 public:
-    explicit LruPolicy(std::size_t capacity);
+    using Clock = std::chrono::steady_clock;
 
-    void touch(std::size_t blockId, std::size_t bytes, double hotness);
+    explicit LruPolicy(std::size_t capacity, double halfLifeSeconds = 600.0);
+
+    // hotness is added to the block's decayed access frequency, so repeated
+    // hits accumulate instead of overwriting each other. Returns the block
+    // evicted to stay within capacity, if any.
+    std::size_t touch(std::size_t blockId, std::size_t bytes, double hotness);
 
     void remove(std::size_t blockId);
 
@@ -17,16 +24,22 @@ public:
 
 private:
     struct Node {
-        std::size_t id;
-        std::size_t bytes;
-        double      hotness;
+        std::size_t       id;
+        std::size_t       bytes;
+        double            freq;
+        Clock::time_point stamp;
     };
 
-    static inline double score(const Node& n) {
-        return n.bytes * (1.0 - n.hotness);
+    inline double decayed(const Node& n, Clock::time_point now) const {
+        return n.freq * std::exp(-decay_ * std::chrono::duration<double>(now - n.stamp).count());
+    }
+
+    static inline double score(double bytes, double freq) {
+        return bytes / (1.0 + freq);
     }
 
     std::size_t capacity_;
+    double      decay_;
     std::list<Node> order_;
     std::unordered_map<std::size_t,
         std::list<Node>::iterator> map_;
@@ -0,0 +1,180 @@
+#include "block_bitmap.h"
+
+#include <algorithm>
+#include <cstring>
+
+// Offset of the first set bit at or after start within one chunk, or
+// kChunkBits when there is none. Inverting the words finds clear bits.
+template <bool kClear>
+static std::uint32_t scan_words(const std::vector<std::uint64_t>& words, std::uint32_t start) {
+    std::uint32_t w = start / 64;
+    std::uint64_t word = (kClear ? ~words[w] : words[w]) & (~0ULL << (start % 64));
+    while (word == 0) {
+        if (++w == words.size()) return std::uint32_t{1} << 16;
+        word = kClear ? ~words[w] : words[w];
+    }
+    return w * 64 + static_cast<std::uint32_t>(__builtin_ctzll(word));
+}
+
+bool BlockBitmap::Chunk::test(std::uint16_t lo) const {
+    if (dense()) return (words[lo / 64] >> (lo % 64)) & 1;
+    return std::binary_search(array.begin(), array.end(), lo);
+}
+
+void BlockBitmap::Chunk::to_words() {
+    words.assign(kWords, 0);
+    for (std::uint16_t lo : array) words[lo / 64] |= 1ULL << (lo % 64);
+    array.clear();
+    array.shrink_to_fit();
+}
+
+void BlockBitmap::Chunk::to_array() {
+    array.clear();
+    array.reserve(cardinality);
+    for (std::uint32_t w = 0; w < kWords; ++w) {
+        for (std::uint64_t word = words[w]; word; word &= word - 1)
+            array.push_back(static_cast<std::uint16_t>(w * 64 + __builtin_ctzll(word)));
+    }
+    words.clear();
+    words.shrink_to_fit();
+}
+
+bool BlockBitmap::set(std::uint32_t i) {
+    Chunk& c = chunks_[static_cast<std::uint16_t>(i >> 16)];
+    std::uint16_t lo = static_cast<std::uint16_t>(i);
+    if (c.dense()) {
+        std::uint64_t& word = c.words[lo / 64];
+        std::uint64_t  mask = 1ULL << (lo % 64);
+        if (word & mask) return false;
+        word |= mask;
+    } else {
+        auto it = std::lower_bound(c.array.begin(), c.array.end(), lo);
+        if (it != c.array.end() && *it == lo) return false;
+        c.array.insert(it, lo);
+    }
+    if (++c.cardinality > kArrayMax && !c.dense()) c.to_words();
+    return true;
+}
+
+bool BlockBitmap::clear(std::uint32_t i) {
+    auto cit = chunks_.find(static_cast<std::uint16_t>(i >> 16));
+    if (cit == chunks_.end()) return false;
+    Chunk& c = cit->second;
+    std::uint16_t lo = static_cast<std::uint16_t>(i);
+    if (c.dense()) {
+        std::uint64_t& word = c.words[lo / 64];
+        std::uint64_t  mask = 1ULL << (lo % 64);
+        if (!(word & mask)) return false;
+        word &= ~mask;
+    } else {
+        auto it = std::lower_bound(c.array.begin(), c.array.end(), lo);
+        if (it == c.array.end() || *it != lo) return false;
+        c.array.erase(it);
+    }
+    if (--c.cardinality == 0) {
+        chunks_.erase(cit);
+        return true;
+    }
+    // convert back only well below the threshold so a chunk hovering
+    // around it does not flip on every update
+    if (c.dense() && c.cardinality <= kArrayMax / 2) c.to_array();
+    return true;
+}
+
+bool BlockBitmap::test(std::uint32_t i) const {
+    auto it = chunks_.find(static_cast<std::uint16_t>(i >> 16));
+    return it != chunks_.end() && it->second.test(static_cast<std::uint16_t>(i));
+}
+
+std::uint64_t BlockBitmap::count() const {
+    std::uint64_t n = 0;
+    for (const auto& [_, c] : chunks_) n += c.cardinality;
+    return n;
+}
+
+std::uint64_t BlockBitmap::extent() const {
+    if (chunks_.empty()) return 0;
+    const auto& [hi, c] = *chunks_.rbegin();
+    std::uint64_t base = std::uint64_t{hi} << 16;
+    if (!c.dense()) return base + c.array.back() + 1;
+    for (std::uint32_t w = kWords; w-- > 0;) {
+        if (c.words[w]) return base + w * 64 + (64 - __builtin_clzll(c.words[w]));
+    }
+    return base;
+}
+
+std::uint64_t BlockBitmap::next_set(std::uint64_t from) const {
+    if (from >= (std::uint64_t{1} << 32)) return kNone;
+    std::uint16_t hi = static_cast<std::uint16_t>(from >> 16);
+    for (auto it = chunks_.lower_bound(hi); it != chunks_.end(); ++it) {
+        std::uint32_t start = it->first == hi ? static_cast<std::uint32_t>(from & 0xffff) : 0;
+        const Chunk& c = it->second;
+        std::uint32_t lo;
+        if (c.dense()) {
+            lo = scan_words<false>(c.words, start);
+        } else {
+            auto a = std::lower_bound(c.array.begin(), c.array.end(), start);
+            lo = a == c.array.end() ? kChunkBits : *a;
+        }
+        if (lo < kChunkBits) return (std::uint64_t{it->first} << 16) | lo;
+    }
+    return kNone;
+}
+
+std::uint64_t BlockBitmap::next_clear(std::uint64_t from) const {
+    while (from < (std::uint64_t{1} << 32)) {
+        auto it = chunks_.find(static_cast<std::uint16_t>(from >> 16));
+        if (it == chunks_.end()) return from;
+
+        std::uint32_t start = static_cast<std::uint32_t>(from & 0xffff), lo;
+        const Chunk& c = it->second;
+        if (c.dense()) {
+            lo = scan_words<true>(c.words, start);
+        } else {
+            // walk the run of consecutive set bits starting at start
+            auto a = std::lower_bound(c.array.begin(), c.array.end(), start);
+            for (lo = start; a != c.array.end() && *a == lo; ++a) ++lo;
+        }
+        if (lo < kChunkBits) return (from & ~std::uint64_t{0xffff}) | lo;
+        from = (from | 0xffff) + 1;
+    }
+    return kNone;
+}
+
+void BlockBitmap::copy_bytes(std::uint64_t first_byte, std::uint8_t* out, std::size_t len) const {
+    std::memset(out, 0, len);
+    const std::uint64_t first_bit = first_byte * 8, end_bit = (first_byte + len) * 8;
+    if (first_bit >= (std::uint64_t{1} << 32)) return;
+
+    for (auto it = chunks_.lower_bound(static_cast<std::uint16_t>(first_bit >> 16));
+         it != chunks_.end() && (std::uint64_t{it->first} << 16) < end_bit; ++it) {
+        const std::uint64_t base = std::uint64_t{it->first} << 16;
+        const Chunk& c = it->second;
+        if (c.dense()) {
+            for (std::uint32_t w = 0; w < kWords; ++w) {
+                std::uint64_t word = c.words[w];
+                if (!word) continue;
+                std::uint64_t byte = (base + w * 64) / 8;
+                for (unsigned b = 0; b < 8; ++b, word >>= 8) {
+                    if (byte + b >= first_byte && byte + b < first_byte + len)
+                        out[byte + b - first_byte] = static_cast<std::uint8_t>(word);
+                }
+            }
+        } else {
+            for (std::uint16_t lo : c.array) {
+                std::uint64_t bit = base + lo;
+                if (bit >= first_bit && bit < end_bit)
+                    out[bit / 8 - first_byte] |= static_cast<std::uint8_t>(1u << (bit % 8));
+            }
+        }
+    }
+}
+
+void BlockBitmap::load_bytes(const std::uint8_t* in, std::size_t len) {
+    reset();
+    len = std::min<std::size_t>(len, std::size_t{1} << 29);
+    for (std::size_t i = 0; i < len; ++i) {
+        for (unsigned byte = in[i]; byte; byte &= byte - 1)
+            set(static_cast<std::uint32_t>(i * 8 + __builtin_ctz(byte)));
+    }
+}
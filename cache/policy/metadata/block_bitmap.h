@@ -0,0 +1,58 @@
+#ifndef CACHE_BLOCK_BITMAP_H
+#define CACHE_BLOCK_BITMAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <vector>
+
+// Roaring-style bitmap over 32-bit block indices. Bits are grouped in chunks
+// of 2^16; a chunk is a sorted array of low halves while sparse and becomes
+// 1024 64-bit words once it holds more than kArrayMax bits. Scans for the
+// next set or clear bit skip whole words with ctz.
+class BlockBitmap {
+public:
+    static constexpr std::uint64_t kNone = std::numeric_limits<std::uint64_t>::max();
+
+    // Both return true if the bit changed.
+    bool set(std::uint32_t i);
+    bool clear(std::uint32_t i);
+    bool test(std::uint32_t i) const;
+
+    std::uint64_t count() const;
+    bool          empty() const { return chunks_.empty(); }
+    // One past the highest set bit, 0 when empty.
+    std::uint64_t extent() const;
+
+    // First set (clear) bit at or after from, kNone if there is none.
+    std::uint64_t next_set(std::uint64_t from) const;
+    std::uint64_t next_clear(std::uint64_t from) const;
+
+    // Flat LSB-first byte image of bits [8 * first_byte, 8 * (first_byte + len)),
+    // the on-disk format of the .dmap/.pmap files.
+    void copy_bytes(std::uint64_t first_byte, std::uint8_t* out, std::size_t len) const;
+    void load_bytes(const std::uint8_t* in, std::size_t len);
+
+    void reset() { chunks_.clear(); }
+
+private:
+    static constexpr std::uint32_t kChunkBits = 1u << 16;
+    static constexpr std::uint32_t kWords     = kChunkBits / 64;
+    static constexpr std::uint32_t kArrayMax  = 4096;
+
+    struct Chunk {
+        std::vector<std::uint16_t> array;   // sorted, while dense is empty
+        std::vector<std::uint64_t> words;   // kWords once dense
+        std::uint32_t cardinality = 0;
+
+        bool dense() const { return !words.empty(); }
+        bool test(std::uint16_t lo) const;
+        void to_words();
+        void to_array();
+    };
+
+    std::map<std::uint16_t, Chunk> chunks_;
+};
+
+#endif
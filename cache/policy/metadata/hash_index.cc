@@ -0,0 +1,293 @@
+#include "hash_index.h"
+#include "metadata_store.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+constexpr char HashIndex::kMagic[8];
+
+HashIndex::HashIndex(const std::string& path) : path_(path) {}
+
+HashIndex::~HashIndex() {
+    flush();
+    unmap(table_);
+    unmap(heap_);
+}
+
+// 64-bit FNV-1a; stable across builds, unlike std::hash.
+std::uint64_t HashIndex::hashPath(const std::string& path) {
+    std::uint64_t h = 0xcbf29ce484222325ULL;
+    for (unsigned char c : path) h = (h ^ c) * 0x100000001b3ULL;
+    return h;
+}
+
+// Maps at least bytes of the file, growing it if it is shorter.
+bool HashIndex::mapFile(const std::string& path, std::size_t bytes, bool truncate, Mapping& out) {
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | (truncate ? O_TRUNC : 0), 0644);
+    if (fd < 0) return false;
+    struct stat st;
+    bool ok = ::fstat(fd, &st) == 0;
+    std::size_t size = ok ? std::max(bytes, static_cast<std::size_t>(st.st_size)) : 0;
+    ok = ok && (static_cast<std::size_t>(st.st_size) == size || ::ftruncate(fd, static_cast<off_t>(size)) == 0);
+    void* p = ok ? ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        std::cerr << "[hash_index] mapping " << path << " failed: " << std::strerror(errno) << '\n';
+        return false;
+    }
+    out.base  = p;
+    out.bytes = size;
+    return true;
+}
+
+void HashIndex::unmap(Mapping& m) {
+    if (m.base) ::munmap(m.base, m.bytes);
+    m = Mapping{};
+}
+
+bool HashIndex::open() {
+    std::lock_guard<std::mutex> g(mu_);
+    struct stat st;
+    if (::stat(path_.c_str(), &st) == 0 && static_cast<std::size_t>(st.st_size) >= kPageBytes) {
+        Mapping t;
+        if (mapFile(path_, 0, false, t)) {
+            const Header* h = static_cast<const Header*>(t.base);
+            struct stat hs;
+            bool valid = std::memcmp(h->magic, kMagic, sizeof(kMagic)) == 0 && h->header_bytes == kPageBytes &&
+                         h->slots >= kMinSlots && (h->slots & (h->slots - 1)) == 0 &&
+                         t.bytes == kPageBytes + h->slots * sizeof(Slot) &&
+                         ::stat(heapPath(h->heap_gen).c_str(), &hs) == 0 &&
+                         static_cast<std::uint64_t>(hs.st_size) >= h->heap_used;
+            Mapping hp;
+            if (valid && mapFile(heapPath(h->heap_gen), kMinHeapBytes, false, hp)) {
+                table_ = t;
+                heap_  = hp;
+                return true;
+            }
+            std::cerr << "[hash_index] " << path_ << " is damaged, starting empty\n";
+            unmap(t);
+        }
+    }
+    return rebuild(kMinSlots, false);
+}
+
+HashIndex::Slot* HashIndex::find(const std::string& path, std::uint64_t hash) const {
+    const std::uint64_t mask = header()->slots - 1;
+    for (std::uint64_t i = hash & mask;; i = (i + 1) & mask) {
+        Slot& s = slots()[i];
+        if (s.flags == 0) return nullptr;
+        if ((s.flags & kUsed) && s.hash == hash && s.path_len == path.size() &&
+            std::memcmp(heap() + s.heap_off, path.data(), path.size()) == 0)
+            return &s;
+    }
+}
+
+// First empty or tombstoned slot on the probe sequence of hash.
+HashIndex::Slot* HashIndex::freeSlot(std::uint64_t hash) const {
+    const std::uint64_t mask = header()->slots - 1;
+    for (std::uint64_t i = hash & mask;; i = (i + 1) & mask) {
+        if (!(slots()[i].flags & kUsed)) return &slots()[i];
+    }
+}
+
+// Keeps used plus tombstoned slots under 70% so probe runs stay short:
+// doubles the table when live rows alone pass 35%, else just purges
+// the tombstones.
+bool HashIndex::reserveSlot() {
+    const Header* h = header();
+    if ((h->count + h->tombstones + 1) * 10 <= h->slots * 7) return true;
+    std::uint64_t slots = h->slots;
+    while ((h->count + 1) * 20 > slots * 7) slots *= 2;
+    return rebuild(slots, true);
+}
+
+bool HashIndex::appendStrings(const std::string& path, const std::string& local, std::uint64_t& off) {
+    const std::uint64_t need = path.size() + local.size();
+    if (header()->heap_used + need > heap_.bytes) {
+        // mostly garbage: compact instead of growing
+        if (header()->heap_garbage * 2 > header()->heap_used && !rebuild(header()->slots, true)) return false;
+        if (header()->heap_used + need > heap_.bytes) {
+            std::size_t bytes = heap_.bytes;
+            while (header()->heap_used + need > bytes) bytes *= 2;
+            Mapping grown;
+            if (!mapFile(heapPath(header()->heap_gen), bytes, false, grown)) return false;
+            unmap(heap_);
+            heap_ = grown;
+        }
+    }
+    off = header()->heap_used;
+    char* dst = static_cast<char*>(heap_.base) + off;
+    std::memcpy(dst, path.data(), path.size());
+    std::memcpy(dst + path.size(), local.data(), local.size());
+    header()->heap_used += need;
+    return true;
+}
+
+// The new table names its own heap generation and is renamed into place
+// last, so a crash midway leaves the old pair intact.
+bool HashIndex::rebuild(std::uint64_t new_slots, bool keep) {
+    const std::uint64_t old_gen = table_.base ? header()->heap_gen : 0;
+    const std::uint64_t live = table_.base && keep ? header()->heap_used - header()->heap_garbage : 0;
+    std::size_t heap_bytes = kMinHeapBytes;
+    while (heap_bytes < 2 * live) heap_bytes *= 2;
+
+    const std::string tmp = path_ + ".tmp";
+    Mapping t, hp;
+    if (!mapFile(tmp, kPageBytes + new_slots * sizeof(Slot), true, t) ||
+        !mapFile(heapPath(old_gen + 1), heap_bytes, true, hp)) {
+        unmap(t);
+        return false;
+    }
+    Header* nh = static_cast<Header*>(t.base);
+    std::memcpy(nh->magic, kMagic, sizeof(kMagic));
+    nh->version      = 1;
+    nh->header_bytes = kPageBytes;
+    nh->slots        = new_slots;
+    nh->heap_gen     = old_gen + 1;
+
+    Slot* ns = reinterpret_cast<Slot*>(static_cast<char*>(t.base) + kPageBytes);
+    char* nheap = static_cast<char*>(hp.base);
+    if (keep && table_.base) {
+        for (std::uint64_t i = 0; i < header()->slots; ++i) {
+            const Slot& s = slots()[i];
+            if (!(s.flags & kUsed)) continue;
+            std::uint64_t j = s.hash & (new_slots - 1);
+            while (ns[j].flags & kUsed) j = (j + 1) & (new_slots - 1);
+            ns[j] = s;
+            ns[j].heap_off = nh->heap_used;
+            std::memcpy(nheap + nh->heap_used, heap() + s.heap_off, s.path_len + s.local_len);
+            nh->heap_used += s.path_len + s.local_len;
+            ++nh->count;
+        }
+    }
+
+    bool ok = ::msync(t.base, t.bytes, MS_SYNC) == 0 && ::msync(hp.base, hp.bytes, MS_SYNC) == 0 &&
+              std::rename(tmp.c_str(), path_.c_str()) == 0;
+    if (!ok) {
+        std::cerr << "[hash_index] rebuilding " << path_ << " failed: " << std::strerror(errno) << '\n';
+        unmap(t);
+        unmap(hp);
+        return false;
+    }
+    bool had_table = table_.base != nullptr;
+    unmap(table_);
+    unmap(heap_);
+    table_ = t;
+    heap_  = hp;
+    if (had_table) ::unlink(heapPath(old_gen).c_str());
+    return true;
+}
+
+void HashIndex::fill(const Slot& s, CacheMetadata& meta) const {
+    meta.path.assign(heap() + s.heap_off, s.path_len);
+    meta.local_path.assign(heap() + s.heap_off + s.path_len, s.local_len);
+    meta.size          = static_cast<std::size_t>(s.size);
+    meta.timestamp     = static_cast<std::time_t>(s.timestamp);
+    meta.last_accessed = static_cast<std::time_t>(s.last_accessed);
+    meta.mtime         = static_cast<std::time_t>(s.mtime);
+    meta.dirty         = (s.flags & kDirty) != 0;
+    meta.is_dir        = (s.flags & kDir) != 0;
+}
+
+std::optional<CacheMetadata> HashIndex::get(const std::string& path) {
+    std::lock_guard<std::mutex> g(mu_);
+    if (!table_.base) return std::nullopt;
+    const Slot* s = find(path, hashPath(path));
+    if (!s) return std::nullopt;
+    CacheMetadata meta;
+    fill(*s, meta);
+    return meta;
+}
+
+bool HashIndex::put(const CacheMetadata& meta) {
+    std::lock_guard<std::mutex> g(mu_);
+    if (!table_.base) return false;
+    const std::uint64_t hash = hashPath(meta.path);
+    Slot* s = find(meta.path, hash);
+    bool same = s && s->local_len == meta.local_path.size() &&
+                std::memcmp(heap() + s->heap_off + s->path_len, meta.local_path.data(), s->local_len) == 0;
+    if (!same) {
+        std::uint64_t off;
+        if ((!s && !reserveSlot()) || !appendStrings(meta.path, meta.local_path, off)) return false;
+        // either call may have rebuilt the table
+        s = find(meta.path, hash);
+        if (s) {
+            header()->heap_garbage += s->path_len + s->local_len;
+        } else {
+            s = freeSlot(hash);
+            if (s->flags & kTombstone) --header()->tombstones;
+            ++header()->count;
+        }
+        s->hash      = hash;
+        s->heap_off  = off;
+        s->path_len  = static_cast<std::uint32_t>(meta.path.size());
+        s->local_len = static_cast<std::uint32_t>(meta.local_path.size());
+    }
+    s->size          = meta.size;
+    s->timestamp     = meta.timestamp;
+    s->last_accessed = meta.last_accessed;
+    s->mtime         = meta.mtime;
+    s->flags         = kUsed | (meta.dirty ? kDirty : 0u) | (meta.is_dir ? kDir : 0u);
+    return true;
+}
+
+bool HashIndex::updateAccessTime(const std::string& path, std::time_t last_accessed) {
+    std::lock_guard<std::mutex> g(mu_);
+    if (!table_.base) return false;
+    if (Slot* s = find(path, hashPath(path))) s->last_accessed = last_accessed;
+    return true;
+}
+
+bool HashIndex::markDirty(const std::string& path, bool dirty) {
+    std::lock_guard<std::mutex> g(mu_);
+    if (!table_.base) return false;
+    if (Slot* s = find(path, hashPath(path))) s->flags = dirty ? (s->flags | kDirty) : (s->flags & ~kDirty);
+    return true;
+}
+
+bool HashIndex::remove(const std::string& path) {
+    std::lock_guard<std::mutex> g(mu_);
+    if (!table_.base) return false;
+    Slot* s = find(path, hashPath(path));
+    if (!s) return true;
+    s->flags = kTombstone;
+    header()->heap_garbage += s->path_len + s->local_len;
+    --header()->count;
+    ++header()->tombstones;
+    return true;
+}
+
+void HashIndex::forEach(const std::function<bool(const CacheMetadata&)>& fn) {
+    std::lock_guard<std::mutex> g(mu_);
+    if (!table_.base) return;
+    CacheMetadata meta;
+    for (std::uint64_t i = 0; i < header()->slots; ++i) {
+        if (!(slots()[i].flags & kUsed)) continue;
+        fill(slots()[i], meta);
+        if (!fn(meta)) return;
+    }
+}
+
+std::size_t HashIndex::size() {
+    std::lock_guard<std::mutex> g(mu_);
+    return table_.base ? static_cast<std::size_t>(header()->count) : 0;
+}
+
+bool HashIndex::flush() {
+    std::lock_guard<std::mutex> g(mu_);
+    if (!table_.base) return true;
+    return ::msync(heap_.base, heap_.bytes, MS_SYNC) == 0 && ::msync(table_.base, table_.bytes, MS_SYNC) == 0;
+}
+
+bool HashIndex::clear() {
+    std::lock_guard<std::mutex> g(mu_);
+    return rebuild(kMinSlots, false);
+}
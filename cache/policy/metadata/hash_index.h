@@ -0,0 +1,110 @@
+#ifndef CACHE_HASH_INDEX_H
+#define CACHE_HASH_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+
+struct CacheMetadata;
+
+// Metadata rows in an open-addressing hash table kept in an mmapped file.
+// Each row is a fixed 64-byte slot found by linear probing on a 64-bit path
+// hash; the path and local path live in an append-only string heap file
+// next to it. A lookup is one probe sequence over mapped memory, with no
+// parsing or query planning. Removed rows leave tombstones, and the table
+// is rebuilt into fresh files, compacting the heap, when it gets too full.
+// Changes reach the disk on flush().
+class HashIndex {
+public:
+    explicit HashIndex(const std::string& path);
+    ~HashIndex();
+
+    bool open();
+
+    std::optional<CacheMetadata> get(const std::string& path);
+    bool put(const CacheMetadata& meta);
+    bool updateAccessTime(const std::string& path, std::time_t last_accessed);
+    bool markDirty(const std::string& path, bool dirty);
+    bool remove(const std::string& path);
+    // Calls fn on the row in each used slot, in slot order, until it
+    // returns false. One row is filled at a time; fn must not call back
+    // into the index.
+    void forEach(const std::function<bool(const CacheMetadata&)>& fn);
+    std::size_t size();
+
+    bool flush();
+    // Drops every row.
+    bool clear();
+
+private:
+    static constexpr std::size_t   kPageBytes       = 4096;
+    static constexpr std::uint64_t kMinSlots        = 1024;
+    static constexpr std::uint64_t kMinHeapBytes    = 1 << 20;
+    static constexpr char          kMagic[8]        = {'M', 'I', 'D', 'X', 'v', '1', '\0', '\0'};
+
+    enum : std::uint32_t { kUsed = 1, kTombstone = 2, kDirty = 4, kDir = 8 };
+
+    struct Header {
+        char          magic[8];
+        std::uint32_t version;
+        std::uint32_t header_bytes;
+        std::uint64_t slots;          // power of two
+        std::uint64_t count;
+        std::uint64_t tombstones;
+        std::uint64_t heap_used;
+        std::uint64_t heap_garbage;   // bytes of strings no slot points to
+        std::uint64_t heap_gen;       // heap file is <path>.heap.<gen>
+    };
+
+    struct Slot {
+        std::uint64_t hash;
+        std::uint64_t heap_off;       // path, immediately followed by local path
+        std::uint32_t path_len;
+        std::uint32_t local_len;
+        std::uint64_t size;
+        std::int64_t  timestamp;
+        std::int64_t  last_accessed;
+        std::int64_t  mtime;
+        std::uint32_t flags;
+        std::uint32_t reserved;
+    };
+    static_assert(sizeof(Slot) == 64, "slots are one cache line");
+
+    struct Mapping {
+        void*       base  = nullptr;
+        std::size_t bytes = 0;
+    };
+
+    static std::uint64_t hashPath(const std::string& path);
+    static bool mapFile(const std::string& path, std::size_t bytes, bool truncate, Mapping& out);
+    static void unmap(Mapping& m);
+    std::string heapPath(std::uint64_t gen) const { return path_ + ".heap." + std::to_string(gen); }
+
+    Header* header() const { return static_cast<Header*>(table_.base); }
+    Slot*   slots() const { return reinterpret_cast<Slot*>(static_cast<char*>(table_.base) + kPageBytes); }
+    const char* heap() const { return static_cast<const char*>(heap_.base); }
+
+    // Caller holds mu_.
+    Slot* find(const std::string& path, std::uint64_t hash) const;
+    Slot* freeSlot(std::uint64_t hash) const;
+    bool  appendStrings(const std::string& path, const std::string& local, std::uint64_t& off);
+    bool  reserveSlot();
+    // Writes the live rows (none unless keep) into new files of the given
+    // size and swaps them in.
+    bool  rebuild(std::uint64_t new_slots, bool keep);
+    void  fill(const Slot& s, CacheMetadata& meta) const;
+
+    std::string path_;
+    Mapping     table_;
+    Mapping     heap_;
+    std::mutex  mu_;
+
+    HashIndex(const HashIndex&) = delete;
+    HashIndex& operator=(const HashIndex&) = delete;
+};
+
+#endif
@@ -0,0 +1,141 @@
+#include "mapped_bitmap.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+// Bit i of the file image is bit i % 8 of byte i / 8, which is bit i % 64 of
+// word i / 64 only on a little-endian host.
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "mapped bitmaps assume little-endian words");
+
+constexpr char MappedBitmap::kMagic[8];
+
+MappedBitmap::MappedBitmap(const std::string& path) : path_(path) {}
+
+MappedBitmap::~MappedBitmap() {
+    if (!base_) return;
+    flush();
+    ::munmap(base_, mapped_);
+}
+
+bool MappedBitmap::open(bool create) {
+    int fd = ::open(path_.c_str(), create ? O_RDWR | O_CREAT : O_RDWR, 0644);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+    std::size_t size = static_cast<std::size_t>(st.st_size);
+
+    // anything without our header is the old flat byte image
+    std::vector<std::uint8_t> legacy;
+    if (size > 0) {
+        Header h{};
+        if (size < 2 * kPageBytes || ::pread(fd, &h, sizeof(h), 0) != sizeof(h) ||
+            std::memcmp(h.magic, kMagic, sizeof(kMagic)) != 0) {
+            legacy.resize(size);
+            if (::pread(fd, legacy.data(), size, 0) != static_cast<ssize_t>(size)) legacy.clear();
+            size = 0;
+        }
+    }
+    bool fresh = size == 0;
+    std::size_t want = fresh ? 2 * kPageBytes : (size + kPageBytes - 1) / kPageBytes * kPageBytes;
+    bool resize = fresh || static_cast<std::size_t>(st.st_size) != want;
+    if ((fresh && ::ftruncate(fd, 0) != 0) ||
+        (resize && ::ftruncate(fd, static_cast<off_t>(want)) != 0)) {
+        ::close(fd);
+        return false;
+    }
+    size = want;
+    bool ok = map(fd, size);
+    ::close(fd);
+    if (!ok) return false;
+
+    if (fresh) {
+        std::memcpy(header()->magic, kMagic, sizeof(kMagic));
+        header()->version      = 1;
+        header()->header_bytes = kPageBytes;
+        dirty_pages_.set(0);
+    }
+    header()->capacity_bits = (mapped_ - kPageBytes) * 8;
+
+    for (std::size_t i = 0; i < legacy.size(); ++i) {
+        for (unsigned byte = legacy[i]; byte; byte &= byte - 1) set(i * 8 + __builtin_ctz(byte));
+    }
+    return true;
+}
+
+bool MappedBitmap::map(int fd, std::size_t bytes) {
+    void* p = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        std::cerr << "[mapped_bitmap] mmap " << path_ << " failed: " << std::strerror(errno) << '\n';
+        return false;
+    }
+    if (base_) ::munmap(base_, mapped_);
+    base_   = p;
+    mapped_ = bytes;
+    return true;
+}
+
+// Doubles the data area until bit fits.
+bool MappedBitmap::grow(std::uint64_t bit) {
+    std::uint64_t pages = (mapped_ - kPageBytes) / kPageBytes;
+    while (pages * kPageBits <= bit) pages *= 2;
+    std::size_t bytes = static_cast<std::size_t>((pages + 1) * kPageBytes);
+
+    int fd = ::open(path_.c_str(), O_RDWR);
+    if (fd < 0) return false;
+    bool ok = ::ftruncate(fd, static_cast<off_t>(bytes)) == 0 && map(fd, bytes);
+    ::close(fd);
+    if (!ok) return false;
+    header()->capacity_bits = pages * kPageBits;
+    dirty_pages_.set(0);
+    return true;
+}
+
+std::uint64_t* MappedBitmap::word(std::uint64_t i) const {
+    return reinterpret_cast<std::uint64_t*>(static_cast<char*>(base_) + kPageBytes) + i / 64;
+}
+
+bool MappedBitmap::set(std::uint64_t i) {
+    if (!base_) return false;
+    if (i >= header()->capacity_bits && !grow(i)) return false;
+    std::uint64_t mask = 1ULL << (i % 64);
+    if (__atomic_fetch_or(word(i), mask, __ATOMIC_RELAXED) & mask) return false;
+    dirty_pages_.set(static_cast<std::uint32_t>(1 + i / kPageBits));
+    return true;
+}
+
+bool MappedBitmap::clear(std::uint64_t i) {
+    if (!base_ || i >= header()->capacity_bits) return false;
+    std::uint64_t mask = 1ULL << (i % 64);
+    if (!(__atomic_fetch_and(word(i), ~mask, __ATOMIC_RELAXED) & mask)) return false;
+    dirty_pages_.set(static_cast<std::uint32_t>(1 + i / kPageBits));
+    return true;
+}
+
+bool MappedBitmap::test(std::uint64_t i) const {
+    if (!base_ || i >= header()->capacity_bits) return false;
+    return (__atomic_load_n(word(i), __ATOMIC_RELAXED) >> (i % 64)) & 1;
+}
+
+// msyncs each run of consecutive touched pages with one call.
+bool MappedBitmap::flush() {
+    if (!base_) return false;
+    bool ok = true;
+    for (std::uint64_t p = dirty_pages_.next_set(0); p != BlockBitmap::kNone;) {
+        std::uint64_t end = dirty_pages_.next_clear(p);
+        ok &= ::msync(static_cast<char*>(base_) + p * kPageBytes, (end - p) * kPageBytes, MS_SYNC) == 0;
+        p = dirty_pages_.next_set(end);
+    }
+    if (ok) dirty_pages_.reset();
+    return ok;
+}
@@ -0,0 +1,58 @@
+#ifndef CACHE_MAPPED_BITMAP_H
+#define CACHE_MAPPED_BITMAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "block_bitmap.h"
+
+// A bitmap that lives in an mmapped file: one header page followed by the
+// raw bits, LSB first. Bits are flipped in place with atomic word ops, so a
+// warm restart maps the file and is done; flush() msyncs only the pages
+// touched since the previous flush. The file grows in whole pages.
+class MappedBitmap {
+public:
+    explicit MappedBitmap(const std::string& path);
+    ~MappedBitmap();
+
+    // Maps the file, converting a headerless bitmap written by older
+    // versions. A missing file is created, unless create is false, in which
+    // case open() fails with errno ENOENT.
+    bool open(bool create = true);
+
+    // Both return true if the bit changed.
+    bool set(std::uint64_t i);
+    bool clear(std::uint64_t i);
+    bool test(std::uint64_t i) const;
+
+    bool flush();
+
+private:
+    static constexpr std::size_t   kPageBytes = 4096;
+    static constexpr std::uint64_t kPageBits  = kPageBytes * 8;
+    static constexpr char          kMagic[8]  = {'D', 'M', 'A', 'P', 'v', '1', '\0', '\0'};
+
+    struct Header {
+        char          magic[8];
+        std::uint32_t version;
+        std::uint32_t header_bytes;
+        std::uint64_t capacity_bits;
+    };
+
+    bool map(int fd, std::size_t bytes);
+    bool grow(std::uint64_t bit);
+    std::uint64_t* word(std::uint64_t i) const;
+    Header* header() const { return static_cast<Header*>(base_); }
+
+    std::string   path_;
+    void*         base_ = nullptr;
+    std::size_t   mapped_ = 0;
+    // file pages written since the last flush; page 0 is the header
+    BlockBitmap   dirty_pages_;
+
+    MappedBitmap(const MappedBitmap&) = delete;
+    MappedBitmap& operator=(const MappedBitmap&) = delete;
+};
+
+#endif
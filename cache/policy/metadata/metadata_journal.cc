@@ -0,0 +1,162 @@
+#include "metadata_journal.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+
+constexpr char MetadataJournal::kMagic[8];
+
+static std::array<std::uint32_t, 256> make_crc_table() {
+    std::array<std::uint32_t, 256> table{};
+    for (std::uint32_t i = 0; i < 256; ++i) {
+        std::uint32_t c = i;
+        for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        table[i] = c;
+    }
+    return table;
+}
+
+static std::uint32_t crc32(const void* data, std::size_t len) {
+    static const std::array<std::uint32_t, 256> table = make_crc_table();
+    const auto* p = static_cast<const std::uint8_t*>(data);
+    std::uint32_t c = 0xFFFFFFFFu;
+    for (std::size_t i = 0; i < len; ++i) c = table[(c ^ p[i]) & 0xFF] ^ (c >> 8);
+    return c ^ 0xFFFFFFFFu;
+}
+
+MetadataJournal::MetadataJournal(const std::string& path) : path_(path) {}
+
+MetadataJournal::~MetadataJournal() {
+    {
+        std::lock_guard<std::mutex> g(mu_);
+        stop_ = true;
+    }
+    cv_.notify_one();
+    if (flusher_.joinable()) flusher_.join();
+    if (fd_ < 0) return;
+    sync();
+    ::close(fd_);
+}
+
+bool MetadataJournal::open(const std::function<void(const Record&)>& replay) {
+    fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd_ < 0) {
+        std::cerr << "[journal] open " << path_ << " failed: " << std::strerror(errno) << '\n';
+        return false;
+    }
+
+    struct stat st;
+    std::uint64_t on_disk = ::fstat(fd_, &st) == 0 ? static_cast<std::uint64_t>(st.st_size) : 0;
+    char header[kHeaderSize] = {};
+    bool valid = on_disk >= kHeaderSize && ::pread(fd_, header, kHeaderSize, 0) == static_cast<ssize_t>(kHeaderSize) &&
+                 std::memcmp(header, kMagic, sizeof(kMagic)) == 0;
+
+    // replay up to the first record that did not make it to disk whole
+    std::uint64_t end = kHeaderSize;
+    if (valid) {
+        std::vector<Wire> chunk(4096);
+        while (end < on_disk) {
+            ssize_t n = ::pread(fd_, chunk.data(), chunk.size() * sizeof(Wire), static_cast<off_t>(end));
+            if (n <= 0) break;
+            std::size_t whole = static_cast<std::size_t>(n) / sizeof(Wire);
+            std::size_t i = 0;
+            for (; i < whole; ++i) {
+                const Wire& w = chunk[i];
+                if (w.crc != crc32(&w, offsetof(Wire, crc)) || w.op < 1 || w.op > 4) break;
+                replay(Record{w.object, w.block, w.part, static_cast<Op>(w.op)});
+            }
+            end += i * sizeof(Wire);
+            if (i < whole || whole < chunk.size()) break;
+        }
+    } else {
+        std::memcpy(header, kMagic, sizeof(kMagic));
+        if (::pwrite(fd_, header, kHeaderSize, 0) != static_cast<ssize_t>(kHeaderSize)) return false;
+    }
+    // drop a torn tail so new records follow the last good one
+    if ((end != on_disk && ::ftruncate(fd_, static_cast<off_t>(end)) != 0) || ::fdatasync(fd_) != 0) return false;
+    size_ = end;
+
+    flusher_ = std::thread(&MetadataJournal::flusher_loop, this);
+    return true;
+}
+
+std::uint64_t MetadataJournal::append(const Record& rec) {
+    Wire w{};
+    w.object = rec.object;
+    w.block  = rec.block;
+    w.part   = rec.part;
+    w.op     = static_cast<std::uint8_t>(rec.op);
+    w.crc    = crc32(&w, offsetof(Wire, crc));
+
+    std::uint64_t size;
+    bool wake;
+    {
+        std::lock_guard<std::mutex> g(mu_);
+        buffer_.push_back(w);
+        size = size_ + buffer_.size() * sizeof(Wire);
+        wake = buffer_.size() == 1 || buffer_.size() * sizeof(Wire) >= kSyncBytes;
+    }
+    if (wake) cv_.notify_one();
+    return size;
+}
+
+// Caller holds io_mu_ and passes mu_ locked; mu_ is released for the I/O.
+bool MetadataJournal::write_buffered(std::unique_lock<std::mutex>& lk) {
+    std::vector<Wire> batch;
+    batch.swap(buffer_);
+    std::uint64_t off = size_;
+    lk.unlock();
+
+    bool ok = true;
+    if (!batch.empty() && fd_ >= 0) {
+        std::size_t len = batch.size() * sizeof(Wire);
+        ok = ::pwrite(fd_, batch.data(), len, static_cast<off_t>(off)) == static_cast<ssize_t>(len) &&
+             ::fdatasync(fd_) == 0;
+        if (!ok) std::cerr << "[journal] write " << path_ << " failed: " << std::strerror(errno) << '\n';
+    }
+
+    lk.lock();
+    if (ok) {
+        size_ = off + batch.size() * sizeof(Wire);
+    } else {
+        // keep the records for the next attempt
+        batch.insert(batch.end(), buffer_.begin(), buffer_.end());
+        buffer_.swap(batch);
+    }
+    return ok;
+}
+
+bool MetadataJournal::sync() {
+    std::lock_guard<std::mutex> io(io_mu_);
+    std::unique_lock<std::mutex> lk(mu_);
+    return write_buffered(lk);
+}
+
+bool MetadataJournal::reset() {
+    std::lock_guard<std::mutex> io(io_mu_);
+    std::lock_guard<std::mutex> g(mu_);
+    buffer_.clear();
+    if (fd_ < 0) return true;
+    if (::ftruncate(fd_, static_cast<off_t>(kHeaderSize)) != 0 || ::fdatasync(fd_) != 0) return false;
+    size_ = kHeaderSize;
+    return true;
+}
+
+void MetadataJournal::flusher_loop() {
+    std::unique_lock<std::mutex> lk(mu_);
+    while (!stop_) {
+        cv_.wait(lk, [&] { return stop_ || !buffer_.empty(); });
+        if (stop_) break;
+        // one fdatasync covers everything appended in the interval
+        cv_.wait_for(lk, kSyncInterval, [&] { return stop_ || buffer_.size() * sizeof(Wire) >= kSyncBytes; });
+        lk.unlock();
+        sync();
+        lk.lock();
+    }
+}
@@ -0,0 +1,82 @@
+#ifndef CACHE_METADATA_JOURNAL_H
+#define CACHE_METADATA_JOURNAL_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Append-only log of block state changes. Records are buffered and written
+// with one fdatasync per kSyncInterval (group fsync), so a crash loses at
+// most that window. After a checkpoint has persisted the bitmaps, reset()
+// truncates the log, and replay on startup only walks the tail since then.
+class MetadataJournal {
+public:
+    enum class Op : std::uint8_t { Present = 1, Dirty = 2, Clean = 3, Evict = 4 };
+
+    struct Record {
+        std::uint64_t object = 0;   // object hash
+        std::uint32_t block  = 0;
+        std::uint16_t part   = 0;
+        Op            op     = Op::Present;
+    };
+
+    static constexpr auto        kSyncInterval = std::chrono::milliseconds(10);
+    static constexpr std::size_t kSyncBytes    = 64 * 1024;
+
+    explicit MetadataJournal(const std::string& path);
+    ~MetadataJournal();
+
+    // Opens or creates the log and passes every intact record to replay,
+    // stopping at the first torn or corrupt one.
+    bool open(const std::function<void(const Record&)>& replay);
+
+    // Buffers one record. Returns the log size including buffered records.
+    std::uint64_t append(const Record& rec);
+
+    // Writes and syncs everything buffered so far.
+    bool sync();
+
+    // Drops every record; the caller has persisted their effects.
+    bool reset();
+
+private:
+    struct Wire {
+        std::uint64_t object;
+        std::uint32_t block;
+        std::uint16_t part;
+        std::uint8_t  op;
+        std::uint8_t  reserved;
+        std::uint32_t crc;        // over the 16 bytes above
+        std::uint32_t pad;
+    };
+    static_assert(sizeof(Wire) == 24, "journal records are 24 bytes");
+
+    static constexpr char        kMagic[8]   = {'C', 'J', 'R', 'N', 'L', '0', '0', '1'};
+    static constexpr std::size_t kHeaderSize = 16;
+
+    bool write_buffered(std::unique_lock<std::mutex>& lk);
+    void flusher_loop();
+
+    std::string path_;
+    int         fd_ = -1;
+
+    // io_mu_ serialises writes to fd_ and is taken before mu_
+    std::mutex        io_mu_;
+    std::mutex        mu_;
+    std::condition_variable cv_;
+    std::vector<Wire> buffer_;
+    std::uint64_t     size_ = kHeaderSize;     // bytes on disk
+    bool              stop_ = false;
+    std::thread       flusher_;
+
+    MetadataJournal(const MetadataJournal&) = delete;
+    MetadataJournal& operator=(const MetadataJournal&) = delete;
+};
+
+#endif
@@ -0,0 +1,549 @@
+#include "metadata_shard.h"
+
+#include <sqlite3.h>
+
+#include <algorithm>
+#include <iostream>
+
+
+static const char* const kStmtSql[] = {
+    // kGet
+    "SELECT local_path, size, timestamp, last_accessed, dirty, mtime, is_dir "
+    "FROM metadata WHERE path=?;",
+    // kPut
+    "INSERT INTO metadata "
+    "(path, local_path, size, timestamp, last_accessed, dirty, mtime, is_dir) "
+    "VALUES (?, ?, ?, ?, ?, ?, ?, ?) "
+    "ON CONFLICT(path) DO UPDATE SET "
+    "local_path=excluded.local_path, size=excluded.size, "
+    "timestamp=excluded.timestamp, last_accessed=excluded.last_accessed, "
+    "dirty=excluded.dirty, mtime=excluded.mtime, is_dir=excluded.is_dir;",
+    // kTouch
+    "UPDATE metadata SET last_accessed=? WHERE path=?;",
+    // kDirty
+    "UPDATE metadata SET dirty=? WHERE path=?;",
+    // kRemove
+    "DELETE FROM metadata WHERE path=?;",
+    // kAll
+    "SELECT path, local_path, size, timestamp, last_accessed, dirty, mtime, is_dir "
+    "FROM metadata;",
+};
+
+// Leaves a cached statement ready for its next use.
+struct StmtReset {
+    sqlite3_stmt* stmt;
+    ~StmtReset() {
+        if (!stmt) return;
+        sqlite3_reset(stmt);
+        sqlite3_clear_bindings(stmt);
+    }
+};
+
+MetadataShard::MetadataShard(const std::string& db_path, SyncLevel sync, std::size_t shard_count, PathTable& paths) : db_path_(db_path), sync_(sync), shard_count_(shard_count), paths_(paths) {}
+
+MetadataShard::~MetadataShard() {
+    stopWriter();
+    {
+        std::lock_guard<std::mutex> db(db_mu_);
+        commitPending();
+    }
+    finalizeStatements();
+    if (db_handle_) sqlite3_close(static_cast<sqlite3*>(db_handle_));
+}
+
+bool MetadataShard::open() {
+    sqlite3* db = nullptr;
+    if (sqlite3_open(db_path_.c_str(), &db) != SQLITE_OK) {
+        std::cerr << "Failed to open DB: " << sqlite3_errmsg(db) << '\n';
+        return false;
+    }
+    db_handle_ = db;
+
+    static const char* const sync_sql[] = {
+        "PRAGMA synchronous=OFF;", "PRAGMA synchronous=NORMAL;", "PRAGMA synchronous=FULL;"};
+    char* errmsg = nullptr;
+    if (sqlite3_exec(db, "PRAGMA journal_mode=WAL;", nullptr, nullptr, &errmsg) != SQLITE_OK ||
+        sqlite3_exec(db, sync_sql[static_cast<int>(sync_)], nullptr, nullptr, &errmsg) != SQLITE_OK) {
+        std::cerr << "Failed to configure DB: " << errmsg << '\n';
+        sqlite3_free(errmsg);
+        return false;
+    }
+    sqlite3_busy_timeout(db, 1000);
+
+    const char* create_sql =
+        "CREATE TABLE IF NOT EXISTS metadata ("
+        "path TEXT PRIMARY KEY,"
+        "local_path TEXT,"
+        "size INTEGER,"
+        "timestamp INTEGER,"
+        "last_accessed INTEGER,"
+        "dirty INTEGER,"
+        "mtime INTEGER DEFAULT 0,"
+        "is_dir INTEGER DEFAULT 0"
+        ");";
+    if (sqlite3_exec(db, create_sql, nullptr, nullptr, &errmsg) != SQLITE_OK) {
+        std::cerr << "Failed to create table: " << errmsg << '\n';
+        sqlite3_free(errmsg);
+        return false;
+    }
+    if (!migrate() || !checkShardCount()) return false;
+
+    writer_ = std::thread(&MetadataShard::writerLoop, this);
+    return true;
+}
+
+// Adds the columns introduced after the first schema to older databases.
+bool MetadataShard::migrate() {
+    sqlite3* db = static_cast<sqlite3*>(db_handle_);
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, "PRAGMA table_info(metadata);", -1, &stmt, nullptr) != SQLITE_OK) return false;
+    bool has_mtime = false, has_is_dir = false;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        std::string col = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+        has_mtime  |= col == "mtime";
+        has_is_dir |= col == "is_dir";
+    }
+    sqlite3_finalize(stmt);
+
+    char* errmsg = nullptr;
+    if ((!has_mtime && sqlite3_exec(db, "ALTER TABLE metadata ADD COLUMN mtime INTEGER DEFAULT 0;", nullptr, nullptr, &errmsg) != SQLITE_OK) ||
+        (!has_is_dir && sqlite3_exec(db, "ALTER TABLE metadata ADD COLUMN is_dir INTEGER DEFAULT 0;", nullptr, nullptr, &errmsg) != SQLITE_OK)) {
+        std::cerr << "Failed to migrate table: " << errmsg << '\n';
+        sqlite3_free(errmsg);
+        return false;
+    }
+    return true;
+}
+
+// The shard count lives in user_version; a fresh database (0) takes ours.
+bool MetadataShard::checkShardCount() {
+    sqlite3* db = static_cast<sqlite3*>(db_handle_);
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, "PRAGMA user_version;", -1, &stmt, nullptr) != SQLITE_OK) return false;
+    std::size_t stored = sqlite3_step(stmt) == SQLITE_ROW ? static_cast<std::size_t>(sqlite3_column_int64(stmt, 0)) : 0;
+    sqlite3_finalize(stmt);
+    if (stored == shard_count_) return true;
+    if (stored != 0) {
+        std::cerr << db_path_ << " belongs to a store of " << stored << " shards, not " << shard_count_ << '\n';
+        return false;
+    }
+    std::string sql = "PRAGMA user_version=" + std::to_string(shard_count_) + ";";
+    return sqlite3_exec(db, sql.c_str(), nullptr, nullptr, nullptr) == SQLITE_OK;
+}
+
+void* MetadataShard::statement(Stmt which) {
+    if (!stmts_[which] && db_handle_) {
+        sqlite3_stmt* stmt = nullptr;
+        if (sqlite3_prepare_v3(static_cast<sqlite3*>(db_handle_), kStmtSql[which], -1,
+                               SQLITE_PREPARE_PERSISTENT, &stmt, nullptr) != SQLITE_OK)
+            return nullptr;
+        stmts_[which] = stmt;
+    }
+    return stmts_[which];
+}
+
+void MetadataShard::finalizeStatements() {
+    for (void*& stmt : stmts_) {
+        sqlite3_finalize(static_cast<sqlite3_stmt*>(stmt));
+        stmt = nullptr;
+    }
+}
+
+// Rows held in memory leave path empty, since their id names it.
+static CacheMetadata unnamed(const CacheMetadata& meta) {
+    CacheMetadata row;
+    row.local_path    = meta.local_path;
+    row.size          = meta.size;
+    row.timestamp     = meta.timestamp;
+    row.last_accessed = meta.last_accessed;
+    row.dirty         = meta.dirty;
+    row.mtime         = meta.mtime;
+    row.is_dir        = meta.is_dir;
+    return row;
+}
+
+static CacheMetadata named(const CacheMetadata& row, const std::string& path) {
+    CacheMetadata meta = row;
+    meta.path = path;
+    return meta;
+}
+
+std::optional<CacheMetadata> MetadataShard::get(const std::string& path) {
+    std::uint32_t id = paths_.find(path);
+    if (id != PathTable::kNone) {
+        std::lock_guard<std::mutex> q(queue_mu_);
+        if (CacheMetadata* known = cachedRow(id)) return named(*known, path);
+    }
+
+    // holding db_mu_ keeps the writer from moving ops between the queue and
+    // the database while we look at both
+    std::lock_guard<std::mutex> db(db_mu_);
+    std::optional<PendingOp> op;
+    if (id != PathTable::kNone) {
+        std::lock_guard<std::mutex> q(queue_mu_);
+        auto it = pending_.find(id);
+        if (it != pending_.end()) op = it->second;
+    }
+    if (op && op->row) return named(*op->row, path);
+    if (op && op->removed) return std::nullopt;
+
+    sqlite3_stmt* stmt = static_cast<sqlite3_stmt*>(statement(kGet));
+    if (!stmt) return std::nullopt;
+    StmtReset reset{stmt};
+
+    sqlite3_bind_text(stmt, 1, path.c_str(), -1, SQLITE_STATIC);
+    if (sqlite3_step(stmt) != SQLITE_ROW) return std::nullopt;
+
+    CacheMetadata meta;
+    meta.path = path;
+    meta.local_path     = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+    meta.size           = sqlite3_column_int64(stmt, 1);
+    meta.timestamp      = static_cast<std::time_t>(sqlite3_column_int64(stmt, 2));
+    meta.last_accessed  = static_cast<std::time_t>(sqlite3_column_int64(stmt, 3));
+    meta.dirty          = sqlite3_column_int(stmt, 4) != 0;
+    meta.mtime          = static_cast<std::time_t>(sqlite3_column_int64(stmt, 5));
+    meta.is_dir         = sqlite3_column_int(stmt, 6) != 0;
+    if (op && op->last_accessed) meta.last_accessed = *op->last_accessed;
+    if (op && op->dirty)         meta.dirty = *op->dirty;
+
+    if (op) return meta;
+    id = paths_.intern(path);
+    std::lock_guard<std::mutex> q(queue_mu_);
+    // only index rows nothing is queued for, before or since we looked
+    if (!pending_.count(id) && !rows_.count(id)) cacheRow(id, meta);
+    return meta;
+}
+
+CacheMetadata* MetadataShard::cachedRow(std::uint32_t id) {
+    auto it = rows_.find(id);
+    if (it == rows_.end()) return nullptr;
+    rows_lru_.splice(rows_lru_.begin(), rows_lru_, it->second.lru);
+    return &it->second.meta;
+}
+
+void MetadataShard::cacheRow(std::uint32_t id, const CacheMetadata& meta) {
+    auto [it, added] = rows_.try_emplace(id);
+    it->second.meta = unnamed(meta);
+    if (!added) {
+        rows_lru_.splice(rows_lru_.begin(), rows_lru_, it->second.lru);
+        return;
+    }
+    rows_lru_.push_front(id);
+    it->second.lru = rows_lru_.begin();
+    trimRows();
+}
+
+void MetadataShard::uncacheRow(std::uint32_t id) {
+    auto it = rows_.find(id);
+    if (it == rows_.end()) return;
+    rows_lru_.erase(it->second.lru);
+    rows_.erase(it);
+}
+
+// A forgotten row is read back from the queue or the database on its next
+// get(), so nothing needs writing first.
+void MetadataShard::trimRows() {
+    while (rows_.size() > max_rows_) {
+        rows_.erase(rows_lru_.back());
+        rows_lru_.pop_back();
+    }
+}
+
+void MetadataShard::setRowCache(std::size_t rows) {
+    std::lock_guard<std::mutex> q(queue_mu_);
+    max_rows_ = rows;
+    trimRows();
+}
+
+std::size_t MetadataShard::cachedRows() {
+    std::lock_guard<std::mutex> q(queue_mu_);
+    return rows_.size();
+}
+
+template <class Fn>
+void MetadataShard::enqueue(std::uint32_t id, Fn&& fn) {
+    bool wake;
+    {
+        std::lock_guard<std::mutex> q(queue_mu_);
+        fn(pending_[id]);
+        ++pending_ops_;
+        wake = pending_ops_ == 1 || pending_ops_ >= kGroupCommitOps;
+    }
+    if (wake) queue_cv_.notify_one();
+}
+
+// queue_mu_ is held over the second look, so a put that interns the path
+// meanwhile queues its row after the direct write and wins.
+template <class Write>
+std::uint32_t MetadataShard::idForChange(const std::string& path, bool& written, Write&& write) {
+    std::uint32_t id = paths_.find(path);
+    if (id != PathTable::kNone) return id;
+    std::lock_guard<std::mutex> db(db_mu_);
+    std::lock_guard<std::mutex> q(queue_mu_);
+    id = paths_.find(path);
+    if (id == PathTable::kNone) written = write();
+    return id;
+}
+
+bool MetadataShard::put(const CacheMetadata& meta) {
+    if (!db_handle_) return false;
+    std::uint32_t id = paths_.intern(meta.path);
+    enqueue(id, [&](PendingOp& op) {
+        cacheRow(id, meta);
+        op.row = unnamed(meta);
+        op.last_accessed.reset();
+        op.dirty.reset();
+    });
+    return true;
+}
+
+bool MetadataShard::updateAccessTime(const std::string& path, std::time_t last_accessed) {
+    if (!db_handle_) return false;
+    bool written = false;
+    std::uint32_t id = idForChange(path, written, [&] { return writeAccessTime(path, last_accessed); });
+    if (id == PathTable::kNone) return written;
+    enqueue(id, [&](PendingOp& op) {
+        if (auto it = rows_.find(id); it != rows_.end()) it->second.meta.last_accessed = last_accessed;
+        if (op.row)              op.row->last_accessed = last_accessed;
+        else if (!op.removed)    op.last_accessed = last_accessed;
+    });
+    return true;
+}
+
+bool MetadataShard::markDirty(const std::string& path, bool dirty) {
+    if (!db_handle_) return false;
+    bool written = false;
+    std::uint32_t id = idForChange(path, written, [&] { return writeDirty(path, dirty); });
+    if (id == PathTable::kNone) return written;
+    enqueue(id, [&](PendingOp& op) {
+        if (auto it = rows_.find(id); it != rows_.end()) it->second.meta.dirty = dirty;
+        if (op.row)              op.row->dirty = dirty;
+        else if (!op.removed)    op.dirty = dirty;
+    });
+    return true;
+}
+
+bool MetadataShard::remove(const std::string& path) {
+    if (!db_handle_) return false;
+    bool written = false;
+    std::uint32_t id = idForChange(path, written, [&] { return writeRemove(path); });
+    if (id == PathTable::kNone) return written;
+    enqueue(id, [&](PendingOp& op) {
+        uncacheRow(id);
+        op = PendingOp{};
+        op.removed = true;
+    });
+    return true;
+}
+
+bool MetadataShard::commit() {
+    std::lock_guard<std::mutex> db(db_mu_);
+    return commitPending();
+}
+
+// Caller holds db_mu_. A batch that fails to commit is rolled back and
+// queued again under anything queued since, so the next commit retries it.
+bool MetadataShard::commitPending() {
+    std::unordered_map<std::uint32_t, PendingOp> batch;
+    {
+        std::lock_guard<std::mutex> q(queue_mu_);
+        batch.swap(pending_);
+        pending_ops_ = 0;
+    }
+    if (batch.empty() || !db_handle_) return true;
+
+    sqlite3* db = static_cast<sqlite3*>(db_handle_);
+    bool ok = sqlite3_exec(db, "BEGIN;", nullptr, nullptr, nullptr) == SQLITE_OK;
+    if (ok) {
+        for (const auto& [id, op] : batch) {
+            std::string_view path = paths_.path(id);
+            if (op.removed) ok &= writeRemove(path);
+            if (op.row) {
+                ok &= writePut(path, *op.row);
+                continue;
+            }
+            if (op.last_accessed) ok &= writeAccessTime(path, *op.last_accessed);
+            if (op.dirty)         ok &= writeDirty(path, *op.dirty);
+        }
+        ok = ok && sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr) == SQLITE_OK;
+    }
+    if (ok) {
+        if (failed_commits_ > 0)
+            std::cerr << "Metadata commits to " << db_path_ << " resumed after " << failed_commits_ << " failures\n";
+        failed_commits_ = unlogged_failures_ = 0;
+        return true;
+    }
+    noteCommitFailure(sqlite3_errmsg(db));
+    if (!sqlite3_get_autocommit(db)) sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+    requeue(std::move(batch));
+    return false;
+}
+
+void MetadataShard::noteCommitFailure(const std::string& error) {
+    auto now = std::chrono::steady_clock::now();
+    ++failed_commits_;
+    if (failed_commits_ > 1 && now - failure_logged_ < kCommitLogInterval) {
+        ++unlogged_failures_;
+        return;
+    }
+    std::cerr << "Metadata commit to " << db_path_ << " failed: " << error;
+    if (unlogged_failures_ > 0) std::cerr << " (" << unlogged_failures_ << " more since the last report)";
+    std::cerr << '\n';
+    unlogged_failures_ = 0;
+    failure_logged_ = now;
+}
+
+// Caller holds db_mu_. Ops queued since batch was taken are newer and win:
+// a put or remove replaces the old op, access-time and dirty updates are
+// applied on top of it.
+void MetadataShard::requeue(std::unordered_map<std::uint32_t, PendingOp> batch) {
+    std::lock_guard<std::mutex> q(queue_mu_);
+    for (auto& [id, old] : batch) {
+        auto it = pending_.find(id);
+        if (it == pending_.end()) {
+            pending_.emplace(id, std::move(old));
+            continue;
+        }
+        PendingOp& now = it->second;
+        if (now.row || now.removed) continue;
+        if (old.row) {
+            if (now.last_accessed) old.row->last_accessed = *now.last_accessed;
+            if (now.dirty)         old.row->dirty = *now.dirty;
+        } else if (!old.removed) {
+            if (now.last_accessed) old.last_accessed = now.last_accessed;
+            if (now.dirty)         old.dirty = now.dirty;
+        }
+        now = std::move(old);
+    }
+}
+
+void MetadataShard::writerLoop() {
+    std::chrono::milliseconds backoff{0};
+    std::unique_lock<std::mutex> lk(queue_mu_);
+    while (!stop_) {
+        queue_cv_.wait(lk, [&] { return stop_ || !pending_.empty(); });
+        if (stop_) break;
+        if (backoff.count() == 0) {
+            // give the batch a few milliseconds to fill up
+            queue_cv_.wait_for(lk, kGroupCommitInterval, [&] { return stop_ || pending_ops_ >= kGroupCommitOps; });
+        } else {
+            // a full queue does not cut this short: retrying a database that
+            // stays unwritable every few milliseconds only burns CPU
+            queue_cv_.wait_for(lk, backoff, [&] { return stop_; });
+        }
+        lk.unlock();
+        bool ok;
+        {
+            std::lock_guard<std::mutex> db(db_mu_);
+            ok = commitPending();
+        }
+        if (ok) {
+            backoff = std::chrono::milliseconds(0);
+        } else {
+            backoff = std::max<std::chrono::milliseconds>(2 * backoff, 2 * kGroupCommitInterval);
+            backoff = std::min<std::chrono::milliseconds>(backoff, kMaxCommitBackoff);
+        }
+        lk.lock();
+    }
+}
+
+void MetadataShard::stopWriter() {
+    {
+        std::lock_guard<std::mutex> q(queue_mu_);
+        stop_ = true;
+    }
+    queue_cv_.notify_one();
+    if (writer_.joinable()) writer_.join();
+}
+
+bool MetadataShard::writePut(std::string_view path, const CacheMetadata& meta) {
+    sqlite3_stmt* stmt = static_cast<sqlite3_stmt*>(statement(kPut));
+    if (!stmt) return false;
+    StmtReset reset{stmt};
+
+    sqlite3_bind_text(stmt, 1, path.data(), static_cast<int>(path.size()), SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, meta.local_path.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 3, static_cast<sqlite3_int64>(meta.size));
+    sqlite3_bind_int64(stmt, 4, static_cast<sqlite3_int64>(meta.timestamp));
+    sqlite3_bind_int64(stmt, 5, static_cast<sqlite3_int64>(meta.last_accessed));
+    sqlite3_bind_int(stmt, 6, meta.dirty ? 1 : 0);
+    sqlite3_bind_int64(stmt, 7, static_cast<sqlite3_int64>(meta.mtime));
+    sqlite3_bind_int(stmt, 8, meta.is_dir ? 1 : 0);
+
+    return sqlite3_step(stmt) == SQLITE_DONE;
+}
+
+bool MetadataShard::writeAccessTime(std::string_view path, std::time_t last_accessed) {
+    sqlite3_stmt* stmt = static_cast<sqlite3_stmt*>(statement(kTouch));
+    if (!stmt) return false;
+    StmtReset reset{stmt};
+
+    sqlite3_bind_int64(stmt, 1, static_cast<sqlite3_int64>(last_accessed));
+    sqlite3_bind_text(stmt, 2, path.data(), static_cast<int>(path.size()), SQLITE_STATIC);
+
+    return sqlite3_step(stmt) == SQLITE_DONE;
+}
+
+bool MetadataShard::writeDirty(std::string_view path, bool dirty) {
+    sqlite3_stmt* stmt = static_cast<sqlite3_stmt*>(statement(kDirty));
+    if (!stmt) return false;
+    StmtReset reset{stmt};
+
+    sqlite3_bind_int(stmt, 1, dirty ? 1 : 0);
+    sqlite3_bind_text(stmt, 2, path.data(), static_cast<int>(path.size()), SQLITE_STATIC);
+
+    return sqlite3_step(stmt) == SQLITE_DONE;
+}
+
+bool MetadataShard::writeRemove(std::string_view path) {
+    sqlite3_stmt* stmt = static_cast<sqlite3_stmt*>(statement(kRemove));
+    if (!stmt) return false;
+    StmtReset reset{stmt};
+
+    sqlite3_bind_text(stmt, 1, path.data(), static_cast<int>(path.size()), SQLITE_STATIC);
+
+    return sqlite3_step(stmt) == SQLITE_DONE;
+}
+
+bool MetadataShard::forEach(const std::function<bool(const CacheMetadata&)>& fn) {
+    std::lock_guard<std::mutex> db(db_mu_);
+    bool ok = commitPending();
+    sqlite3_stmt* stmt = static_cast<sqlite3_stmt*>(statement(kAll));
+    if (!stmt) return false;
+    StmtReset reset{stmt};
+
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        CacheMetadata meta;
+        meta.path = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+        meta.local_path = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+        meta.size = sqlite3_column_int64(stmt, 2);
+        meta.timestamp = static_cast<std::time_t>(sqlite3_column_int64(stmt, 3));
+        meta.last_accessed = static_cast<std::time_t>(sqlite3_column_int64(stmt, 4));
+        meta.dirty = sqlite3_column_int(stmt, 5) != 0;
+        meta.mtime = static_cast<std::time_t>(sqlite3_column_int64(stmt, 6));
+        meta.is_dir = sqlite3_column_int(stmt, 7) != 0;
+        if (!fn(meta)) break;
+    }
+    return ok;
+}
+
+void MetadataShard::drop() {
+    stopWriter();
+    std::lock_guard<std::mutex> db(db_mu_);
+    {
+        std::lock_guard<std::mutex> q(queue_mu_);
+        pending_.clear();
+        rows_.clear();
+        rows_lru_.clear();
+        pending_ops_ = 0;
+    }
+    finalizeStatements();
+    if (db_handle_) {
+        const char* sql = "DROP TABLE IF EXISTS metadata;";
+        char* errmsg = nullptr;
+        sqlite3_exec(static_cast<sqlite3*>(db_handle_), sql, nullptr, nullptr, &errmsg);
+        if (errmsg) sqlite3_free(errmsg);
+        sqlite3_close(static_cast<sqlite3*>(db_handle_));
+        db_handle_ = nullptr;
+    }
+}
@@ -0,0 +1,168 @@
+#ifndef CACHE_METADATA_SHARD_H
+#define CACHE_METADATA_SHARD_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+#include <ctime>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+
+#include "path_table.h"
+
+struct CacheMetadata {
+std::string path;
+std::string local_path;
+std::size_t size = 0;
+std::time_t timestamp = 0;
+std::time_t last_accessed = 0;
+bool        dirty = false;
+std::time_t mtime = 0;          // origin modification time
+bool        is_dir = false;
+};
+
+// One SQLite database file holding the metadata rows of the paths that hash
+// to it, with its own connection and its own background writer, so shards
+// never wait for each other.
+//
+// put, updateAccessTime, markDirty and remove only queue the change; queued
+// changes are merged per path and committed by the writer in one
+// transaction every kGroupCommitInterval or kGroupCommitOps operations,
+// whichever comes first. get() sees queued changes, and rows read or written
+// recently are answered from memory, up to a bound (kDefaultCachedRows
+// unless set) past which the least recently used are forgotten.
+class MetadataShard {
+public:
+
+// Maps to PRAGMA synchronous. In WAL mode Normal only risks the last
+// transactions on power loss, never corruption; Full fsyncs every commit.
+enum class SyncLevel { Off, Normal, Full };
+
+// shard_count is recorded in the database, and open() refuses a file that
+// was written with a different count, since its rows would then be looked
+// for in the wrong shard. paths is shared with the other shards and the
+// cache manager, and must outlive the shard.
+MetadataShard(const std::string& db_path, SyncLevel sync, std::size_t shard_count, PathTable& paths);
+~MetadataShard();
+
+bool open();
+
+std::optional<CacheMetadata> get(const std::string& path);
+bool put(const CacheMetadata& meta);
+bool updateAccessTime(const std::string& path, std::time_t last_accessed);
+bool markDirty(const std::string& path, bool dirty);
+bool remove(const std::string& path);
+// Commits what is queued, then calls fn on every row until it returns
+// false. fn must not call back into the shard.
+bool forEach(const std::function<bool(const CacheMetadata&)>& fn);
+// Commits everything queued so far.
+bool commit();
+void setRowCache(std::size_t rows);
+std::size_t cachedRows();
+// Stops the writer, drops the table and closes the database.
+void drop();
+
+private:
+static constexpr auto        kGroupCommitInterval = std::chrono::milliseconds(5);
+static constexpr std::size_t kGroupCommitOps      = 256;
+static constexpr std::size_t kDefaultCachedRows   = 65536;
+// after a failed commit the writer waits twice as long before each retry,
+// from 2 * kGroupCommitInterval up to kMaxCommitBackoff
+static constexpr auto        kMaxCommitBackoff    = std::chrono::milliseconds(1000);
+static constexpr auto        kCommitLogInterval   = std::chrono::seconds(10);
+
+// Net effect of the queued operations on one path. When row is set it
+// already includes later access-time and dirty updates.
+struct PendingOp {
+    bool removed = false;
+    std::optional<CacheMetadata> row;
+    std::optional<std::time_t>   last_accessed;
+    std::optional<bool>          dirty;
+};
+
+// A row answered from memory, and its place in the LRU.
+struct CachedRow {
+    CacheMetadata meta;
+    std::list<std::uint32_t>::iterator lru;
+};
+
+// Caller holds queue_mu_. The cached row for path, marked most recently
+// used, or nullptr.
+CacheMetadata* cachedRow(std::uint32_t id);
+// Caller holds queue_mu_. Caches meta, forgetting the least recently used
+// rows past the bound.
+void cacheRow(std::uint32_t id, const CacheMetadata& meta);
+void uncacheRow(std::uint32_t id);
+void trimRows();
+
+// Applies fn to the pending op for the path with this id and wakes the
+// writer if needed.
+template <class Fn>
+void enqueue(std::uint32_t id, Fn&& fn);
+// Id of the path a change names. A path never interned has nothing queued
+// or cached, so instead of interning a path that may have no row, write()
+// applies the change to the database directly, its result goes to
+// written, and kNone is returned.
+template <class Write>
+std::uint32_t idForChange(const std::string& path, bool& written, Write&& write);
+bool commitPending();
+// Caller holds db_mu_. Logs the first failed commit of a run, then at most
+// one line per kCommitLogInterval.
+void noteCommitFailure(const std::string& error);
+void requeue(std::unordered_map<std::uint32_t, PendingOp> batch);
+void writerLoop();
+void stopWriter();
+
+bool writePut(std::string_view path, const CacheMetadata& meta);
+bool writeAccessTime(std::string_view path, std::time_t last_accessed);
+bool writeDirty(std::string_view path, bool dirty);
+bool writeRemove(std::string_view path);
+bool migrate();
+bool checkShardCount();
+
+// Statements are prepared once per connection and reset after each use.
+enum Stmt { kGet, kPut, kTouch, kDirty, kRemove, kAll, kStmtCount };
+
+void* statement(Stmt which);
+void  finalizeStatements();
+
+std::string db_path_;
+void*       db_handle_ = nullptr;
+SyncLevel   sync_;
+std::size_t shard_count_;
+void*       stmts_[kStmtCount] = {};
+
+// db_mu_ serialises use of the connection and is taken before queue_mu_.
+std::mutex  db_mu_;
+std::mutex  queue_mu_;
+std::condition_variable queue_cv_;
+// Queued ops and cached rows are keyed by the path's id in paths_, and
+// their rows leave path empty, so each path is stored once.
+PathTable&  paths_;
+std::unordered_map<std::uint32_t, PendingOp> pending_;
+// in-memory index of known rows, kept in step with the queue
+std::unordered_map<std::uint32_t, CachedRow> rows_;
+// most recently used first
+std::list<std::uint32_t> rows_lru_;
+std::size_t max_rows_ = kDefaultCachedRows;
+std::size_t pending_ops_ = 0;
+// guarded by db_mu_: commits failed since the last one that went through,
+// how many of those were not logged, and when one last was
+std::size_t failed_commits_ = 0;
+std::size_t unlogged_failures_ = 0;
+std::chrono::steady_clock::time_point failure_logged_;
+bool        stop_ = false;
+std::thread writer_;
+
+MetadataShard(const MetadataShard&) = delete;
+MetadataShard& operator=(const MetadataShard&) = delete;
+};
+
+#endif
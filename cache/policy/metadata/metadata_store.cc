@@ -1,233 +1,495 @@
 #include "metadata_store.h"
 #include "fs_layout.h"
 
-#include <sqlite3.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cerrno>
+#include <cstdio>
 #include <cstring>
 #include <filesystem>
 #include <iostream>
+#include <iterator>
 
 namespace fs = std::filesystem;
 using namespace fs_layout;
 
 
-MetadataStore::MetadataStore(const std::string& db_path, const std::string& cache_root) : db_path_(db_path), db_handle_(nullptr), cache_root_(cache_root) {}
+// 64-bit FNV-1a. Rows must land in the same shard on every run, so this
+// cannot be std::hash.
+static std::uint64_t shard_hash(const std::string& path) {
+    std::uint64_t h = 0xcbf29ce484222325ULL;
+    for (unsigned char c : path) h = (h ^ c) * 0x100000001b3ULL;
+    return h;
+}
+
+// Dropping another object can remove a shard directory we are about to
+// use, so the directory is recreated until open succeeds.
+template <typename Open>
+static bool open_in_dir(const std::string& path, Open open) {
+    for (int attempt = 0; attempt < 3; ++attempt) {
+        std::error_code ec;
+        fs::create_directories(fs::path(path).parent_path(), ec);
+        if (open()) return true;
+        if (errno != ENOENT) return false;
+    }
+    return false;
+}
+
+MetadataStore::MetadataStore(const std::string& db_path, const std::string& cache_root, SyncLevel sync, Backend backend, std::size_t shards, PathTable* paths) : db_path_(db_path), cache_root_(cache_root), journal_(journal_path(cache_root)) {
+    if (backend == Backend::Index) {
+        index_ = std::make_unique<HashIndex>(db_path);
+        return;
+    }
+    if (!paths) {
+        own_paths_ = std::make_unique<PathTable>();
+        paths = own_paths_.get();
+    }
+    shards = std::max<std::size_t>(shards, 1);
+    for (std::size_t i = 0; i < shards; ++i) {
+        std::string path = shards == 1 ? db_path : db_path + "." + std::to_string(i);
+        shards_.push_back(std::make_unique<MetadataShard>(path, sync, shards, *paths));
+    }
+}
 
 MetadataStore::~MetadataStore() {
-    if (db_handle_) sqlite3_close(static_cast<sqlite3*>(db_handle_));
+    stopCheckpointer();
+    checkpoint();
 }
 
 
 bool MetadataStore::init() {
-    sqlite3* db = nullptr;
-    if (sqlite3_open(db_path_.c_str(), &db) != SQLITE_OK) {
-        std::cerr << "Failed to open DB: " << sqlite3_errmsg(db) << '\n';
+    if (index_ && !index_->open()) {
+        std::cerr << "Failed to open metadata index " << db_path_ << '\n';
         return false;
     }
-    db_handle_ = db;
-
-    const char* create_sql =
-        "CREATE TABLE IF NOT EXISTS metadata ("
-        "path TEXT PRIMARY KEY,"
-        "local_path TEXT,"
-        "size INTEGER,"
-        "timestamp INTEGER,"
-        "last_accessed INTEGER,"
-        "dirty INTEGER"
-        ");";
-    char* errmsg = nullptr;
-    if (sqlite3_exec(db, create_sql, nullptr, nullptr, &errmsg) != SQLITE_OK) {
-        std::cerr << "Failed to create table: " << errmsg << '\n';
-        sqlite3_free(errmsg);
-        return false;
+    for (auto& shard : shards_) {
+        if (!shard->open()) return false;
+    }
+    return openJournal();
+}
+
+// Replays what a crash left in the journal and starts the checkpointer.
+bool MetadataStore::openJournal() {
+    std::error_code ec;
+    fs::create_directories(cache_root_, ec);
+    std::size_t replayed = 0;
+    bool opened;
+    {
+        std::lock_guard<std::mutex> g(bitmap_mu_);
+        opened = journal_.open([&](const MetadataJournal::Record& rec) {
+            apply(rec);
+            ++replayed;
+        });
     }
+    if (!opened) return false;
+    if (replayed > 0 && !checkpoint()) std::cerr << "Metadata checkpoint after replay failed\n";
+
+    checkpointer_ = std::thread(&MetadataStore::checkpointLoop, this);
     return true;
 }
 
+MetadataShard& MetadataStore::shardFor(const std::string& path) {
+    return *shards_[shards_.size() == 1 ? 0 : shard_hash(path) % shards_.size()];
+}
+
 std::optional<CacheMetadata> MetadataStore::get(const std::string& path) {
-    sqlite3* db = static_cast<sqlite3*>(db_handle_);
-    const char* sql =
-        "SELECT local_path, size, timestamp, last_accessed, dirty "
-        "FROM metadata WHERE path=?;";
-    sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK)
-        return std::nullopt;
-
-    sqlite3_bind_text(stmt, 1, path.c_str(), -1, SQLITE_TRANSIENT);
-    CacheMetadata meta;
-    meta.path = path;
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        meta.local_path     = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
-        meta.size           = sqlite3_column_int64(stmt, 1);
-        meta.timestamp      = static_cast<std::time_t>(sqlite3_column_int64(stmt, 2));
-        meta.last_accessed  = static_cast<std::time_t>(sqlite3_column_int64(stmt, 3));
-        meta.dirty          = sqlite3_column_int(stmt, 4) != 0;
-        sqlite3_finalize(stmt);
-        return meta;
-    }
-    sqlite3_finalize(stmt);
-    return std::nullopt;
+    if (index_) return index_->get(path);
+    return shardFor(path).get(path);
 }
 
 bool MetadataStore::put(const CacheMetadata& meta) {
-    sqlite3* db = static_cast<sqlite3*>(db_handle_);
-    const char* sql =
-        "INSERT INTO metadata "
-        "(path, local_path, size, timestamp, last_accessed, dirty) "
-        "VALUES (?, ?, ?, ?, ?, ?) "
-        "ON CONFLICT(path) DO UPDATE SET "
-        "local_path=excluded.local_path, size=excluded.size, "
-        "timestamp=excluded.timestamp, last_accessed=excluded.last_accessed, "
-        "dirty=excluded.dirty;";
-    sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) return false;
-
-    sqlite3_bind_text(stmt, 1, meta.path.c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 2, meta.local_path.c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_int64(stmt, 3, static_cast<sqlite3_int64>(meta.size));
-    sqlite3_bind_int64(stmt, 4, static_cast<sqlite3_int64>(meta.timestamp));
-    sqlite3_bind_int64(stmt, 5, static_cast<sqlite3_int64>(meta.last_accessed));
-    sqlite3_bind_int(stmt, 6, meta.dirty ? 1 : 0);
-
-    bool ok = sqlite3_step(stmt) == SQLITE_DONE;
-    sqlite3_finalize(stmt);
-    return ok;
+    if (index_) return index_->put(meta);
+    return shardFor(meta.path).put(meta);
 }
 
 bool MetadataStore::updateAccessTime(const std::string& path, std::time_t last_accessed) {
-    sqlite3* db = static_cast<sqlite3*>(db_handle_);
-    const char* sql = "UPDATE metadata SET last_accessed=? WHERE path=?;";
-    sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) return false;
-
-    sqlite3_bind_int64(stmt, 1, static_cast<sqlite3_int64>(last_accessed));
-    sqlite3_bind_text(stmt, 2, path.c_str(), -1, SQLITE_TRANSIENT);
-
-    bool ok = sqlite3_step(stmt) == SQLITE_DONE;
-    sqlite3_finalize(stmt);
-    return ok;
+    if (index_) return index_->updateAccessTime(path, last_accessed);
+    return shardFor(path).updateAccessTime(path, last_accessed);
 }
 
 bool MetadataStore::markDirty(const std::string& path, bool dirty) {
-    sqlite3* db = static_cast<sqlite3*>(db_handle_);
-    const char* sql = "UPDATE metadata SET dirty=? WHERE path=?;";
-    sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) return false;
+    if (index_) return index_->markDirty(path, dirty);
+    return shardFor(path).markDirty(path, dirty);
+}
 
-    sqlite3_bind_int(stmt, 1, dirty ? 1 : 0);
-    sqlite3_bind_text(stmt, 2, path.c_str(), -1, SQLITE_TRANSIENT);
+bool MetadataStore::remove(const std::string& path) {
+    if (index_) return index_->remove(path);
+    return shardFor(path).remove(path);
+}
 
-    bool ok = sqlite3_step(stmt) == SQLITE_DONE;
-    sqlite3_finalize(stmt);
+bool MetadataStore::forEachEntry(const std::function<bool(const CacheMetadata&)>& fn) {
+    if (index_) {
+        index_->forEach(fn);
+        return true;
+    }
+    bool ok = true, more = true;
+    for (auto& shard : shards_) {
+        ok &= shard->forEach([&](const CacheMetadata& meta) { return more = fn(meta); });
+        if (!more) break;
+    }
     return ok;
 }
 
-bool MetadataStore::remove(const std::string& path) {
-    sqlite3* db = static_cast<sqlite3*>(db_handle_);
-    const char* sql = "DELETE FROM metadata WHERE path=?;";
-    sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) return false;
+bool MetadataStore::commitShards() {
+    bool ok = true;
+    for (auto& shard : shards_) ok &= shard->commit();
+    if (index_) ok &= index_->flush();
+    return ok;
+}
 
-    sqlite3_bind_text(stmt, 1, path.c_str(), -1, SQLITE_TRANSIENT);
+bool MetadataStore::flush() {
+    bool ok = commitShards();
+    return journal_.sync() && ok;
+}
 
-    bool ok = sqlite3_step(stmt) == SQLITE_DONE;
-    sqlite3_finalize(stmt);
-    return ok;
+bool MetadataStore::checkpoint() {
+    {
+        std::lock_guard<std::mutex> c(ckpt_mu_);
+        checkpoint_due_ = false;
+    }
+    bool ok = commitShards();
+    std::lock_guard<std::mutex> w(pageout_mu_);
+    ok &= pageOutLocked();
+    // marks wait for us, so nothing can reach the journal that the
+    // bitmaps written here do not already contain
+    std::lock_guard<std::mutex> g(bitmap_mu_);
+    for (auto& [object, res] : resident_) ok &= writeBack(object, res);
+    // trimmed since pageOutLocked() let go of the lock
+    for (auto& [object, res] : paging_out_) ok &= writeBack(object, res);
+    return ok && journal_.reset();
 }
 
-std::vector<CacheMetadata> MetadataStore::allEntries() {
-    sqlite3* db = static_cast<sqlite3*>(db_handle_);
-    const char* sql =
-        "SELECT path, local_path, size, timestamp, last_accessed, dirty "
-        "FROM metadata;";
-    sqlite3_stmt* stmt;
-    std::vector<CacheMetadata> entries;
+void MetadataStore::checkpointLoop() {
+    std::unique_lock<std::mutex> lk(ckpt_mu_);
+    while (!stop_) {
+        ckpt_cv_.wait(lk, [&] { return stop_ || checkpoint_due_ || pageout_due_; });
+        if (stop_) break;
+        bool full = checkpoint_due_;
+        pageout_due_ = false;
+        lk.unlock();
+        if (full) checkpoint();
+        else pageOut();
+        lk.lock();
+    }
+}
 
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) return entries;
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        CacheMetadata meta;
-        meta.path = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
-        meta.local_path = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
-        meta.size = sqlite3_column_int64(stmt, 2);
-        meta.timestamp = static_cast<std::time_t>(sqlite3_column_int64(stmt, 3));
-        meta.last_accessed = static_cast<std::time_t>(sqlite3_column_int64(stmt, 4));
-        meta.dirty = sqlite3_column_int(stmt, 5) != 0;
-        entries.push_back(meta);
+void MetadataStore::stopCheckpointer() {
+    {
+        std::lock_guard<std::mutex> c(ckpt_mu_);
+        stop_ = true;
     }
-    sqlite3_finalize(stmt);
-    return entries;
+    ckpt_cv_.notify_one();
+    if (checkpointer_.joinable()) checkpointer_.join();
 }
 
 void MetadataStore::cleanup() {
-    if (db_handle_) {
-        const char* sql = "DROP TABLE IF EXISTS metadata;";
-        char* errmsg = nullptr;
-        sqlite3_exec(static_cast<sqlite3*>(db_handle_), sql, nullptr, nullptr, &errmsg);
-        if (errmsg) sqlite3_free(errmsg);
-        sqlite3_close(static_cast<sqlite3*>(db_handle_));
-        db_handle_ = nullptr;
+    stopCheckpointer();
+    for (auto& shard : shards_) shard->drop();
+    if (index_) {
+        index_->clear();
+        index_.reset();
     }
+    journal_.reset();
 }
 
 
-void MetadataStore::markDirtyBlock(const std::string& hash_hex, std::size_t part_idx,std::size_t block_idx) {
-    auto& vec = bitmap_[hash_hex][part_idx];
-    if (vec.size() <= block_idx) vec.resize(block_idx + 1, false);
-    vec[block_idx] = true;
+void MetadataStore::markDirtyBlock(std::uint64_t object, std::size_t part_idx,std::size_t block_idx) {
+    std::lock_guard<std::mutex> g(bitmap_mu_);
+    record(MetadataJournal::Op::Dirty, object, part_idx, block_idx);
 }
 
-bool MetadataStore::flushBitmaps(const std::string& hash_hex) {
-    bool ok = true;
-    auto it = bitmap_.find(hash_hex);
-    if (it == bitmap_.end()) return true;
+void MetadataStore::markCleanBlock(std::uint64_t object, std::size_t part_idx, std::size_t block_idx) {
+    std::lock_guard<std::mutex> g(bitmap_mu_);
+    record(MetadataJournal::Op::Clean, object, part_idx, block_idx);
+}
+
+bool MetadataStore::isBlockDirty(std::uint64_t object, std::size_t part_idx, std::size_t block_idx) {
+    std::lock_guard<std::mutex> g(bitmap_mu_);
+    MappedBitmap* map = dirtyMapFor(object, part_idx, false);
+    return map && map->test(block_idx);
+}
+
+void MetadataStore::markPresentBlock(std::uint64_t object, std::size_t part_idx, std::size_t block_idx) {
+    std::lock_guard<std::mutex> g(bitmap_mu_);
+    record(MetadataJournal::Op::Present, object, part_idx, block_idx);
+}
+
+bool MetadataStore::isBlockPresent(std::uint64_t object, std::size_t part_idx, std::size_t block_idx) {
+    std::lock_guard<std::mutex> g(bitmap_mu_);
+    return presenceFor(object, part_idx).bits.test(static_cast<std::uint32_t>(block_idx));
+}
+
+void MetadataStore::dropBitmaps(std::uint64_t object) {
+    std::lock_guard<std::mutex> g(bitmap_mu_);
+    record(MetadataJournal::Op::Evict, object, 0, 0);
+}
+
+// Caller holds bitmap_mu_. Journals the change only if it did something.
+void MetadataStore::record(MetadataJournal::Op op, std::uint64_t object, std::size_t part_idx, std::size_t block_idx) {
+    MetadataJournal::Record rec;
+    rec.object = object;
+    rec.block  = static_cast<std::uint32_t>(block_idx);
+    rec.part   = static_cast<std::uint16_t>(part_idx);
+    rec.op     = op;
+    if (!apply(rec) || journal_.append(rec) < kCheckpointBytes) return;
+    {
+        std::lock_guard<std::mutex> c(ckpt_mu_);
+        if (checkpoint_due_) return;
+        checkpoint_due_ = true;
+    }
+    ckpt_cv_.notify_one();
+}
+
+// Caller holds bitmap_mu_.
+bool MetadataStore::apply(const MetadataJournal::Record& rec) {
+    const std::uint64_t object = rec.object;
+    switch (rec.op) {
+    case MetadataJournal::Op::Present:
+        return setBit(presenceFor(object, rec.part), rec.block);
+    case MetadataJournal::Op::Dirty: {
+        MappedBitmap* map = dirtyMapFor(object, rec.part);
+        return map && map->set(rec.block);
+    }
+    case MetadataJournal::Op::Clean: {
+        MappedBitmap* map = dirtyMapFor(object, rec.part, false);
+        return map && map->clear(rec.block);
+    }
+    case MetadataJournal::Op::Evict:
+        break;
+    }
+    if (auto it = resident_.find(object); it != resident_.end()) {
+        resident_lru_.erase(it->second.lru);
+        resident_.erase(it);
+    }
+    paging_out_.erase(object);
+    if (writing_ && writing_->count(object)) dropped_while_writing_.insert(object);
+    // normally the object's files are gone already, but not when replaying
+    // an eviction that a crash interrupted
+    removeBitmapFiles(object, true);
+    return true;
+}
+
+void MetadataStore::removeBitmapFiles(std::uint64_t object, bool dirty_maps) {
+    std::error_code ec;
+    const std::string prefix = object_hex(object);
+    for (const auto& entry : fs::directory_iterator(cache_root_ + "/" + shard_dir(object), ec)) {
+        const fs::path& p = entry.path();
+        if (p.filename().string().rfind(prefix, 0) == 0 && ((dirty_maps && p.extension() == ".dmap") || p.extension() == ".pmap"))
+            fs::remove(p, ec);
+    }
+}
+
+bool MetadataStore::flushBitmaps(std::uint64_t object) {
+    std::lock_guard<std::mutex> w(pageout_mu_);
+    std::lock_guard<std::mutex> g(bitmap_mu_);
+    if (auto it = resident_.find(object); it != resident_.end()) return writeBack(object, it->second);
+    if (auto it = paging_out_.find(object); it != paging_out_.end()) return writeBack(object, it->second);
+    return true;
+}
+
+void MetadataStore::setBitmapResidency(std::size_t objects) {
+    std::lock_guard<std::mutex> g(bitmap_mu_);
+    max_resident_ = std::max<std::size_t>(objects, 1);
+    trimResident();
+}
+
+std::size_t MetadataStore::residentObjects() {
+    std::lock_guard<std::mutex> g(bitmap_mu_);
+    return resident_.size();
+}
+
+MetadataStore::ResidentObject& MetadataStore::residentFor(std::uint64_t object) {
+    auto [it, added] = resident_.try_emplace(object);
+    if (!added) {
+        resident_lru_.splice(resident_lru_.begin(), resident_lru_, it->second.lru);
+        return it->second;
+    }
+    if (auto out = paging_out_.find(object); out != paging_out_.end()) {
+        it->second = std::move(out->second);
+        paging_out_.erase(out);
+    }
+    resident_lru_.push_front(object);
+    it->second.lru = resident_lru_.begin();
+    // the new object is at the front, so trimming never drops it
+    trimResident();
+    return it->second;
+}
+
+void MetadataStore::trimResident() {
+    if (resident_.size() <= max_resident_) return;
+    while (resident_.size() > max_resident_) {
+        auto it = resident_.find(resident_lru_.back());
+        paging_out_[it->first] = std::move(it->second);
+        resident_lru_.pop_back();
+        resident_.erase(it);
+    }
+    {
+        std::lock_guard<std::mutex> c(ckpt_mu_);
+        pageout_due_ = true;
+    }
+    ckpt_cv_.notify_one();
+}
+
+bool MetadataStore::pageOut() {
+    std::lock_guard<std::mutex> w(pageout_mu_);
+    return pageOutLocked();
+}
+
+bool MetadataStore::pageOutLocked() {
+    std::unordered_map<std::uint64_t, ResidentObject> batch;
+    {
+        std::lock_guard<std::mutex> g(bitmap_mu_);
+        if (paging_out_.empty()) return true;
+        batch.swap(paging_out_);
+        writing_ = &batch;
+    }
+    std::vector<std::uint64_t> failed;
+    for (auto& [object, res] : batch) {
+        if (!writeBack(object, res)) failed.push_back(object);
+    }
 
-    for (auto& [part_idx, bits] : it->second) {
-        ok &= persistBitmap(hash_hex, part_idx, bits);
+    // batch is destroyed, unmapping its dirty maps, after the lock is let go
+    std::lock_guard<std::mutex> g(bitmap_mu_);
+    writing_ = nullptr;
+    for (std::uint64_t object : dropped_while_writing_) {
+        // a dirty map opened since the drop is a new file and stays
+        bool reused = resident_.count(object) || paging_out_.count(object);
+        removeBitmapFiles(object, !reused);
+    }
+    for (std::uint64_t object : failed) {
+        std::cerr << "Failed to write back bitmaps of " << object_hex(object) << '\n';
+        if (dropped_while_writing_.count(object)) continue;
+        ResidentObject& victim = batch[object];
+        ResidentObject* again = nullptr;
+        if (auto it = resident_.find(object); it != resident_.end()) again = &it->second;
+        else if (auto out = paging_out_.find(object); out != paging_out_.end()) again = &out->second;
+        if (again) {
+            // paged in again since; parts it has not loaded keep our bits
+            for (auto& [part_idx, file] : victim.presence) again->presence.try_emplace(part_idx, std::move(file));
+            continue;
+        }
+        ResidentObject& res = resident_[object];
+        res = std::move(victim);
+        resident_lru_.push_back(object);
+        res.lru = std::prev(resident_lru_.end());
     }
+    dropped_while_writing_.clear();
+    return failed.empty();
+}
+
+// Caller holds bitmap_mu_.
+bool MetadataStore::writeBack(std::uint64_t object, ResidentObject& res) {
+    bool ok = true;
+    for (auto& [_, map] : res.dirty) ok &= map->flush();
+    for (auto& [part_idx, file] : res.presence)
+        ok &= persistBitmap(presence_path(cache_root_, object, part_idx), file);
     return ok;
 }
 
+// Caller holds bitmap_mu_. Loads the file on first use.
+MetadataStore::BitmapFile& MetadataStore::presenceFor(std::uint64_t object, std::size_t part_idx) {
+    auto& parts = residentFor(object).presence;
+    auto it = parts.find(part_idx);
+    if (it != parts.end()) return it->second;
+    BitmapFile& file = parts[part_idx];
+    if (writing_) {
+        if (dropped_while_writing_.count(object)) return file;
+        auto w = writing_->find(object);
+        if (w != writing_->end()) {
+            auto old = w->second.presence.find(part_idx);
+            if (old != w->second.presence.end()) {
+                // its file may not have these bits yet, so every page goes again
+                file.bits = old->second.bits;
+                std::uint64_t pages = ((file.bits.extent() + 7) / 8 + kBitmapPageBytes - 1) / kBitmapPageBytes;
+                for (std::uint64_t p = 0; p < pages; ++p) file.dirty_pages.set(static_cast<std::uint32_t>(p));
+                return file;
+            }
+        }
+    }
+    loadBitmap(presence_path(cache_root_, object, part_idx), file);
+    return file;
+}
 
-bool MetadataStore::loadBitmap(const std::string& hash_hex, std::size_t part_idx) {
-    std::string path = bitmap_path(cache_root_, hash_hex, part_idx);
-    if (!fs::exists(path)) return true;
+// Caller holds bitmap_mu_. Maps the file on first use; nullptr if that fails.
+// Lookups pass create = false, so probing an object with no dirty blocks
+// leaves no empty map behind; nullptr then also means all clean.
+MappedBitmap* MetadataStore::dirtyMapFor(std::uint64_t object, std::size_t part_idx, bool create) {
+    auto& parts = residentFor(object).dirty;
+    auto& map = parts[part_idx];
+    if (map) return map.get();
+    std::string path = bitmap_path(cache_root_, object, part_idx);
+    auto opened = std::make_unique<MappedBitmap>(path);
+    bool ok = create ? open_in_dir(path, [&] { return opened->open(); }) : opened->open(false);
+    if (!ok) {
+        if (create || errno != ENOENT) std::cerr << "Failed to map dirty bitmap " << path << '\n';
+        parts.erase(part_idx);
+        return nullptr;
+    }
+    map = std::move(opened);
+    return map.get();
+}
 
+bool MetadataStore::setBit(BitmapFile& file, std::size_t block_idx) {
+    if (!file.bits.set(static_cast<std::uint32_t>(block_idx))) return false;
+    file.dirty_pages.set(static_cast<std::uint32_t>(block_idx / 8 / kBitmapPageBytes));
+    return true;
+}
+
+
+bool MetadataStore::loadBitmap(const std::string& path, BitmapFile& file) {
     int fd = ::open(path.c_str(), O_RDONLY);
-    if (fd < 0) return false;
+    if (fd < 0) return errno == ENOENT;
 
-    std::vector<uint8_t> bytes((fs::file_size(path) + 7) / 8);
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+    std::vector<uint8_t> bytes(static_cast<std::size_t>(st.st_size));
     ssize_t n = ::pread(fd, bytes.data(), bytes.size(), 0);
     ::close(fd);
     if (n < 0) return false;
 
-    auto& vec = bitmap_[hash_hex][part_idx];
-    vec.resize(bytes.size() * 8, false);
-    for (std::size_t i = 0; i < bytes.size(); ++i) {
-        for (int b = 0; b < 8; ++b) {
-            vec[i * 8 + b] = bytes[i] & (1u << b);
-        }
-    }
+    file.bits.load_bytes(bytes.data(), static_cast<std::size_t>(n));
+    file.persisted_bytes = static_cast<std::uint64_t>(n);
     return true;
 }
 
-bool MetadataStore::persistBitmap(const std::string& hash_hex, std::size_t part_idx, const BitVec& bits) {
-    if (bits.empty()) return true;
+// Writes only the pages marked in dirty_pages, unless the file lost data
+// behind our back (deleted with its object), in which case all pages go.
+bool MetadataStore::persistBitmap(const std::string& path, BitmapFile& file) {
+    if (file.bits.empty() && file.persisted_bytes == 0) return true;
 
-    std::string path = bitmap_path(cache_root_, hash_hex, part_idx);
-    fs::create_directories(fs::path(path).parent_path());
-    std::vector<uint8_t> bytes((bits.size() + 7) / 8, 0);
-    for (std::size_t i = 0; i < bits.size(); ++i) {
-        if (bits[i]) bytes[i / 8] |= (1u << (i % 8));
-    }
+    int fd = -1;
+    if (!open_in_dir(path, [&] { return (fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644)) >= 0; })) return false;
 
-    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
-    if (fd < 0) return false;
+    struct stat st;
+    std::uint64_t on_disk = ::fstat(fd, &st) == 0 ? static_cast<std::uint64_t>(st.st_size) : 0;
+    std::uint64_t bytes = (file.bits.extent() + 7) / 8;
+    std::uint64_t pages = (bytes + kBitmapPageBytes - 1) / kBitmapPageBytes;
+    if (on_disk < std::min(file.persisted_bytes, bytes)) {
+        for (std::uint64_t p = 0; p < pages; ++p) file.dirty_pages.set(static_cast<std::uint32_t>(p));
+    }
 
-    ssize_t n = ::write(fd, bytes.data(), bytes.size());
+    bool ok = true, wrote = false;
+    std::uint8_t page[kBitmapPageBytes];
+    for (std::uint64_t p = file.dirty_pages.next_set(0); p != BlockBitmap::kNone; p = file.dirty_pages.next_set(p + 1)) {
+        std::uint64_t off = p * kBitmapPageBytes;
+        if (off >= bytes) break;
+        std::size_t len = static_cast<std::size_t>(std::min<std::uint64_t>(kBitmapPageBytes, bytes - off));
+        file.bits.copy_bytes(off, page, len);
+        ok &= ::pwrite(fd, page, len, static_cast<off_t>(off)) == static_cast<ssize_t>(len);
+        wrote = true;
+    }
+    // a checkpoint truncates the journal right after this
+    if (wrote) ok &= ::fdatasync(fd) == 0;
     ::close(fd);
-    return n == static_cast<ssize_t>(bytes.size());
+    if (ok) {
+        file.dirty_pages.reset();
+        file.persisted_bytes = std::max(on_disk, bytes);
+    }
+    return ok;
 }
@@ -2,56 +2,189 @@
 #define CACHE_METADATA_STORE_H
 
 
+#include <condition_variable>
 #include <cstddef>
 #include <cstdint>
 #include <ctime>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
-struct CacheMetadata {
-std::string path;
-std::string local_path;
-std::size_t size = 0;
-std::time_t timestamp = 0;
-std::time_t last_accessed = 0;
-bool        dirty = false;
-};
+#include "block_bitmap.h"
+#include "hash_index.h"
+#include "mapped_bitmap.h"
+#include "metadata_journal.h"
+#include "metadata_shard.h"
 
 
 class MetadataStore {
 public:
 
-MetadataStore(const std::string& db_path, const std::string& cache_root);
+using SyncLevel = MetadataShard::SyncLevel;
+
+// Where the metadata rows live. Sqlite is the cache_meta.db table; Index
+// keeps them in an mmapped hash table (hash_index.h) at db_path, which
+// answers lookups in nanoseconds but only reaches the disk on flush() or
+// checkpoint(). Bitmaps and the journal are the same for both.
+enum class Backend { Sqlite, Index };
+
+// With Backend::Sqlite the rows are spread over shards database files by
+// a hash of their path, each with its own connection and writer (see
+// metadata_shard.h). One shard uses db_path itself; more use db_path.0,
+// db_path.1, ... The count cannot change for an existing database.
+// The shards key their queues and cached rows by the path's id in paths,
+// which the caller shares so each path is interned once; without one the
+// store keeps its own.
+MetadataStore(const std::string& db_path, const std::string& cache_root, SyncLevel sync = SyncLevel::Normal,
+              Backend backend = Backend::Sqlite, std::size_t shards = 1, PathTable* paths = nullptr);
 ~MetadataStore();
 
 bool init();
 
+// On SQLite, put, updateAccessTime, markDirty and remove only queue the
+// change in the path's shard, which group-commits it. get() sees queued
+// changes. With Backend::Index the changes go straight into the mapped
+// table and nothing is queued.
 std::optional<CacheMetadata> get(const std::string& path);
 bool put(const CacheMetadata& meta);
 bool updateAccessTime(const std::string& path, std::time_t last_accessed);
 bool markDirty(const std::string& path, bool dirty);
 bool remove(const std::string& path);
-std::vector<CacheMetadata> allEntries();
+// Calls fn on every row, one shard after another, until it returns false.
+// Rows are streamed, never collected. fn must not call back into the store.
+bool forEachEntry(const std::function<bool(const CacheMetadata&)>& fn);
+// Commits everything queued so far and syncs the journal before returning.
+bool flush();
 void cleanup();
 
-void markDirtyBlock(const std::string& hash_hex, std::size_t part_idx, std::size_t block_idx);
-
-bool flushBitmaps(const std::string& hash_hex);
+// Every bitmap change is also appended to the journal, which is fsynced in
+// groups every MetadataJournal::kSyncInterval. Once it passes
+// kCheckpointBytes a background thread checkpoints: all bitmaps and queued rows are
+// written back and the journal starts over. init() replays the journal
+// left by a crash, so recovery only reads what changed since the last
+// checkpoint.
+
+// Bitmaps are keyed by the 64-bit object id that also names the object's
+// block files.
+
+// Dirty maps are mmapped .dmap files updated in place.
+void markDirtyBlock(std::uint64_t object, std::size_t part_idx, std::size_t block_idx);
+void markCleanBlock(std::uint64_t object, std::size_t part_idx, std::size_t block_idx);
+bool isBlockDirty(std::uint64_t object, std::size_t part_idx, std::size_t block_idx);
+
+// Presence maps record which blocks of a part hold fetched data, so holes in
+// a sparse .blk file and short final blocks are told apart from misses.
+void markPresentBlock(std::uint64_t object, std::size_t part_idx, std::size_t block_idx);
+bool isBlockPresent(std::uint64_t object, std::size_t part_idx, std::size_t block_idx);
+// Forgets the dirty and presence maps of an object whose files were deleted.
+void dropBitmaps(std::uint64_t object);
+
+// Writes back the 4 KiB pages of the dirty and presence maps that changed
+// since the last flush.
+bool flushBitmaps(std::uint64_t object);
+// Writes back every bitmap and queued row, then truncates the journal.
+bool checkpoint();
+
+// Bitmaps are paged in when an object is first used and kept in memory for
+// at most this many objects (kDefaultResidentObjects unless set); the least
+// recently used object's maps are dropped to make room and written back by
+// the checkpoint thread, outside the bitmap lock.
+void setBitmapResidency(std::size_t objects);
+std::size_t residentObjects();
 
 private:
-std::string db_path_;
-void*       db_handle_ = nullptr;
-std::string cache_root_;
+static constexpr std::uint64_t kCheckpointBytes   = 4 * 1024 * 1024;
+static constexpr std::size_t kDefaultResidentObjects = 4096;
 
+MetadataShard& shardFor(const std::string& path);
+bool commitShards();
+bool openJournal();
+void checkpointLoop();
+void stopCheckpointer();
 
-using BitVec = std::vector<bool>;
-std::unordered_map<std::string, std::unordered_map<std::size_t, BitVec>> bitmap_;
+std::string db_path_;
+std::string cache_root_;
+// set when no table was passed in
+std::unique_ptr<PathTable> own_paths_;
+std::vector<std::unique_ptr<MetadataShard>> shards_;
+// set for Backend::Index, in which case there are no shards
+std::unique_ptr<HashIndex> index_;
+
+std::mutex  ckpt_mu_;
+std::condition_variable ckpt_cv_;
+bool        checkpoint_due_ = false;
+bool        pageout_due_ = false;
+bool        stop_ = false;
+std::thread checkpointer_;
+
+static constexpr std::size_t kBitmapPageBytes = 4096;
+
+// One .pmap file: the bits, which pages of the file image changed
+// since the last flush, and how many bytes the file is known to hold.
+struct BitmapFile {
+    BlockBitmap   bits;
+    BlockBitmap   dirty_pages;
+    std::uint64_t persisted_bytes = 0;
+};
 
+// The maps of one object that are in memory, and its place in the LRU.
+struct ResidentObject {
+    std::unordered_map<std::size_t, std::unique_ptr<MappedBitmap>> dirty;
+    std::unordered_map<std::size_t, BitmapFile> presence;
+    std::list<std::uint64_t>::iterator lru;
+};
 
-bool loadBitmap(const std::string& hash_hex, std::size_t part_idx);
-bool persistBitmap(const std::string& hash_hex, std::size_t part_idx, const BitVec& bits);
+// Caller holds bitmap_mu_. Marks the object most recently used, paging it
+// in, and trims the least recently used ones down to the bound.
+ResidentObject& residentFor(std::uint64_t object);
+bool writeBack(std::uint64_t object, ResidentObject& res);
+// Caller holds bitmap_mu_. Moves the least recently used objects past the
+// bound to paging_out_ and wakes the checkpointer.
+void trimResident();
+// Writes back what trimResident queued, holding bitmap_mu_ only to take
+// the batch and to settle it afterwards. An object that fails goes back to
+// resident_, so its bits are not lost.
+bool pageOut();
+// Caller holds pageout_mu_.
+bool pageOutLocked();
+void removeBitmapFiles(std::uint64_t object, bool dirty_maps);
+
+BitmapFile& presenceFor(std::uint64_t object, std::size_t part_idx);
+bool setBit(BitmapFile& file, std::size_t block_idx);
+MappedBitmap* dirtyMapFor(std::uint64_t object, std::size_t part_idx, bool create = true);
+// Applies one change to the bitmaps; true if a bit actually changed.
+bool apply(const MetadataJournal::Record& rec);
+void record(MetadataJournal::Op op, std::uint64_t object, std::size_t part_idx, std::size_t block_idx);
+
+bool loadBitmap(const std::string& path, BitmapFile& file);
+bool persistBitmap(const std::string& path, BitmapFile& file);
+
+// Guards the bitmaps, which are used without the database lock.
+std::mutex bitmap_mu_;
+std::unordered_map<std::uint64_t, ResidentObject> resident_;
+// most recently used first
+std::list<std::uint64_t> resident_lru_;
+// Objects trimmed from resident_ and not written back yet. One used again
+// before pageOut() takes it is moved back as it is.
+std::unordered_map<std::uint64_t, ResidentObject> paging_out_;
+// The batch pageOut() is writing back, if any. Presence maps paged in
+// meanwhile copy its bits, which their files may not hold yet.
+const std::unordered_map<std::uint64_t, ResidentObject>* writing_ = nullptr;
+// objects of that batch dropped while it is written, whose files it may
+// recreate
+std::unordered_set<std::uint64_t> dropped_while_writing_;
+// Serialises writing presence maps back: pageOut(), checkpoint() and
+// flushBitmaps(). Taken before bitmap_mu_.
+std::mutex pageout_mu_;
+std::size_t max_resident_ = kDefaultResidentObjects;
+MetadataJournal journal_;
 
 MetadataStore(const MetadataStore&) = delete;
 MetadataStore& operator=(const MetadataStore&) = delete;
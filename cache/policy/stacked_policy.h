@@ -0,0 +1,65 @@
+#ifndef CACHE_POLICY_STACKED_POLICY_H
+#define CACHE_POLICY_STACKED_POLICY_H
+
+#include "eviction_policy.h"
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// Runs two policies over the same blocks. Victims come from First while it
+// has any (e.g. expired TTL entries) and from Second otherwise; a victim
+// chosen by one is dropped from the other.
+template <class First, class Second>
+class StackedPolicy {
+    static_assert(eviction::is_policy<First>::value,  "First is not an eviction policy");
+    static_assert(eviction::is_policy<Second>::value, "Second is not an eviction policy");
+
+public:
+    template <class A, class B>
+    StackedPolicy(A&& firstArg, B&& secondArg)
+    : first_(std::forward<A>(firstArg)), second_(std::forward<B>(secondArg)) {}
+
+    // A block displaced by one policy is dropped from the other. Only one
+    // of the two is expected to be bounded; Second's victim wins if both are.
+    std::size_t touch(std::size_t blockId, std::size_t bytes, double hotness, double cost = 1.0) {
+        std::size_t first = eviction::touch(first_, blockId, bytes, hotness, cost);
+        if (first != eviction::kNoVictim) second_.remove(first);
+        std::size_t second = eviction::touch(second_, blockId, bytes, hotness, cost);
+        if (second != eviction::kNoVictim) first_.remove(second);
+        return second != eviction::kNoVictim ? second : first;
+    }
+
+    void remove(std::size_t blockId) {
+        first_.remove(blockId);
+        second_.remove(blockId);
+    }
+
+    std::size_t evict() {
+        std::size_t victim = first_.evict();
+        if (victim != eviction::kNoVictim) {
+            second_.remove(victim);
+            return victim;
+        }
+        victim = second_.evict();
+        if (victim != eviction::kNoVictim) first_.remove(victim);
+        return victim;
+    }
+
+    template <class F = First>
+    auto expire(std::vector<std::size_t>& out) -> decltype(std::declval<F&>().expire(out)) {
+        std::size_t start = out.size();
+        auto n = first_.expire(out);
+        for (std::size_t i = start; i < out.size(); ++i) second_.remove(out[i]);
+        return n;
+    }
+
+private:
+    First  first_;
+    Second second_;
+
+    StackedPolicy(const StackedPolicy&)            = delete;
+    StackedPolicy& operator=(const StackedPolicy&) = delete;
+};
+
+#endif
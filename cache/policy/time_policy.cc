@@ -1,28 +1,137 @@
 #include "time_policy.h"
 
 TimePolicy::TimePolicy(long ttlSeconds)
-    : ttlSeconds_(ttlSeconds) {}
+    : ttlSeconds_(ttlSeconds < 0 ? 0 : ttlSeconds), start_(Clock::now()), heads_(kExpired + 1, kNil) {}
 
-void TimePolicy::touch(size_t blockId) {
-    timestamps_[blockId] = Clock::now();
+std::uint64_t TimePolicy::now_tick() const {
+    return std::chrono::duration_cast<std::chrono::seconds>(Clock::now() - start_).count();
+}
+
+size_t TimePolicy::touch(size_t blockId, size_t, double) {
+    advance(now_tick());
+
+    std::uint32_t n;
+    auto it = index_.find(blockId);
+    if (it != index_.end()) {
+        n = it->second;
+        unlink(n);
+    } else {
+        if (free_.empty()) {
+            n = static_cast<std::uint32_t>(nodes_.size());
+            nodes_.emplace_back();
+        } else {
+            n = free_.back();
+            free_.pop_back();
+        }
+        nodes_[n].id = blockId;
+        index_.emplace(blockId, n);
+    }
+    nodes_[n].deadline = current_ + ttlSeconds_;
+    place(n);
+    return SIZE_MAX;
 }
 
 void TimePolicy::remove(size_t blockId) {
-    timestamps_.erase(blockId);
+    auto it = index_.find(blockId);
+    if (it == index_.end()) return;
+    unlink(it->second);
+    release(it->second);
+    index_.erase(it);
 }
 
 size_t TimePolicy::evict() {
-    auto now = Clock::now();
-    size_t victim = SIZE_MAX;
-    for (auto& [blockId, ts] : timestamps_) {
-        auto age = std::chrono::duration_cast<std::chrono::seconds>(now - ts).count();
-        if (age >= ttlSeconds_) {
-            victim = blockId;
-            break;
+    advance(now_tick());
+    std::uint32_t n = heads_[kExpired];
+    if (n == kNil) return SIZE_MAX;
+
+    size_t victim = nodes_[n].id;
+    unlink(n);
+    release(n);
+    index_.erase(victim);
+    return victim;
+}
+
+size_t TimePolicy::expire(std::vector<size_t>& out) {
+    advance(now_tick());
+    size_t count = 0;
+    for (std::uint32_t n = heads_[kExpired]; n != kNil;) {
+        std::uint32_t next = nodes_[n].next;
+        out.push_back(nodes_[n].id);
+        index_.erase(nodes_[n].id);
+        release(n);
+        n = next;
+        ++count;
+    }
+    heads_[kExpired] = kNil;
+    return count;
+}
+
+// Picks the coarsest level whose slot still distinguishes the deadline from
+// the current tick; anything already due goes straight to the expired list.
+void TimePolicy::place(std::uint32_t n) {
+    std::uint64_t deadline = nodes_[n].deadline;
+    if (deadline <= current_) {
+        link(n, kExpired);
+        return;
+    }
+    std::uint64_t delta = deadline - current_;
+    for (std::size_t level = 0; level < kLevels; ++level) {
+        if (delta < (std::uint64_t{1} << (kSlotBits * (level + 1))) || level + 1 == kLevels) {
+            std::uint64_t slot = (deadline >> (kSlotBits * level)) & (kSlots - 1);
+            link(n, static_cast<std::uint32_t>(level * kSlots + slot));
+            return;
         }
     }
-    if (victim != SIZE_MAX) {
-        timestamps_.erase(victim);
+}
+
+void TimePolicy::advance(std::uint64_t tick) {
+    while (current_ < tick) {
+        ++current_;
+
+        // When a lower level wraps, pull the next slot of the level above
+        // down so its entries land in finer slots.
+        for (std::size_t level = 1; level < kLevels; ++level) {
+            if ((current_ & ((std::uint64_t{1} << (kSlotBits * level)) - 1)) != 0) break;
+            std::uint32_t bucket = static_cast<std::uint32_t>(
+                level * kSlots + ((current_ >> (kSlotBits * level)) & (kSlots - 1)));
+            std::uint32_t n = heads_[bucket];
+            heads_[bucket] = kNil;
+            while (n != kNil) {
+                std::uint32_t next = nodes_[n].next;
+                place(n);
+                n = next;
+            }
+        }
+
+        std::uint32_t bucket = static_cast<std::uint32_t>(current_ & (kSlots - 1));
+        std::uint32_t n = heads_[bucket];
+        heads_[bucket] = kNil;
+        while (n != kNil) {
+            std::uint32_t next = nodes_[n].next;
+            link(n, kExpired);
+            n = next;
+        }
     }
-    return victim;
+}
+
+void TimePolicy::link(std::uint32_t n, std::uint32_t bucket) {
+    Node& node  = nodes_[n];
+    node.bucket = bucket;
+    node.prev   = kNil;
+    node.next   = heads_[bucket];
+    if (node.next != kNil) nodes_[node.next].prev = n;
+    heads_[bucket] = n;
+}
+
+void TimePolicy::unlink(std::uint32_t n) {
+    Node& node = nodes_[n];
+    if (node.prev != kNil) nodes_[node.prev].next = node.next;
+    else                   heads_[node.bucket]    = node.next;
+    if (node.next != kNil) nodes_[node.next].prev = node.prev;
+    node.prev = node.next = node.bucket = kNil;
+}
+
+void TimePolicy::release(std::uint32_t n) {
+    nodes_[n] = Node{};
+    free_.push_back(n);
 }
@@ -2,24 +2,61 @@
 #define TIME_POLICY_H
 
 #include <cstddef>
+#include <cstdint>
 #include <chrono>
 #include <unordered_map>
+#include <vector>
 
+// TTL expiry on a hierarchical timing wheel (kLevels x kSlots, one-second
+// ticks). touch/remove are O(1); advancing a tick cascades at most one slot
+// per level and moves everything due in that slot to the expired list.
 class TimePolicy {
 public:
     using Clock = std::chrono::steady_clock;
 
     TimePolicy(long ttlSeconds);
 
-    void touch(size_t blockId);
+    // Unbounded, so never displaces a block.
+    size_t touch(size_t blockId, size_t bytes = 0, double hotness = 1.0);
 
     void remove(size_t blockId);
 
     size_t evict();
 
+    // Appends every entry whose TTL has passed to out and drops it from the
+    // policy. Returns the number of entries appended.
+    size_t expire(std::vector<size_t>& out);
+
 private:
+    static constexpr unsigned    kSlotBits = 6;
+    static constexpr std::size_t kSlots    = std::size_t{1} << kSlotBits;
+    static constexpr std::size_t kLevels   = 4;
+    static constexpr std::uint32_t kNil    = UINT32_MAX;
+    static constexpr std::uint32_t kExpired = kLevels * kSlots;
+
+    struct Node {
+        size_t        id       = 0;
+        std::uint64_t deadline = 0;
+        std::uint32_t prev     = kNil;
+        std::uint32_t next     = kNil;
+        std::uint32_t bucket   = kNil;
+    };
+
+    std::uint64_t now_tick() const;
+    void advance(std::uint64_t tick);
+    void place(std::uint32_t n);
+    void link(std::uint32_t n, std::uint32_t bucket);
+    void unlink(std::uint32_t n);
+    void release(std::uint32_t n);
+
     long ttlSeconds_;
-    std::unordered_map<size_t, Clock::time_point> timestamps_;
+    Clock::time_point start_;
+    std::uint64_t current_ = 0;
+    std::vector<Node> nodes_;
+    std::vector<std::uint32_t> free_;
+    // one list head per wheel slot, plus the expired list at kExpired
+    std::vector<std::uint32_t> heads_;
+    std::unordered_map<size_t, std::uint32_t> index_;
 };
 
-#endif
\ No newline at end of file
+#endif
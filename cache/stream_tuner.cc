@@ -0,0 +1,54 @@
+#include "stream_tuner.h"
+
+#include <algorithm>
+
+StreamTuner::StreamTuner(std::size_t min_streams, std::size_t max_streams, std::size_t initial)
+: min_(std::max<std::size_t>(min_streams, 1)),
+  max_(std::max(max_streams, min_)),
+  streams_(std::clamp(initial, min_, max_)) {}
+
+void StreamTuner::record(std::size_t bytes, double seconds) {
+    if (seconds <= 0) return;
+    round_bytes_   += bytes;
+    round_seconds_ += seconds;
+    if (++round_chunks_ < streams_) return;
+    double rate = round_bytes_ / round_seconds_;
+    round_chunks_  = 0;
+    round_bytes_   = 0;
+    round_seconds_ = 0;
+    endRound(rate);
+}
+
+void StreamTuner::probe(std::size_t streams, double rate) {
+    probe_from_ = streams_;
+    probe_rate_ = rate;
+    streams_    = streams;
+}
+
+void StreamTuner::endRound(double rate) {
+    last_rate_ = rate;
+    if (probe_from_ != 0) {
+        double before = probe_rate_ * probe_from_;
+        double now    = rate * streams_;
+        bool   up     = streams_ > probe_from_;
+        bool   keep   = up ? now >= before * (1 + kMinGain) : now >= before * (1 - kMinGain);
+        if (!keep) {
+            streams_ = probe_from_;
+            ramping_ = false;
+        }
+        probe_from_ = 0;
+        // an added stream that paid off is followed by another
+        if (keep && up && streams_ < max_) {
+            probe(std::min(max_, ramping_ ? streams_ * 2 : streams_ + 1), rate);
+            return;
+        }
+        hold_ = kHoldRounds;
+        return;
+    }
+    if (hold_ > 0 && --hold_ > 0) return;
+
+    bool up = (next_up_ && streams_ < max_) || streams_ <= min_;
+    if (up && streams_ >= max_) return;
+    next_up_ = !up;
+    probe(up ? std::min(max_, ramping_ ? streams_ * 2 : streams_ + 1) : streams_ - 1, rate);
+}
@@ -0,0 +1,51 @@
+#ifndef CACHE_STREAM_TUNER_H
+#define CACHE_STREAM_TUNER_H
+
+#include <cstddef>
+
+// Picks how many parallel range streams a bulk download runs from the rate
+// each stream gets. Every finished chunk reports its bytes and seconds; a
+// round ends once as many chunks as there are streams have finished, and
+// its per-stream rate times the stream count is the round's throughput.
+//
+// The count climbs by probing: a round at a new count is kept if it moved
+// throughput the right way, more than kMinGain for an added stream and no
+// more than kMinGain lost for a removed one, and undone otherwise. Counts
+// double while every probe pays off and move by one after the first miss.
+// A kept count holds for kHoldRounds rounds before the next probe, which
+// alternates between one more stream and one fewer, so the count follows a
+// link that gets faster or slower.
+class StreamTuner {
+public:
+    static constexpr double      kMinGain    = 0.10;
+    static constexpr std::size_t kHoldRounds = 8;
+
+    StreamTuner(std::size_t min_streams, std::size_t max_streams, std::size_t initial);
+
+    void record(std::size_t bytes, double seconds);
+
+    std::size_t streams() const { return streams_; }
+    // Bytes per second of one stream in the last complete round, 0 before.
+    double perStreamRate() const { return last_rate_; }
+
+private:
+    void endRound(double rate);
+    void probe(std::size_t streams, double rate);
+
+    std::size_t min_;
+    std::size_t max_;
+    std::size_t streams_;
+    bool        ramping_ = true;
+
+    std::size_t round_chunks_  = 0;
+    double      round_bytes_   = 0;
+    double      round_seconds_ = 0;
+    double      last_rate_     = 0;
+
+    std::size_t probe_from_ = 0;     // count before the probe in flight, 0 if none
+    double      probe_rate_ = 0;     // per-stream rate at probe_from_
+    std::size_t hold_       = 0;
+    bool        next_up_    = true;
+};
+
+#endif
@@ -123,7 +123,7 @@ static void findJsonNames(const string &json, set<string> &out) {
 
 }
 
-static bool getFileInfo(const char* path, bool &isDirectory, off_t &size) {
+static bool getFileInfo(const char* path, bool &isDirectory, off_t &size, time_t &mtime) {
 
     vector<char> buf(1024);
     string filePath = string("/info") + path;
@@ -157,6 +157,20 @@ static bool getFileInfo(const char* path, bool &isDirectory, off_t &size) {
         }
     }
 
+    // parse modification time
+    mtime = 0;
+    if (auto pos = json.find("\"mtime\""); pos != std::string::npos) {
+        pos = json.find(':', pos);
+        if (pos != std::string::npos) {
+            // skip to the first digit after the colon
+            pos = json.find_first_of("0123456789", pos);
+            if (pos != std::string::npos) {
+                // strtoll stops at the first non-digit
+                mtime = (time_t)strtoll(json.c_str() + pos, nullptr, 10);
+            }
+        }
+    }
+
     // check if there is a directory
     isDirectory = false;
     if (auto pos = json.find("\"is_directory\""); pos != -1) {
@@ -194,19 +208,30 @@ static int getAttribute(const char* path, struct stat* stbuf, struct fuse_file_i
     }
     // if looking at http directory
     if (httpMode) {
-        bool isDirectory;
-        off_t fsize;
-        if (!getFileInfo(path, isDirectory, fsize))
-            // return error if file info is not found
-            return -1;
-        if (isDirectory) {
+        cache_attr attr;
+        // answer from the metadata cache while the entry is fresh
+        if (cache_get_attr(path, &attr) != 0) {
+            bool isDirectory;
+            off_t fsize;
+            time_t mtime;
+            if (!getFileInfo(path, isDirectory, fsize, mtime))
+                // return error if file info is not found
+                return -1;
+            attr.size = fsize;
+            attr.mtime = mtime;
+            attr.is_dir = isDirectory;
+            // remember the origin's answer for the next getattr
+            cache_put_attr(path, &attr);
+        }
+        if (attr.is_dir) {
             stbuf->st_mode = S_IFDIR | 0755;
             stbuf->st_nlink = 2;
         } else {
             stbuf->st_mode = S_IFREG | 0644;
             stbuf->st_nlink = 1;
-            stbuf->st_size = fsize;
+            stbuf->st_size = attr.size;
         }
+        stbuf->st_mtime = attr.mtime;
         return 0;
     }
     // check if the file has been cached
@@ -410,6 +435,8 @@ static int writeFile(const char* path, const char* buf, size_t sz, off_t off, st
     if (numBytes < 0) {
         return -1;
     } else {
+        // the upload went around the cache, so its blocks and size are stale
+        cache_invalidate(path);
         return (int)numBytes;
     }
 
@@ -417,7 +444,7 @@ static int writeFile(const char* path, const char* buf, size_t sz, off_t off, st
 
 static int releaseFiles(const char*, struct fuse_file_info*) {
 
-    // cleans files that are no longer used
+    // wakes the background evictor, close() never waits on eviction
     cache_apply_eviction();
     return 0;
 
@@ -438,11 +465,49 @@ int main(int argc, char* argv[]) {
 
     // path must have been correct
     cacheDirectory = realPath;
+    // eviction policy is picked at mount time (lru, clock, gdsf, or ttl+ any of them)
+    const char* policy = getenv("CACHE_POLICY");
+    // metadata rows live in SQLite unless CACHE_METADATA=index picks the mmapped hash table
+    if (const char* metadata = getenv("CACHE_METADATA")) {
+        if (cache_set_metadata_backend(metadata) != 0) {
+            fprintf(stderr, "unknown CACHE_METADATA backend %s\n", metadata);
+            return -1;
+        }
+    }
+    // optional number of SQLite metadata shards; an existing cache must be reopened with the same count
+    if (const char* shards = getenv("CACHE_METADATA_SHARDS")) {
+        if (cache_set_metadata_shards(strtoull(shards, nullptr, 10)) != 0) {
+            fprintf(stderr, "invalid CACHE_METADATA_SHARDS %s\n", shards);
+            return -1;
+        }
+    }
     // timeout cache at 60
-    if (cache_init(cacheDirectory.c_str(), 60) != 0) {
+    if (cache_init_policy(cacheDirectory.c_str(), 60, policy ? policy : "lru") != 0) {
         fprintf(stderr, "cache_init failed\n");
         return -1;
     }
+    // optional cache size in megabytes, background eviction keeps usage below it
+    if (const char* capacity = getenv("CACHE_CAPACITY_MB")) {
+        cache_set_capacity(strtoull(capacity, nullptr, 10) * 1024ULL * 1024ULL);
+    }
+    // optional per-prefix quotas, e.g. CACHE_PARTITIONS=/teamA=512,/teamB=256 (megabytes)
+    if (const char* partitions = getenv("CACHE_PARTITIONS")) {
+        string spec(partitions);
+        size_t start = 0;
+        while (start < spec.size()) {
+            // each entry ends at the next comma or at the end of the string
+            size_t end = spec.find(',', start);
+            if (end == string::npos) {
+                end = spec.size();
+            }
+            string item = spec.substr(start, end - start);
+            size_t eq = item.rfind('=');
+            if (eq != string::npos && eq > 0) {
+                cache_add_partition(item.substr(0, eq).c_str(), strtoull(item.c_str() + eq + 1, nullptr, 10) * 1024ULL * 1024ULL);
+            }
+            start = end + 1;
+        }
+    }
 
     // parse URL scheme
     string url(argv[2]);
@@ -468,6 +533,28 @@ int main(int argc, char* argv[]) {
         }
     }
 
+    // optional cap on requests in flight to one origin (default 8)
+    if (const char* concurrency = getenv("CACHE_ORIGIN_CONCURRENCY")) {
+        if (cache_fs::backend_set_origin_concurrency(strtoull(concurrency, nullptr, 10)) != 0) {
+            fprintf(stderr, "invalid CACHE_ORIGIN_CONCURRENCY %s\n", concurrency);
+            return -1;
+        }
+    }
+    // optional hedging of slow block fetches: the latency percentile that
+    // triggers a second request (default 95, 0 turns it off) and the most
+    // requests in a hundred that may be hedged (default 5)
+    const char* hedge_percentile = getenv("CACHE_HEDGE_PERCENTILE");
+    const char* hedge_budget     = getenv("CACHE_HEDGE_BUDGET");
+    if (hedge_percentile || hedge_budget) {
+        double percentile = hedge_percentile ? strtod(hedge_percentile, nullptr) : 95.0;
+        double budget     = hedge_budget ? strtod(hedge_budget, nullptr) : 5.0;
+        if (cache_fs::backend_set_hedging(percentile, budget / 100) != 0) {
+            fprintf(stderr, "invalid CACHE_HEDGE_PERCENTILE %s or CACHE_HEDGE_BUDGET %s\n",
+                    hedge_percentile ? hedge_percentile : "95", hedge_budget ? hedge_budget : "5");
+            return -1;
+        }
+    }
+
     // initializes the HTTP backend
     dataBackend = cache_fs::create_backend(url);
     if (!dataBackend) {
@@ -1,5 +1,7 @@
 #include <iostream>
 #include <cstring>
+#include <cerrno>
+#include <unistd.h>
 #include "cache/cache_manager.h"
 
 int main() {
@@ -23,7 +25,54 @@ int main() {
         std::cout << "cache_has_valid_entry: no\n";
     }
 
+    cache_entry* entry = cache_get_entry(path);
+    if (!entry || strcmp(entry->path, path) != 0 || entry->size != strlen(data) || cache_get_entry("/missing.txt")) {
+        std::cerr << "cache_get_entry FAILED\n";
+        return 1;
+    }
+    std::cout << "cache_get_entry OK\n";
+
     cache_cleanup();
     std::cout << "cache_cleanup OK\n";
+
+    // attributes: fresh for the init timeout, extended by writes, and
+    // a changed origin copy or a write around the cache invalidates the
+    // cached blocks
+    if (cache_init("./cache_dir", 1) != 0) {
+        std::cerr << "cache_init failed\n";
+        return 1;
+    }
+    cache_attr attr;
+    cache_attr origin = {4, 1000, false};
+    cache_put_attr("/attr.txt", &origin);
+    bool ok = cache_get_attr("/never_stored.txt", &attr) == -ENOENT &&
+              cache_get_attr("/attr.txt", &attr) == 0 && attr.size == 4 && attr.mtime == 1000 && !attr.is_dir;
+
+    // our own write keeps the origin's mtime, so revalidating it against
+    // the same origin answer keeps the blocks it wrote
+    ok = ok && cache_store_file("/attr.txt", data, strlen(data), 0) == 0 &&
+         cache_get_attr("/attr.txt", &attr) == 0 && attr.size == strlen(data) && attr.mtime == 1000;
+    cache_attr same = {strlen(data), 1000, false};
+    cache_put_attr("/attr.txt", &same);
+    ok = ok && cache_has_valid_entry("/attr.txt");
+    cache_attr changed = {strlen(data), 2000, false};
+    cache_put_attr("/attr.txt", &changed);
+    ok = ok && !cache_has_valid_entry("/attr.txt");
+
+    // a write that went straight to the origin drops the blocks and the
+    // attributes' freshness
+    ok = ok && cache_store_file("/attr.txt", data, strlen(data), 0) == 0 && cache_has_valid_entry("/attr.txt") &&
+         cache_invalidate("/attr.txt") == 0 && !cache_has_valid_entry("/attr.txt") &&
+         cache_get_attr("/attr.txt", &attr) == -ESTALE;
+    cache_put_attr("/attr.txt", &changed);
+
+    sleep(2);
+    ok = ok && cache_get_attr("/attr.txt", &attr) == -ESTALE && attr.mtime == 2000;
+    cache_cleanup();
+    if (!ok) {
+        std::cerr << "cache_get_attr FAILED\n";
+        return 1;
+    }
+    std::cout << "cache_get_attr OK\n";
     return 0;
 }
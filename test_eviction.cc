@@ -1,10 +1,144 @@
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <cstring>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "cache/cache_manager.h"
 
+// Allocated bytes of every block file under root, as BlockStore counts them.
+static unsigned long long scan_block_bytes(const std::string& root) {
+    unsigned long long bytes = 0;
+    for (auto& e : std::filesystem::recursive_directory_iterator(root)) {
+        struct stat st;
+        if (e.path().extension() == ".blk" && ::stat(e.path().c_str(), &st) == 0) bytes += st.st_blocks * 512ULL;
+    }
+    return bytes;
+}
+
+// Writes that take usage past the high watermark wake the evictor, which
+// drains it to the low watermark and stops there.
+static bool test_watermarks() {
+    const std::string root = "./watermark_dir";
+    const unsigned long long block = 64 * 1024, capacity = 64 * block;
+    const unsigned long long high = capacity * 9 / 10, low = capacity * 8 / 10;
+    std::system(("rm -rf " + root).c_str());
+    if (cache_init(root.c_str(), 60) != 0) return false;
+    cache_set_capacity(capacity);
+
+    // stop right past the high watermark, so nothing refills what the
+    // evictor frees
+    std::vector<char> data(block, 'w');
+    unsigned long long peak = 0;
+    for (int i = 0; i < 100 && peak <= high; ++i) {
+        cache_store_file(("/wm/" + std::to_string(i)).c_str(), data.data(), data.size(), 0);
+        peak = std::max(peak, cache_used_bytes());
+    }
+    unsigned long long used = cache_used_bytes();
+    for (int i = 0; i < 100 && used > low; ++i) {
+        usleep(50 * 1000);
+        used = cache_used_bytes();
+    }
+    std::cout << "  watermarks: peak " << peak << " bytes, drained to " << used << " (high " << high
+              << ", low " << low << ")\n";
+    cache_cleanup();
+    std::system(("rm -rf " + root).c_str());
+    return peak > high && used <= low && used > low - 2 * block;
+}
+
+// Reads, prefetches and writes race with an evictor that a small capacity
+// keeps busy; the byte counter persisted by cleanup must still match what
+// is on disk.
+static bool test_usage_matches_rescan() {
+    const std::string root = "./usage_dir";
+    const std::size_t block = 64 * 1024, files = 8, blocks = 16;
+    std::system(("rm -rf " + root + " && mkdir -p " + root + "/src").c_str());
+    std::string content(blocks * block, '\0');
+    for (std::size_t i = 0; i < content.size(); ++i) content[i] = static_cast<char>('a' + i % 26);
+    for (std::size_t f = 0; f < files; ++f)
+        std::ofstream(root + "/src/" + std::to_string(f), std::ios::binary) << content;
+
+    if (cache_init(root.c_str(), 60) != 0) return false;
+    cache_set_capacity(24 * block);
+    std::vector<std::thread> readers;
+    for (unsigned t = 0; t < 4; ++t) {
+        readers.emplace_back([&, t] {
+            std::vector<char> buf(2 * block);
+            unsigned seed = t + 1;
+            for (int i = 0; i < 400; ++i) {
+                seed = seed * 1103515245 + 12345;
+                std::string path = "/src/" + std::to_string(seed % files);
+                off_t off = (seed >> 8) % blocks * block;
+                cache_read_file(path.c_str(), buf.data(), buf.size(), off);
+                if (i % 50 == 0) cache_store_file(("/w/" + std::to_string(t)).c_str(), buf.data(), block, off);
+            }
+        });
+    }
+    for (auto& th : readers) th.join();
+    cache_cleanup();
+
+    unsigned long long saved = 0;
+    std::ifstream(root + "/.usage") >> saved;
+    unsigned long long scanned = scan_block_bytes(root);
+    std::cout << "  .usage " << saved << " bytes, rescan " << scanned << " bytes\n";
+    std::system(("rm -rf " + root).c_str());
+    return saved == scanned;
+}
+
+// Dropping an entry takes all its blocks out of the policy. A key left
+// behind would outrank newer blocks and, once the entry is written again,
+// evict it in place of the least recently used one.
+static bool test_drop_forgets_blocks() {
+    const std::string root = "./forget_dir";
+    const std::size_t block = 64 * 1024;
+    std::system(("rm -rf " + root).c_str());
+    if (cache_init_policy(root.c_str(), 60, "lru") != 0) return false;
+    std::vector<char> data(4 * block, 'f');
+    cache_store_file("/re/used", data.data(), data.size(), 0);
+    usleep(20 * 1000);
+    cache_store_file("/re/older", data.data(), block, 0);
+    usleep(20 * 1000);
+    cache_invalidate("/re/used");
+    cache_store_file("/re/used", data.data(), block, 0);
+
+    // room for one of the two blocks: the evictor drains to 1.2 blocks
+    cache_set_capacity(block * 3 / 2);
+    for (int i = 0; i < 100 && cache_used_bytes() > block * 6 / 5; ++i) usleep(10 * 1000);
+    bool ok = cache_has_valid_entry("/re/used") && !cache_has_valid_entry("/re/older");
+    cache_cleanup();
+    std::system(("rm -rf " + root).c_str());
+    return ok;
+}
+
+// A write one block larger than the capacity makes room by dropping its
+// own entry; the block written after that is still cached and charged to
+// it, and usage ends under the watermarks so the evictor leaves it alone.
+static bool test_write_past_capacity() {
+    const std::string root = "./selfdrop_dir";
+    const std::size_t block = 64 * 1024, blocks = 11;
+    std::system(("rm -rf " + root).c_str());
+    if (cache_init(root.c_str(), 60) != 0) return false;
+    cache_set_capacity((blocks - 1) * block);
+    std::string data(blocks * block, '\0');
+    for (std::size_t i = 0; i < data.size(); ++i) data[i] = static_cast<char>('a' + i % 26);
+    bool ok = cache_store_file("/big", data.data(), data.size(), 0) == 0 && cache_has_valid_entry("/big") &&
+              cache_used_bytes() == block;
+    std::vector<char> back(block);
+    ok = ok && cache_read_file("/big", back.data(), block, (blocks - 1) * block) == static_cast<ssize_t>(block) &&
+         std::equal(back.begin(), back.end(), data.begin() + (blocks - 1) * block) && cache_used_bytes() == block;
+    cache_cleanup();
+    unsigned long long saved = 0;
+    std::ifstream(root + "/.usage") >> saved;
+    ok = ok && saved == scan_block_bytes(root);
+    std::system(("rm -rf " + root).c_str());
+    return ok;
+}
+
 int main() {
     const char* backing_dir = "./cache_dir";
     const char* path        = "/foo/bar.txt";
@@ -47,5 +181,58 @@ int main() {
 
     cache_cleanup();
     std::cout << "cache_cleanup OK\n";
+
+    // partitions: /b/ borrows idle space, then gives it back when /a/ fills
+    if (cache_init(backing_dir, timeout) != 0) {
+        std::cerr << "cache_init failed\n";
+        return 1;
+    }
+    cache_set_capacity(2 * 1024 * 1024);
+    cache_add_partition("/a/", 1024 * 1024);
+    cache_add_partition("/b/", 512 * 1024);
+
+    std::vector<char> block(64 * 1024, 'x');
+    for (int i = 0; i < 30; ++i)
+        cache_store_file(("/b/" + std::to_string(i)).c_str(), block.data(), block.size(), 0);
+    for (int i = 0; i < 16; ++i)
+        cache_store_file(("/a/" + std::to_string(i)).c_str(), block.data(), block.size(), 0);
+    sleep(2);
+
+    int kept_a = 0, kept_b = 0;
+    for (int i = 0; i < 30; ++i) {
+        kept_a += cache_has_valid_entry(("/a/" + std::to_string(i)).c_str());
+        kept_b += cache_has_valid_entry(("/b/" + std::to_string(i)).c_str());
+    }
+    std::cout << "  partition /a/ kept " << kept_a << " blocks, /b/ kept " << kept_b << "\n";
+    cache_cleanup();
+    if (kept_a != 16) {
+        std::cerr << "ERROR: /a/ lost blocks inside its quota\n";
+        return 1;
+    }
+    std::cout << "partition quotas OK\n";
+
+    if (!test_watermarks()) {
+        std::cerr << "ERROR: evictor did not drain to the low watermark\n";
+        return 1;
+    }
+    std::cout << "watermark eviction OK\n";
+
+    if (!test_usage_matches_rescan()) {
+        std::cerr << "ERROR: persisted usage drifted from the block files\n";
+        return 1;
+    }
+    std::cout << "usage accounting OK\n";
+
+    if (!test_drop_forgets_blocks()) {
+        std::cerr << "ERROR: a dropped entry's blocks stayed in the policy\n";
+        return 1;
+    }
+    std::cout << "dropped entry forgotten OK\n";
+
+    if (!test_write_past_capacity()) {
+        std::cerr << "ERROR: a write lost the entry it dropped to make room\n";
+        return 1;
+    }
+    std::cout << "write past capacity OK\n";
     return 0;
 }
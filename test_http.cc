@@ -1,5 +1,7 @@
 // test_http.cc
 
+#include <algorithm>
+#include <cerrno>
 #include <iostream>
 #include <vector>
 #include <thread>
@@ -7,12 +9,378 @@
 #include <sys/wait.h>
 #include <signal.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <fstream>
+#include <atomic>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <condition_variable>
+#include <mutex>
+
+#include <curl/curl.h>
 
 #include "cache/cache_manager.h"
 #include "backend/backend.h"
+#include "backend/byteranges.h"
+#include "backend/curl_pool.h"
+#include "backend/latency_histogram.h"
+#include "backend/transfer_engine.h"
+
+// Handles go back to the pool and are lent again, and an origin never has
+// more than its limit out at once.
+static bool test_curl_pool() {
+    using cache_fs::CurlPool;
+    if (CurlPool::originOf("http://host:8000/api/data/f?x=1") != "http://host:8000" ||
+        CurlPool::originOf("https://host") != "https://host" || CurlPool::originOf("host/f") != "host/f")
+        return false;
+
+    CurlPool pool(2);
+    CURL* first;
+    {
+        CurlPool::Handle a = pool.acquire("http://a:1/x");
+        if (!a) return false;
+        first = a.get();
+    }
+    CurlPool::Handle a = pool.acquire("http://a:1/y");
+    CurlPool::Handle b = pool.acquire("http://a:1/z");
+    // another origin is not held back by a's limit
+    CurlPool::Handle other = pool.acquire("http://b:1/x");
+    if (a.get() != first || !b || !other || pool.created() != 3) return false;
+
+    std::atomic<bool> got{false};
+    std::thread waiter([&] {
+        CurlPool::Handle c = pool.acquire("http://a:1/w");
+        got = c.get() == first;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    if (got) {
+        waiter.join();
+        return false;
+    }
+    a = CurlPool::Handle();
+    waiter.join();
+    return got && pool.created() == 3;
+}
+
+// Several ranges of one file in flight at once from a single thread each
+// land in their own buffer.
+static bool test_async_reads(cache_fs::Backend& backend, const std::string& path, const std::string& content) {
+    const std::size_t parts = 4;
+    const std::size_t len   = content.size() / parts;
+    std::vector<std::vector<char>> bufs(parts, std::vector<char>(len));
+    std::vector<ssize_t> got(parts, 0);
+    std::mutex mu;
+    std::condition_variable cv;
+    std::size_t left = parts;
+    for (std::size_t i = 0; i < parts; ++i) {
+        backend.download_async(path, bufs[i].data(), len, static_cast<off_t>(i * len), [&, i](ssize_t n) {
+            std::lock_guard<std::mutex> g(mu);
+            got[i] = n;
+            if (--left == 0) cv.notify_one();
+        });
+    }
+    {
+        std::unique_lock<std::mutex> lk(mu);
+        if (!cv.wait_for(lk, std::chrono::seconds(10), [&] { return left == 0; })) return false;
+    }
+    for (std::size_t i = 0; i < parts; ++i) {
+        if (got[i] != static_cast<ssize_t>(len) || std::string(bufs[i].data(), len) != content.substr(i * len, len))
+            return false;
+    }
+    return true;
+}
+
+// Multipart bodies are scattered into the spans that asked for each part,
+// however the body is split across writes; a whole-resource 200 and a plain
+// 206 land the same way.
+static bool test_byterange_sink() {
+    using cache_fs::ByteRangeSink;
+    using cache_fs::ByteSpan;
+    char a[4], b[4], c[4];
+    std::vector<ByteSpan> spans{{a, 4, 10}, {b, 4, 14}, {c, 4, 30}};
+    if (ByteRangeSink::rangeHeader(spans) != "10-17,30-33") return false;
+    std::uint64_t first, last;
+    if (!ByteRangeSink::parseContentRange("bytes 5-9/100", first, last) || first != 5 || last != 9 ||
+        ByteRangeSink::parseContentRange("bytes */100", first, last))
+        return false;
+
+    const std::string body =
+        "preamble\r\n"
+        "--XYZ\r\nContent-Type: text/plain\r\nContent-Range: bytes 10-17/40\r\n\r\n"
+        "ABCDEFGH\r\n"
+        "--XYZ\r\ncontent-range: bytes 30-33/40\r\n\r\n"
+        "wxyz\r\n"
+        "--XYZ--\r\n";
+    for (std::size_t step : {body.size(), std::size_t(1), std::size_t(7)}) {
+        std::memset(a, 0, 4), std::memset(b, 0, 4), std::memset(c, 0, 4);
+        ByteRangeSink sink(spans);
+        if (!sink.begin(206, "multipart/byteranges; boundary=\"XYZ\"", "")) return false;
+        for (std::size_t i = 0; i < body.size(); i += step) {
+            if (!sink.feed(body.data() + i, std::min(step, body.size() - i))) return false;
+        }
+        if (std::string(a, 4) != "ABCD" || std::string(b, 4) != "EFGH" || std::string(c, 4) != "wxyz" ||
+            sink.total() != 12 || !sink.satisfied())
+            return false;
+    }
+
+    // a part without Content-Range cannot be placed
+    ByteRangeSink bad(spans);
+    const std::string no_range = "--XYZ\r\n\r\nABCD";
+    if (!bad.begin(206, "multipart/byteranges; boundary=XYZ", "") || bad.feed(no_range.data(), no_range.size()))
+        return false;
+
+    std::string whole(40, '.');
+    whole.replace(30, 4, "WXYZ");
+    ByteRangeSink full(spans);
+    if (!full.begin(200, "text/plain", "") || !full.feed(whole.data(), whole.size()) || std::string(c, 4) != "WXYZ")
+        return false;
+
+    ByteRangeSink single({{a, 4, 10}, {b, 4, 14}});
+    const std::string part = "0123456";
+    if (!single.begin(206, "text/plain", "bytes 11-17/40") || !single.feed(part.data(), part.size())) return false;
+    return std::string(a + 1, 3) == "012" && std::string(b, 4) == "3456" && single.got()[0] == 4 &&
+           single.got()[1] == 4;
+}
+
+// backend/local_server.py serving dir on port, its request log going to
+// log; the caller kills it.
+static pid_t start_local_server(const char* dir, const char* port, const char* log,
+                                std::vector<const char*> extra = {}) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        int out = open(log, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        dup2(out, STDOUT_FILENO);
+        dup2(out, STDERR_FILENO);
+        std::vector<const char*> argv{"python3", "backend/local_server.py", "--port", port, "--directory", dir};
+        argv.insert(argv.end(), extra.begin(), extra.end());
+        argv.push_back(nullptr);
+        execvp("python3", const_cast<char* const*>(argv.data()));
+        _exit(1);
+    }
+    return pid;
+}
+
+// One GET for several scattered blocks against local_server.py, which
+// answers with multipart/byteranges; spans past the end come back short.
+static bool test_multi_range() {
+    const char* dir  = "multi_range_data";
+    const char* port = "8092";
+    std::string content;
+    for (int i = 0; i < 20000; ++i) content += static_cast<char>('a' + i % 26);
+    system((std::string("rm -rf ") + dir + " && mkdir -p " + dir).c_str());
+    {
+        std::ofstream ofs(std::string(dir) + "/blob", std::ios::binary);
+        ofs << content;
+    }
+
+    pid_t pid = start_local_server(dir, port, "/dev/null");
+    if (pid < 0) return false;
+
+    auto backend = cache_fs::create_backend(std::string("http://127.0.0.1:") + port + "/api/data");
+    auto read_spans = [&](std::vector<cache_fs::ByteSpan> spans) {
+        std::mutex mu;
+        std::condition_variable cv;
+        bool finished = false;
+        std::vector<ssize_t> got;
+        backend->download_ranges_async("/blob", std::move(spans), [&](std::vector<ssize_t> n) {
+            std::lock_guard<std::mutex> g(mu);
+            got = std::move(n);
+            finished = true;
+            cv.notify_one();
+        });
+        std::unique_lock<std::mutex> lk(mu);
+        cv.wait(lk, [&] { return finished; });
+        return got;
+    };
+
+    bool ok = false;
+    char probe;
+    for (int i = 0; i < 50 && backend; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        if (read_spans({{&probe, 1, 0}}) == std::vector<ssize_t>{1}) {
+            ok = true;
+            break;
+        }
+    }
+
+    std::vector<std::vector<char>> bufs(5, std::vector<char>(4096));
+    // two adjacent spans, two scattered ones and one past the end
+    std::vector<cache_fs::ByteSpan> spans{{bufs[0].data(), 4096, 0},
+                                          {bufs[1].data(), 4096, 8192},
+                                          {bufs[2].data(), 4096, 4096},
+                                          {bufs[3].data(), 4096, 16384},
+                                          {bufs[4].data(), 4096, 40960}};
+    std::vector<ssize_t> expect{4096, 4096, 4096, static_cast<ssize_t>(content.size() - 16384), 0};
+    if (ok) ok = read_spans(spans) == expect;
+    for (std::size_t i = 0; ok && i < 4; ++i) {
+        std::size_t n = static_cast<std::size_t>(expect[i]);
+        ok = std::string(bufs[i].data(), n) == content.substr(spans[i].off, n);
+    }
+    // nothing satisfiable at all
+    if (ok) ok = read_spans({{bufs[4].data(), 4096, 40960}}) == std::vector<ssize_t>{0};
+
+    kill(pid, SIGTERM);
+    waitpid(pid, nullptr, 0);
+    system((std::string("rm -rf ") + dir).c_str());
+    return ok;
+}
+
+// A large file read front to back through the cache is fetched ahead of
+// the reader in big chunks over parallel streams, so the origin sees a few
+// dozen requests rather than one or more per 64 KiB block.
+static bool test_bulk_read() {
+    const char* dir  = "bulk_data";
+    const char* port = "8092";
+    const char* log  = "bulk_server.log";
+    const std::size_t size = 20 << 20, block = 64 * 1024;
+    std::string content(size, '\0');
+    for (std::size_t i = 0; i < size; ++i) content[i] = static_cast<char>('a' + i % 26);
+    system((std::string("rm -rf ") + dir + " bulk_cache && mkdir -p " + dir).c_str());
+    std::ofstream(std::string(dir) + "/blob", std::ios::binary) << content;
+
+    pid_t pid = start_local_server(dir, port, log);
+    if (pid < 0) return false;
+    cache_fs::create_backend(std::string("http://127.0.0.1:") + port + "/api/data");
+    bool ok = cache_init("./bulk_cache", 60) == 0;
+    cache_attr attr{size, std::time(nullptr), false};
+    ok = ok && cache_put_attr("/blob", &attr) == 0;
+
+    std::string got(block, '\0');
+    for (std::size_t off = 0; ok && off < size; off += block) {
+        ssize_t n = -1;
+        // the server may still be starting
+        for (int i = 0; i < 50 && n < 0; ++i) {
+            n = cache_read_file("/blob", &got[0], block, off);
+            if (n < 0) std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        ok = n == static_cast<ssize_t>(block) && got.compare(0, block, content, off, block) == 0;
+    }
+    // a read across the end is short, and one at or past it is empty
+    ok = ok && cache_read_file("/blob", &got[0], block, size - 100) == 100 &&
+         cache_read_file("/blob", &got[0], block, size) == 0 &&
+         cache_read_file("/blob", &got[0], block, size + 3 * block) == 0;
+    cache_cleanup();
+    kill(pid, SIGTERM);
+    waitpid(pid, nullptr, 0);
+
+    std::size_t requests = 0;
+    std::ifstream in(log);
+    for (std::string line; std::getline(in, line);) requests += line.find("GET /api/data/blob") != std::string::npos;
+    std::cout << "bulk read: " << requests << " requests for " << size / block << " blocks\n";
+    system((std::string("rm -rf ") + dir + " bulk_cache " + log).c_str());
+    return ok && requests < size / block / 4;
+}
+
+// Percentiles land within a bucket of the samples, and old samples fade.
+static bool test_latency_histogram() {
+    cache_fs::LatencyHistogram h;
+    if (h.percentile(0.5) != 0) return false;
+    for (int i = 0; i < 90; ++i) h.record(0.010);
+    for (int i = 0; i < 10; ++i) h.record(0.500);
+    double p50 = h.percentile(0.5), p95 = h.percentile(0.95);
+    if (h.count() != 100 || p50 < 0.010 || p50 > 0.011 || p95 < 0.500 || p95 > 0.550) return false;
+    for (int i = 0; i < 2000; ++i) h.record(0.001);
+    return h.percentile(0.9) < 0.0011;
+}
+
+// Against an origin where every tenth request stalls, block reads past the
+// warmup are hedged and none waits out the stall; an engine held to a 5%
+// budget sends no more duplicates than that however eager its deadlines.
+static bool test_hedging() {
+    const char* dir  = "hedge_data";
+    const char* port = "8092";
+    const double stall = 0.3;
+    const std::size_t block = 64 * 1024, blocks = 32;
+    std::string content(block * blocks, '\0');
+    for (std::size_t i = 0; i < content.size(); ++i) content[i] = static_cast<char>('a' + i % 26);
+    system((std::string("rm -rf ") + dir + " && mkdir -p " + dir).c_str());
+    std::ofstream(std::string(dir) + "/blob", std::ios::binary) << content;
+
+    pid_t pid = start_local_server(dir, port, "/dev/null", {"--slow-every", "10", "--slow-ms", "300"});
+    if (pid < 0) return false;
+    const std::string base = std::string("http://127.0.0.1:") + port + "/api/data";
+    auto backend = cache_fs::create_backend(base);
+    bool ok = backend && cache_fs::backend_set_hedging(100, 0.5) == -EINVAL &&
+              cache_fs::backend_set_hedging(90, 1.5) == -EINVAL &&
+              cache_fs::backend_set_hedging(80, 1.0) == 0;
+
+    std::string got(block, '\0');
+    for (int i = 0; ok && i < 50 && backend->download("/blob", &got[0], 1, 0) != 1; ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    auto before = cache_fs::shared_transfer_engine().hedgeStats();
+    double worst = 0;
+    for (std::size_t i = 0; ok && i < 100; ++i) {
+        off_t off = static_cast<off_t>(i % blocks * block);
+        auto t0 = std::chrono::steady_clock::now();
+        ok = backend->download("/blob", &got[0], block, off) == static_cast<ssize_t>(block) &&
+             got.compare(0, block, content, off, block) == 0;
+        double took = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        // the histogram needs some samples before it hedges
+        if (i >= 30) worst = std::max(worst, took);
+    }
+    auto after = cache_fs::shared_transfer_engine().hedgeStats();
+    std::cout << "hedging: " << after.hedged - before.hedged << " hedged, " << after.won - before.won
+              << " won, slowest read " << worst * 1000 << " ms\n";
+    ok = ok && worst < stall / 2 && after.won > before.won;
+    cache_fs::backend_set_hedging(95, cache_fs::TransferEngine::kDefaultHedgeBudget);
+
+    // every request is due a hedge after 1 ms; the budget allows one in 20
+    cache_fs::TransferEngine engine(4);
+    engine.setHedgeBudget(0.05);
+    const int requests = 100;
+    for (int i = 0; ok && i < requests; ++i) {
+        std::mutex mu;
+        std::condition_variable cv;
+        bool finished = false;
+        ssize_t n = -1;
+        cache_fs::TransferEngine::Request req;
+        req.url         = base + "/blob";
+        req.spans       = {{&got[0], block, static_cast<off_t>(i % blocks * block)}};
+        req.hedge_after = 0.001;
+        req.done = [&](const cache_fs::TransferEngine::Result& res) {
+            std::lock_guard<std::mutex> g(mu);
+            n = res.bytes;
+            finished = true;
+            cv.notify_one();
+        };
+        engine.submit(std::move(req));
+        std::unique_lock<std::mutex> lk(mu);
+        cv.wait(lk, [&] { return finished; });
+        ok = n == static_cast<ssize_t>(block) && got.compare(0, block, content, i % blocks * block, block) == 0;
+    }
+    auto capped = engine.hedgeStats();
+    std::cout << "hedging at a 5% budget: " << capped.hedged << " of " << capped.eligible << " hedged\n";
+    ok = ok && capped.eligible == requests && capped.hedged >= 1 && capped.hedged <= requests / 20;
+
+    kill(pid, SIGTERM);
+    waitpid(pid, nullptr, 0);
+    system((std::string("rm -rf ") + dir).c_str());
+    return ok;
+}
 
 int main() {
+    if (!test_curl_pool()) {
+        std::cerr << "CurlPool FAILED\n";
+        return 1;
+    }
+    std::cout << "CurlPool OK\n";
+    if (!test_byterange_sink()) {
+        std::cerr << "ByteRangeSink FAILED\n";
+        return 1;
+    }
+    std::cout << "ByteRangeSink OK\n";
+    if (!test_multi_range()) {
+        std::cerr << "multi-range GET FAILED\n";
+        return 1;
+    }
+    std::cout << "multi-range GET OK\n";
+    if (!test_latency_histogram()) {
+        std::cerr << "LatencyHistogram FAILED\n";
+        return 1;
+    }
+    std::cout << "LatencyHistogram OK\n";
+
     const int timeout = 2;               // eviction timeout
     const std::string fname   = "hello.txt";
     const std::string content = "Hello, HTTP!";
@@ -69,6 +437,13 @@ int main() {
         std::cout << "Downloaded (miss): \"" 
                   << std::string(buf.data(), n1) << "\"\n";
     }
+    if (!test_async_reads(*backend, "/" + fname, content)) {
+        std::cerr << "async reads FAILED\n";
+        cache_cleanup();
+        kill(pid, SIGTERM); waitpid(pid, nullptr, 0);
+        return 1;
+    }
+    std::cout << "async reads OK\n";
 
     // 6) Evict after timeout
     std::this_thread::sleep_for(std::chrono::seconds(timeout + 1));
@@ -97,5 +472,16 @@ int main() {
     kill(pid, SIGTERM);
     waitpid(pid, nullptr, 0);
 
+    if (!test_bulk_read()) {
+        std::cerr << "bulk read FAILED\n";
+        return 1;
+    }
+    std::cout << "bulk read OK\n";
+    if (!test_hedging()) {
+        std::cerr << "hedging FAILED\n";
+        return 1;
+    }
+    std::cout << "hedging OK\n";
+
     return 0;
 }
@@ -0,0 +1,616 @@
+#include <sqlite3.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cache/fs_layout.h"
+#include "cache/policy/metadata/block_bitmap.h"
+#include "cache/policy/metadata/metadata_store.h"
+
+static constexpr const char* kDbPath = "test_meta.db";
+
+static void remove_db() {
+    for (const char* sfx : {"", "-wal", "-shm", "-journal"})
+        std::filesystem::remove(std::string(kDbPath) + sfx);
+}
+
+static CacheMetadata row(const std::string& path, std::size_t size) {
+    CacheMetadata m;
+    m.path = path;
+    m.local_path = "cache_dir" + path;
+    m.size = size;
+    m.timestamp = m.last_accessed = 100;
+    return m;
+}
+
+static std::size_t count_entries(MetadataStore& store) {
+    std::size_t n = 0;
+    store.forEachEntry([&](const CacheMetadata&) {
+        ++n;
+        return true;
+    });
+    return n;
+}
+
+// Queued mutations are visible to get() before and after the group commit,
+// and survive reopening the database.
+static bool test_group_commit() {
+    remove_db();
+    {
+        MetadataStore store(kDbPath, "cache_dir");
+        if (!store.init()) return false;
+
+        store.put(row("/a", 1));
+        store.updateAccessTime("/a", 200);
+        store.markDirty("/a", true);
+        auto a = store.get("/a");
+        if (!a || a->last_accessed != 200 || !a->dirty) return false;
+
+        store.put(row("/b", 2));
+        store.flush();
+        // partial updates on a committed row merge with the stored columns
+        store.updateAccessTime("/b", 300);
+        auto b = store.get("/b");
+        if (!b || b->size != 2 || b->last_accessed != 300 || b->dirty) return false;
+
+        store.remove("/b");
+        store.markDirty("/b", true);
+        if (store.get("/b")) return false;
+
+        store.put(row("/c", 3));
+        store.remove("/c");
+        store.put(row("/c", 4));
+        auto c = store.get("/c");
+        if (!c || c->size != 4) return false;
+    }
+
+    MetadataStore reopened(kDbPath, "cache_dir");
+    if (!reopened.init()) return false;
+    auto a = reopened.get("/a");
+    auto c = reopened.get("/c");
+    bool ok = a && a->last_accessed == 200 && a->dirty && !reopened.get("/b") && c && c->size == 4 &&
+              count_entries(reopened) == 2;
+    remove_db();
+    return ok;
+}
+
+// A commit that fails while another connection holds the write lock is
+// rolled back and retried by the next one; updates queued in between win.
+static bool test_failed_commit_retries() {
+    remove_db();
+    {
+        MetadataStore store(kDbPath, "cache_dir");
+        if (!store.init()) return false;
+        store.put(row("/r", 1));
+        store.put(row("/s", 2));
+        if (!store.flush()) return false;
+
+        sqlite3* other = nullptr;
+        if (sqlite3_open(kDbPath, &other) != SQLITE_OK ||
+            sqlite3_exec(other, "BEGIN IMMEDIATE;", nullptr, nullptr, nullptr) != SQLITE_OK) {
+            sqlite3_close(other);
+            return false;
+        }
+        store.put(row("/r", 10));
+        store.markDirty("/s", true);
+        bool failed = !store.flush();
+        store.updateAccessTime("/r", 500);
+        store.put(row("/s", 20));
+        sqlite3_exec(other, "COMMIT;", nullptr, nullptr, nullptr);
+        sqlite3_close(other);
+        if (!failed || !store.flush()) return false;
+    }
+
+    MetadataStore reopened(kDbPath, "cache_dir");
+    if (!reopened.init()) return false;
+    auto r = reopened.get("/r");
+    auto s = reopened.get("/s");
+    bool ok = r && r->size == 10 && r->last_accessed == 500 && s && s->size == 20 && !s->dirty;
+    remove_db();
+    return ok;
+}
+
+// While another connection holds the write lock past the busy timeout, the
+// writer's repeated failures are logged once, not once per retry; the
+// queued row lands once the lock is gone.
+static bool test_commit_backoff() {
+    remove_db();
+    std::ostringstream log;
+    std::streambuf* saved = std::cerr.rdbuf(log.rdbuf());
+    bool landed = false;
+    {
+        MetadataStore store(kDbPath, "cache_dir");
+        sqlite3* other = nullptr;
+        if (store.init() && sqlite3_open(kDbPath, &other) == SQLITE_OK &&
+            sqlite3_exec(other, "BEGIN IMMEDIATE;", nullptr, nullptr, nullptr) == SQLITE_OK) {
+            store.put(row("/b", 1));
+            std::this_thread::sleep_for(std::chrono::milliseconds(2500));
+            sqlite3_exec(other, "COMMIT;", nullptr, nullptr, nullptr);
+            auto found = [](void* flag, int, char**, char**) {
+                *static_cast<bool*>(flag) = true;
+                return 0;
+            };
+            for (int i = 0; i < 60 && !landed; ++i) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                sqlite3_exec(other, "SELECT 1 FROM metadata WHERE path='/b';", found, &landed, nullptr);
+            }
+        }
+        sqlite3_close(other);
+    }
+    std::cerr.rdbuf(saved);
+    const std::string text = log.str();
+    std::size_t failures = 0;
+    for (std::size_t at = 0; (at = text.find("failed", at)) != std::string::npos; ++at) ++failures;
+    std::size_t resumed = text.find("resumed after ");
+    std::size_t failed = resumed == std::string::npos ? 0 : std::stoul(text.substr(resumed + 14));
+    std::cout << "  commit backoff: " << failed << " failures, " << failures << " logged, row "
+              << (landed ? "landed" : "missing") << '\n';
+    remove_db();
+    return landed && failures == 1 && failed >= 2;
+}
+
+// The rows a shard answers from memory stay within the bound; forgotten
+// rows are still found, queued or committed. Changes to unknown paths go
+// straight to the database without interning the path.
+static bool test_row_cache_bound() {
+    remove_db();
+    bool ok;
+    {
+        PathTable paths;
+        MetadataShard shard(kDbPath, MetadataShard::SyncLevel::Normal, 1, paths);
+        if (!shard.open()) return false;
+        shard.setRowCache(100);
+        for (int i = 0; i < 1000; ++i) shard.put(row("/m" + std::to_string(i), i));
+        auto queued = shard.get("/m0");
+        ok = shard.cachedRows() == 100 && queued && queued->size == 0;
+        shard.updateAccessTime("/m1", 500);
+        ok &= shard.commit();
+        for (int i = 0; i < 1000; i += 7) {
+            auto m = shard.get("/m" + std::to_string(i));
+            ok &= m && m->size == static_cast<std::size_t>(i);
+        }
+        auto m1 = shard.get("/m1");
+        ok &= m1 && m1->last_accessed == 500 && shard.cachedRows() == 100;
+        // changes to paths never seen are not interned
+        ok &= shard.updateAccessTime("/none", 1) && shard.markDirty("/none", true) && shard.remove("/none") &&
+              paths.size() == 1000;
+    }
+    {
+        // a row from an earlier run is still changed and removed through a
+        // table that has not seen its path
+        PathTable paths;
+        MetadataShard shard(kDbPath, MetadataShard::SyncLevel::Normal, 1, paths);
+        if (!shard.open()) return false;
+        ok &= shard.markDirty("/m3", true) && shard.remove("/m2") && paths.size() == 0;
+        auto m3 = shard.get("/m3");
+        ok &= !shard.get("/m2") && m3 && m3->dirty && paths.size() == 1;
+    }
+    remove_db();
+    return ok;
+}
+
+// Rows spread over several shard files are written from many threads at
+// once, found again after a reopen, and visited once each by forEachEntry.
+// Reopening with another shard count is refused.
+static bool test_sharded_store() {
+    constexpr std::size_t kShards = 4;
+    auto remove_shards = [] {
+        for (std::size_t i = 0; i < kShards; ++i)
+            for (const char* sfx : {"", "-wal", "-shm", "-journal"})
+                std::filesystem::remove(std::string(kDbPath) + "." + std::to_string(i) + sfx);
+    };
+    remove_shards();
+    const auto normal = MetadataStore::SyncLevel::Normal;
+    const auto sqlite = MetadataStore::Backend::Sqlite;
+    {
+        MetadataStore store(kDbPath, "cache_dir", normal, sqlite, kShards);
+        if (!store.init()) return false;
+        std::vector<std::thread> writers;
+        for (int t = 0; t < 4; ++t) {
+            writers.emplace_back([&store, t] {
+                for (int i = t; i < 2000; i += 4) {
+                    store.put(row("/s" + std::to_string(i), i));
+                    if (i % 2 == 0) store.updateAccessTime("/s" + std::to_string(i), 300);
+                }
+            });
+        }
+        for (auto& w : writers) w.join();
+        store.remove("/s7");
+        store.markDirty("/s8", true);
+        if (!store.flush()) return false;
+    }
+    for (std::size_t i = 0; i < kShards; ++i) {
+        if (!std::filesystem::exists(std::string(kDbPath) + "." + std::to_string(i))) return false;
+    }
+
+    bool ok;
+    {
+        MetadataStore reopened(kDbPath, "cache_dir", normal, sqlite, kShards);
+        if (!reopened.init()) return false;
+        auto s8 = reopened.get("/s8");
+        auto s9 = reopened.get("/s9");
+        ok = s8 && s8->dirty && s8->last_accessed == 300 && s9 && s9->size == 9 && s9->last_accessed == 100 &&
+             !reopened.get("/s7") && count_entries(reopened) == 1999;
+        // stopping early visits no further rows, in this shard or the next
+        std::size_t seen = 0;
+        reopened.forEachEntry([&](const CacheMetadata&) { return ++seen < 10; });
+        ok &= seen == 10;
+    }
+    {
+        MetadataStore wrong(kDbPath, "cache_dir", normal, sqlite, kShards * 2);
+        ok &= !wrong.init();
+    }
+    remove_shards();
+    for (std::size_t i = kShards; i < kShards * 2; ++i) std::filesystem::remove(std::string(kDbPath) + "." + std::to_string(i));
+    return ok;
+}
+
+// The hash-table backend answers like the SQLite one, keeps its rows across
+// a reopen, and survives growing and purging tombstones along the way.
+static bool test_hash_index() {
+    const std::string idx = "test_meta.idx";
+    auto remove_idx = [&] {
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator(".", ec)) {
+            if (entry.path().filename().string().rfind(idx, 0) == 0) std::filesystem::remove(entry.path(), ec);
+        }
+    };
+    remove_idx();
+    const auto index = MetadataStore::Backend::Index;
+    {
+        MetadataStore store(idx, "cache_dir", MetadataStore::SyncLevel::Normal, index);
+        if (!store.init()) return false;
+        // well past the initial 1024 slots, with removals leaving tombstones
+        for (int i = 0; i < 5000; ++i) store.put(row("/f" + std::to_string(i), i));
+        for (int i = 0; i < 5000; i += 2) store.remove("/f" + std::to_string(i));
+        store.updateAccessTime("/f1", 200);
+        store.markDirty("/f1", true);
+        CacheMetadata moved = row("/f3", 33);
+        moved.local_path = "elsewhere/f3";
+        moved.is_dir = true;
+        store.put(moved);
+
+        auto f1 = store.get("/f1");
+        if (!f1 || f1->size != 1 || f1->last_accessed != 200 || !f1->dirty || store.get("/f2")) return false;
+        if (!store.flush()) return false;
+    }
+
+    MetadataStore reopened(idx, "cache_dir", MetadataStore::SyncLevel::Normal, index);
+    if (!reopened.init()) return false;
+    auto f1 = reopened.get("/f1");
+    auto f3 = reopened.get("/f3");
+    auto f4999 = reopened.get("/f4999");
+    bool ok = f1 && f1->dirty && f1->last_accessed == 200 && f3 && f3->size == 33 && f3->is_dir &&
+              f3->local_path == "elsewhere/f3" && f4999 && f4999->local_path == "cache_dir/f4999" &&
+              !reopened.get("/f4998") && count_entries(reopened) == 2500;
+    // every row is visited once, and stopping early visits no more
+    std::size_t odd = 0, seen = 0;
+    reopened.forEachEntry([&](const CacheMetadata& m) {
+        odd += std::stoi(m.path.substr(2)) % 2;
+        return true;
+    });
+    reopened.forEachEntry([&](const CacheMetadata&) { return ++seen < 10; });
+    ok &= odd == 2500 && seen == 10;
+    reopened.cleanup();
+    remove_idx();
+    return ok;
+}
+
+// Sparse and dense chunks answer the same queries, and the flat byte image
+// round-trips.
+static bool test_block_bitmap() {
+    BlockBitmap bm;
+    for (std::uint32_t i = 0; i < 10000; ++i) bm.set(70000 + i * 2);   // dense chunk 1
+    bm.set(5);
+    bm.set(6);
+    bm.set(200000);
+    if (bm.count() != 10003 || !bm.test(70002) || bm.test(70003)) return false;
+    if (bm.next_set(7) != 70000 || bm.next_set(70001) != 70002 || bm.next_set(89999) != 200000) return false;
+    if (bm.next_clear(5) != 7 || bm.next_clear(70000) != 70001 || bm.next_clear(200000) != 200001) return false;
+    if (bm.next_set(200001) != BlockBitmap::kNone || bm.extent() != 200001) return false;
+
+    for (std::uint32_t i = 0; i < 9000; ++i) bm.clear(70000 + i * 2);
+    if (bm.count() != 1003 || bm.next_set(7) != 88000) return false;
+
+    std::vector<std::uint8_t> image((bm.extent() + 7) / 8);
+    bm.copy_bytes(0, image.data(), image.size());
+    BlockBitmap copy;
+    copy.load_bytes(image.data(), image.size());
+    for (std::uint64_t a = bm.next_set(0), b = copy.next_set(0);; a = bm.next_set(a + 1), b = copy.next_set(b + 1)) {
+        if (a != b) return false;
+        if (a == BlockBitmap::kNone) break;
+    }
+    return copy.count() == bm.count();
+}
+
+// A flush rewrites only the 4 KiB pages whose bits changed, and presence
+// survives a restart.
+static bool test_bitmap_pages() {
+    const std::string root = "cache_dir";
+    const std::uint64_t hash = 0x00112233445566aaULL;
+    std::filesystem::remove_all(root);
+    remove_db();
+    const std::string pmap = fs_layout::presence_path(root, hash, 0);
+    {
+        MetadataStore store(kDbPath, root);
+        if (!store.init()) return false;
+        store.markPresentBlock(hash, 0, 3);
+        store.markPresentBlock(hash, 0, 40000);   // page 1
+        if (!store.flushBitmaps(hash) || std::filesystem::file_size(pmap) != 40000 / 8 + 1) return false;
+
+        // scribble over page 0; touching only page 1 must leave it alone
+        { std::fstream f(pmap, std::ios::in | std::ios::out | std::ios::binary); f.seekp(100); f.put('\x7f'); }
+        store.markPresentBlock(hash, 0, 40001);
+        if (!store.flushBitmaps(hash)) return false;
+        std::ifstream f(pmap, std::ios::binary);
+        f.seekg(100);
+        if (f.get() != 0x7f) return false;
+    }
+
+    MetadataStore reopened(kDbPath, root);
+    if (!reopened.init()) return false;
+    bool ok = reopened.isBlockPresent(hash, 0, 3) && reopened.isBlockPresent(hash, 0, 40001) &&
+              !reopened.isBlockPresent(hash, 0, 4);
+    reopened.dropBitmaps(hash);
+    ok = ok && !reopened.isBlockPresent(hash, 0, 3) && !std::filesystem::exists(pmap);
+    std::filesystem::remove_all(root);
+    remove_db();
+    return ok;
+}
+
+// Dirty maps are updated in place and readable straight from the mapping
+// after a restart; a headerless map from older versions is converted.
+static bool test_mapped_dirty_map() {
+    const std::string root = "cache_dir";
+    const std::uint64_t hash = 0x00112233445566bbULL;
+    std::filesystem::remove_all(root);
+    remove_db();
+    const std::string dmap = fs_layout::bitmap_path(root, hash, 0);
+    const std::string legacy = fs_layout::bitmap_path(root, hash, 1);
+    std::filesystem::create_directories(std::filesystem::path(legacy).parent_path());
+    std::ofstream(legacy, std::ios::binary) << '\x05';
+    {
+        MetadataStore store(kDbPath, root);
+        if (!store.init()) return false;
+        store.markDirtyBlock(hash, 0, 7);
+        store.markDirtyBlock(hash, 0, 1000000);   // grows the file
+        if (!store.flushBitmaps(hash)) return false;
+        if (!store.isBlockDirty(hash, 1, 0) || store.isBlockDirty(hash, 1, 1) || !store.isBlockDirty(hash, 1, 2)) return false;
+    }
+    std::ifstream f(dmap, std::ios::binary);
+    char magic[4] = {};
+    f.read(magic, 4);
+    if (std::string(magic, 4) != "DMAP") return false;
+
+    MetadataStore reopened(kDbPath, root);
+    if (!reopened.init()) return false;
+    bool ok = reopened.isBlockDirty(hash, 0, 7) && reopened.isBlockDirty(hash, 0, 1000000) &&
+              !reopened.isBlockDirty(hash, 0, 8) && reopened.isBlockDirty(hash, 1, 2);
+
+    // probing or cleaning an object with no dirty map creates none
+    const std::uint64_t clean = 0x00112233445566ccULL;
+    reopened.markCleanBlock(clean, 0, 3);
+    ok = ok && !reopened.isBlockDirty(clean, 0, 3) && reopened.flushBitmaps(clean) &&
+         !std::filesystem::exists(fs_layout::bitmap_path(root, clean, 0));
+    reopened.markDirtyBlock(clean, 0, 3);
+    ok = ok && reopened.isBlockDirty(clean, 0, 3) && std::filesystem::exists(fs_layout::bitmap_path(root, clean, 0));
+    std::filesystem::remove_all(root);
+    remove_db();
+    return ok;
+}
+
+// With room for two objects, older objects' maps are written back and
+// dropped, and come back from disk with their bits when used again.
+static bool test_bitmap_residency() {
+    const std::string root = "cache_dir";
+    std::filesystem::remove_all(root);
+    remove_db();
+    bool ok;
+    {
+        MetadataStore store(kDbPath, root);
+        if (!store.init()) return false;
+        store.setBitmapResidency(2);
+        for (std::uint64_t obj = 1; obj <= 5; ++obj) {
+            store.markPresentBlock(obj, 0, obj);
+            store.markDirtyBlock(obj, 0, obj + 100);
+        }
+        // trimmed maps are written back by the checkpointer
+        ok = store.residentObjects() == 2;
+        for (int i = 0; i < 100 && !std::filesystem::exists(fs_layout::presence_path(root, 1, 0)); ++i)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        ok = ok && std::filesystem::exists(fs_layout::presence_path(root, 1, 0));
+        for (std::uint64_t obj = 1; obj <= 5; ++obj) {
+            ok = ok && store.isBlockPresent(obj, 0, obj) && !store.isBlockPresent(obj, 0, obj + 1) &&
+                 store.isBlockDirty(obj, 0, obj + 100);
+        }
+        ok = ok && store.residentObjects() == 2;
+    }
+    std::filesystem::remove_all(root);
+    remove_db();
+    return ok;
+}
+
+// With a tiny bound, objects are trimmed, written back by the checkpointer
+// and paged in again while other threads keep marking and dropping them;
+// no bit is lost and no dropped bit comes back.
+static bool test_bitmap_pageout_race() {
+    const std::string root = "cache_dir";
+    std::filesystem::remove_all(root);
+    remove_db();
+    bool ok = true;
+    {
+        MetadataStore store(kDbPath, root);
+        if (!store.init()) return false;
+        store.setBitmapResidency(3);
+        std::vector<std::thread> threads;
+        std::vector<int> lost(4, 0);
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&, t] {
+                for (int round = 0; round < 20; ++round) {
+                    for (std::uint64_t obj = t * 100 + 1; obj <= t * 100 + 10u; ++obj) {
+                        store.markPresentBlock(obj, 0, round);
+                        store.markDirtyBlock(obj, 0, round);
+                    }
+                    for (std::uint64_t obj = t * 100 + 1; obj <= t * 100 + 10u; ++obj) {
+                        for (int b = 0; b <= round; ++b)
+                            lost[t] += !store.isBlockPresent(obj, 0, b) || !store.isBlockDirty(obj, 0, b);
+                    }
+                    store.dropBitmaps(t * 100 + 10);
+                    lost[t] += store.isBlockPresent(t * 100 + 10, 0, 0);
+                    for (int b = 0; b <= round; ++b) {
+                        store.markPresentBlock(t * 100 + 10, 0, b);
+                        store.markDirtyBlock(t * 100 + 10, 0, b);
+                    }
+                }
+            });
+        }
+        for (auto& th : threads) th.join();
+        for (int n : lost) ok &= n == 0;
+        ok &= store.checkpoint();
+    }
+    MetadataStore reopened(kDbPath, root);
+    ok = ok && reopened.init();
+    for (std::uint64_t t = 0; t < 4 && ok; ++t) {
+        ok = reopened.isBlockPresent(t * 100 + 1, 0, 19) && reopened.isBlockDirty(t * 100 + 9, 0, 0) &&
+             reopened.isBlockPresent(t * 100 + 10, 0, 19) && !reopened.isBlockPresent(t * 100 + 10, 0, 20);
+    }
+    std::filesystem::remove_all(root);
+    remove_db();
+    return ok;
+}
+
+// A process that dies without checkpointing leaves its bitmap changes in
+// the journal only; the next init() replays them in order and truncates it.
+static bool test_journal_replay() {
+    const std::string root = "cache_dir";
+    const std::uint64_t kept = 0x00112233445566ccULL, evicted = 0x00112233445566ddULL;
+    std::filesystem::remove_all(root);
+    remove_db();
+
+    pid_t pid = fork();
+    if (pid < 0) return false;
+    if (pid == 0) {
+        MetadataStore store(kDbPath, root);
+        if (!store.init()) _exit(1);
+        store.markPresentBlock(kept, 0, 5);
+        store.markPresentBlock(kept, 0, 6);
+        store.markPresentBlock(evicted, 0, 9);
+        store.flushBitmaps(evicted);
+        store.dropBitmaps(evicted);
+        store.markPresentBlock(kept, 1, 2);
+        store.flush();
+        _exit(0);   // no destructors, no checkpoint
+    }
+    int status = 0;
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) return false;
+
+    const std::string journal = fs_layout::journal_path(root);
+    if (std::filesystem::file_size(journal) <= 16 || std::filesystem::exists(fs_layout::presence_path(root, kept, 0)))
+        return false;
+
+    MetadataStore reopened(kDbPath, root);
+    if (!reopened.init()) return false;
+    bool ok = std::filesystem::file_size(journal) == 16 &&
+              reopened.isBlockPresent(kept, 0, 5) && reopened.isBlockPresent(kept, 0, 6) &&
+              reopened.isBlockPresent(kept, 1, 2) && !reopened.isBlockPresent(kept, 0, 7) &&
+              !reopened.isBlockPresent(evicted, 0, 9) &&
+              std::filesystem::exists(fs_layout::presence_path(root, kept, 0));
+
+    // a torn record at the tail is dropped, the ones before it still count
+    reopened.markDirtyBlock(kept, 0, 1);
+    reopened.markCleanBlock(kept, 0, 1);
+    reopened.markDirtyBlock(kept, 0, 3);
+    reopened.flush();
+    std::ofstream(journal, std::ios::binary | std::ios::app) << "torn";
+    std::filesystem::remove(fs_layout::bitmap_path(root, kept, 0));
+    MetadataStore again(kDbPath, root);
+    ok = ok && again.init() && !again.isBlockDirty(kept, 0, 1) && again.isBlockDirty(kept, 0, 3);
+    return ok;
+}
+
+int main() {
+    if (!test_group_commit()) {
+        std::cerr << "MetadataStore group commit FAILED\n";
+        return 1;
+    }
+    std::cout << "MetadataStore group commit OK\n";
+
+    if (!test_failed_commit_retries()) {
+        std::cerr << "MetadataStore failed commit retry FAILED\n";
+        return 1;
+    }
+    std::cout << "MetadataStore failed commit retry OK\n";
+
+    if (!test_commit_backoff()) {
+        std::cerr << "MetadataShard commit backoff FAILED\n";
+        return 1;
+    }
+    std::cout << "MetadataShard commit backoff OK\n";
+
+    if (!test_row_cache_bound()) {
+        std::cerr << "MetadataShard row cache bound FAILED\n";
+        return 1;
+    }
+    std::cout << "MetadataShard row cache bound OK\n";
+
+    if (!test_sharded_store()) {
+        std::cerr << "MetadataStore sharded store FAILED\n";
+        return 1;
+    }
+    std::cout << "MetadataStore sharded store OK\n";
+
+    if (!test_hash_index()) {
+        std::cerr << "MetadataStore hash index FAILED\n";
+        return 1;
+    }
+    std::cout << "MetadataStore hash index OK\n";
+
+    if (!test_block_bitmap()) {
+        std::cerr << "BlockBitmap FAILED\n";
+        return 1;
+    }
+    std::cout << "BlockBitmap OK\n";
+
+    if (!test_bitmap_pages()) {
+        std::cerr << "MetadataStore bitmap pages FAILED\n";
+        return 1;
+    }
+    std::cout << "MetadataStore bitmap pages OK\n";
+
+    if (!test_mapped_dirty_map()) {
+        std::cerr << "MetadataStore mapped dirty map FAILED\n";
+        return 1;
+    }
+    std::cout << "MetadataStore mapped dirty map OK\n";
+
+    if (!test_bitmap_residency()) {
+        std::cerr << "MetadataStore bitmap residency FAILED\n";
+        return 1;
+    }
+    std::cout << "MetadataStore bitmap residency OK\n";
+
+    if (!test_bitmap_pageout_race()) {
+        std::cerr << "MetadataStore bitmap page-out race FAILED\n";
+        return 1;
+    }
+    std::cout << "MetadataStore bitmap page-out race OK\n";
+
+    bool replayed = test_journal_replay();
+    std::filesystem::remove_all("cache_dir");
+    remove_db();
+    if (!replayed) {
+        std::cerr << "MetadataStore journal replay FAILED\n";
+        return 1;
+    }
+    std::cout << "MetadataStore journal replay OK\n";
+    return 0;
+}
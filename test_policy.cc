@@ -0,0 +1,241 @@
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cache/access_buffer.h"
+#include "cache/path_table.h"
+#include "cache/policy/clock_policy.h"
+#include "cache/policy/gdsf_policy.h"
+#include "cache/policy/lru_policy.h"
+#include "cache/policy/time_policy.h"
+#include "cache/policy/stacked_policy.h"
+
+static constexpr std::size_t kNone = std::numeric_limits<std::size_t>::max();
+
+static bool test_clock() {
+    ClockPolicy clock(4);
+    for (std::size_t id = 1; id <= 4; ++id) clock.touch(id, 4096, 1.0);
+
+    // 1 and 3 are referenced again, so the hand should skip them
+    clock.touch(1, 4096, 1.0);
+    clock.touch(3, 4096, 1.0);
+
+    std::size_t v1 = clock.evict();
+    std::size_t v2 = clock.evict();
+    std::cout << "clock victims: " << v1 << ", " << v2 << "\n";
+    if (v1 != 2 || v2 != 4) return false;
+
+    // inserting past capacity recycles a slot instead of growing, and
+    // hands back the block that lost it
+    if (clock.touch(5, 4096, 1.0) != kNone || clock.touch(6, 4096, 1.0) != kNone) return false;
+    std::size_t displaced = clock.touch(7, 4096, 1.0);
+    if (displaced != 1 && displaced != 3 && displaced != 6) return false;
+    if (clock.touch(7, 4096, 1.0) != kNone) return false;
+    clock.remove(7);
+    // hits on resident blocks are taken without the lock; others are not
+    if (!clock.hit(5, 1.0) || clock.hit(7, 1.0) || clock.hit(99, 1.0)) return false;
+
+    std::vector<std::thread> hitters;
+    std::atomic<int> missed{0};
+    for (int t = 0; t < 4; ++t) {
+        hitters.emplace_back([&clock, &missed] {
+            for (int i = 0; i < 10000; ++i) missed += !clock.hit(5, 1.0);
+        });
+    }
+    for (auto& th : hitters) th.join();
+    if (missed != 0) return false;
+
+    std::size_t drained = 0;
+    while (clock.evict() != kNone) ++drained;
+    std::cout << "clock drained " << drained << " entries\n";
+    return drained == 3;
+}
+
+static bool test_stacked() {
+    // nothing is past its TTL, so victims come from the capacity policy and
+    // are dropped from the TTL policy as well
+    StackedPolicy<TimePolicy, LruPolicy> stacked(3600, 8);
+    stacked.touch(1, 4096, 1.0);
+    stacked.touch(2, 4096, 1.0);
+
+    std::size_t v1 = stacked.evict();
+    std::size_t v2 = stacked.evict();
+    std::size_t v3 = stacked.evict();
+    std::cout << "stacked victims: " << v1 << ", " << v2 << "\n";
+    if (v1 == kNone || v2 == kNone || v1 == v2 || v3 != kNone) return false;
+
+    // a block the capacity policy displaces leaves the TTL policy too
+    StackedPolicy<TimePolicy, LruPolicy> bounded(0, 1);
+    bounded.touch(1, 4096, 1.0);
+    std::size_t displaced = bounded.touch(2, 4096, 1.0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+    std::vector<std::size_t> expired;
+    bounded.expire(expired);
+    return displaced == 1 && expired.size() == 1 && expired[0] == 2;
+}
+
+static bool test_decayed_frequency() {
+    // half-life of 60s: a block hit 1000 times a few ms ago must outrank a
+    // block hit once just now, and a prefetch-only block ranks below both
+    LruPolicy lru(8, 60.0);
+    for (int i = 0; i < 1000; ++i) lru.touch(1, 65536, 1.0);
+    lru.touch(3, 65536, 0.25);
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    lru.touch(2, 65536, 1.0);
+
+    std::size_t v1 = lru.evict();
+    std::size_t v2 = lru.evict();
+    std::size_t v3 = lru.evict();
+    std::cout << "decayed victims: " << v1 << ", " << v2 << ", " << v3 << "\n";
+    return v1 == 3 && v2 == 2 && v3 == 1;
+}
+
+static bool test_gdsf() {
+    static_assert(eviction::accepts_cost<GdsfPolicy>::value, "GDSF takes a refetch cost");
+
+    // same size and frequency: the block from the fast origin goes first
+    GdsfPolicy gdsf(8);
+    gdsf.touch(1, 65536, 1.0, 0.500);
+    gdsf.touch(2, 65536, 1.0, 0.001);
+    std::size_t v1 = gdsf.evict();
+
+    // a cheap block hit often enough outweighs an expensive one hit once
+    for (int i = 0; i < 1000; ++i) gdsf.touch(3, 65536, 1.0, 0.001);
+    std::size_t v2 = gdsf.evict();
+    std::size_t v3 = gdsf.evict();
+    std::cout << "gdsf victims: " << v1 << ", " << v2 << ", " << v3 << "\n";
+    if (v1 != 2 || v2 != 1 || v3 != 3 || gdsf.evict() != kNone) return false;
+
+    // past capacity the block making room is handed back, not lost
+    GdsfPolicy full(2);
+    full.touch(1, 65536, 1.0, 0.500);
+    full.touch(2, 65536, 1.0, 0.001);
+    return full.touch(3, 65536, 1.0, 0.500) == 2 && full.evict() != 2 && full.evict() != 2 &&
+           full.evict() == kNone;
+}
+
+static bool test_ttl_wheel() {
+    static_assert(eviction::has_expiry<StackedPolicy<TimePolicy, LruPolicy>>::value, "stacked TTL should expire");
+    static_assert(!eviction::has_expiry<LruPolicy>::value, "LRU has no expiry");
+
+    TimePolicy ttl(1);
+    for (std::size_t id = 0; id < 100000; ++id) ttl.touch(id);
+
+    std::vector<std::size_t> expired;
+    ttl.expire(expired);
+    if (!expired.empty() || ttl.evict() != kNone) return false;
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(2100));
+    ttl.touch(7);
+    ttl.remove(8);
+
+    std::size_t n = ttl.expire(expired);
+    std::cout << "ttl expired " << n << " entries in one batch\n";
+    return n == 99998 && expired.size() == n;
+}
+
+// Concurrent producers with a draining consumer: every access is either
+// dropped at record time or drained exactly once.
+static bool test_access_buffer() {
+    static constexpr std::size_t kThreads = 4, kPerThread = 20000;
+    AccessBuffer buf;
+    std::atomic<std::size_t> recorded{0};
+    std::atomic<bool> done{false};
+    std::vector<std::uint8_t> seen(kThreads * kPerThread, 0);
+    std::size_t drained = 0;
+    bool ok = true;
+    auto consume = [&](const AccessBuffer::Access& a) {
+        if (a.key >= seen.size() || seen[a.key]++ || a.part != a.key % 3) ok = false;
+        ++drained;
+    };
+
+    std::thread consumer([&] {
+        while (!done.load()) buf.drain(consume);
+    });
+    std::vector<std::thread> producers;
+    for (std::size_t t = 0; t < kThreads; ++t) {
+        producers.emplace_back([&, t] {
+            for (std::size_t i = 0; i < kPerThread; ++i) {
+                std::size_t key = t * kPerThread + i;
+                if (buf.record(key, std::uint16_t(key % 3), 1.0, 0.0) != 0)
+                    recorded.fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+    }
+    for (auto& p : producers) p.join();
+    done = true;
+    consumer.join();
+    buf.drain(consume);
+
+    std::cout << "access buffer kept " << drained << " of " << kThreads * kPerThread << " hits\n";
+    return ok && drained == recorded.load() && drained > 0;
+}
+
+// Ids are dense and stable, views survive the index growing, and a path
+// longer than an arena chunk still round-trips, as do the paths after it.
+static bool test_path_table() {
+    PathTable paths;
+    std::string_view first;
+    for (std::uint32_t i = 0; i < 50000; ++i) {
+        std::string p = "/dir" + std::to_string(i % 97) + "/file" + std::to_string(i);
+        if (paths.intern(p) != i) return false;
+        if (i == 0) first = paths.path(0);
+    }
+    std::string huge(3 << 20, 'x');
+    std::uint32_t big = paths.intern(huge);
+    std::string after(4096, 'y');
+    std::uint32_t next = paths.intern(after);
+    return paths.intern("/dir0/file0") == 0 && paths.find("/dir5/file5") == 5 &&
+           paths.find("/dir5/file6") == PathTable::kNone && first == "/dir0/file0" &&
+           paths.path(49999) == "/dir44/file49999" && paths.path(big) == huge && paths.path(next) == after &&
+           paths.size() == 50002;
+}
+
+int main() {
+    if (!test_clock()) {
+        std::cerr << "ClockPolicy FAILED\n";
+        return 1;
+    }
+    std::cout << "ClockPolicy OK\n";
+
+    if (!test_stacked()) {
+        std::cerr << "StackedPolicy FAILED\n";
+        return 1;
+    }
+    std::cout << "StackedPolicy OK\n";
+
+    if (!test_decayed_frequency()) {
+        std::cerr << "LruPolicy FAILED\n";
+        return 1;
+    }
+    std::cout << "LruPolicy OK\n";
+
+    if (!test_gdsf()) {
+        std::cerr << "GdsfPolicy FAILED\n";
+        return 1;
+    }
+    std::cout << "GdsfPolicy OK\n";
+
+    if (!test_ttl_wheel()) {
+        std::cerr << "TimePolicy FAILED\n";
+        return 1;
+    }
+    std::cout << "TimePolicy OK\n";
+
+    if (!test_access_buffer()) {
+        std::cerr << "AccessBuffer FAILED\n";
+        return 1;
+    }
+    std::cout << "AccessBuffer OK\n";
+
+    if (!test_path_table()) {
+        std::cerr << "PathTable FAILED\n";
+        return 1;
+    }
+    std::cout << "PathTable OK\n";
+    return 0;
+}
@@ -1,9 +1,50 @@
+#include <algorithm>
 #include <iostream>
 #include <cstring>
+#include <fstream>
+#include <string>
 #include <unistd.h>
 #include "cache/cache_manager.h"
+#include "cache/stream_tuner.h"
+
+// Streams are added while they raise throughput and dropped back once the
+// link is saturated. link is the bytes per second all streams share; one
+// stream alone gets at most per_stream.
+static std::size_t settle(double link, double per_stream, std::size_t rounds, std::size_t* lo, std::size_t* hi) {
+    StreamTuner tuner(1, 8, 2);
+    *lo = 8;
+    *hi = 1;
+    for (std::size_t r = 0; r < rounds; ++r) {
+        std::size_t n = tuner.streams();
+        double rate = std::min(per_stream, link / n);
+        for (std::size_t i = 0; i < n; ++i) tuner.record(static_cast<std::size_t>(rate), 1.0);
+        if (r >= rounds / 2) {
+            *lo = std::min(*lo, n);
+            *hi = std::max(*hi, n);
+        }
+    }
+    return tuner.streams();
+}
+
+static bool test_stream_tuner() {
+    std::size_t lo, hi;
+    // every stream gets its full rate: climb to the cap and stay near it
+    if (settle(1e12, 100e6, 100, &lo, &hi) < 7 || lo < 7) return false;
+    // three streams fill the link; probes may try one more or one fewer
+    settle(300e6, 100e6, 100, &lo, &hi);
+    if (lo < 2 || hi > 4) return false;
+    // a single stream already fills it
+    settle(100e6, 100e6, 100, &lo, &hi);
+    return hi <= 2;
+}
 
 int main() {
+    if (!test_stream_tuner()) {
+        std::cerr << "StreamTuner FAILED\n";
+        return 1;
+    }
+    std::cout << "StreamTuner OK\n";
+
     const char* backing_dir = "./cache_dir";
     const char* path        = "/foo.txt";
     const char* data        = "Hello, Cache Read!";
@@ -45,6 +86,29 @@ int main() {
         }
     }
 
+    // Blocks filled out of order leave holes in the part file; a hole must
+    // read as a miss, and a short final block must not be refetched as one.
+    {
+        const std::size_t kBlock = 64 * 1024;
+        std::string content(5 * kBlock + 100, '\0');
+        for (std::size_t i = 0; i < content.size(); ++i) content[i] = static_cast<char>('a' + i % 26);
+        std::ofstream(std::string(backing_dir) + "/holes.bin", std::ios::binary) << content;
+
+        std::string got(kBlock, '\0');
+        bool ok = cache_read_file("/holes.bin", &got[0], 100, 5 * kBlock) == 100 &&
+                  got.compare(0, 100, content, 5 * kBlock, 100) == 0;
+        ok = ok && cache_read_file("/holes.bin", &got[0], kBlock, 2 * kBlock) == static_cast<ssize_t>(kBlock) &&
+             got.compare(0, kBlock, content, 2 * kBlock, kBlock) == 0;
+        // past the end of the file
+        ok = ok && cache_read_file("/holes.bin", &got[0], kBlock, 5 * kBlock + 50) == 50 &&
+             cache_read_file("/holes.bin", &got[0], 10, 5 * kBlock + 100) == 0;
+        if (!ok) {
+            std::cerr << "cache_read_file (sparse blocks) FAILED\n";
+            return 1;
+        }
+        std::cout << "Read (sparse blocks) OK\n";
+    }
+
     cache_cleanup();
     std::cout << "cache_cleanup OK\n";
     return 0;